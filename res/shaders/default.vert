@@ -11,14 +11,39 @@ layout(binding = 0) uniform UniformBufferObject
     float time;
 } scene;
 
-layout( push_constant ) uniform Constants {
+struct Instance
+{
     mat4 model;
+};
+
+layout(std430, binding = 2) readonly buffer Instances
+{
+    Instance instances[];
+};
+
+layout( push_constant ) uniform Constants {
+    vec4 positionOffset;
+    vec4 positionScale;
+    uint firstInstance;
 } constants;
 
+#ifdef PACKED_VERTEX
+layout(location = 0) in vec4 packedPosition;
+layout(location = 1) in vec2 packedNormal;
+layout(location = 3) in vec2 uv;
+
+vec3 OctDecode(vec2 e)
+{
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+#else
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
-layout(location = 2) in vec3 color;
 layout(location = 3) in vec2 uv;
+#endif
 
 layout(location = 0) out vec3 normalOut;
 layout(location = 1) out vec3 FragPos;
@@ -32,8 +57,14 @@ layout(location = 2) out vec2 uvOut;
 //    gl_Position = vec4(positio, 0.0f, 1.0f);
 //}
 void main() {
-    gl_Position = scene.projview * constants.model * vec4(position, 1.0);
-    normalOut = vec3(constants.model * vec4(normal, 0.f));
-    FragPos = vec3(constants.model * vec4(position, 1.f));
+    mat4 model = instances[constants.firstInstance + gl_InstanceIndex].model;
+#ifdef PACKED_VERTEX
+    vec3 position = constants.positionOffset.xyz + packedPosition.xyz * constants.positionScale.xyz;
+    vec3 normal = OctDecode(packedNormal);
+#endif
+
+    gl_Position = scene.projview * model * vec4(position, 1.0);
+    normalOut = vec3(model * vec4(normal, 0.f));
+    FragPos = vec3(model * vec4(position, 1.f));
     uvOut = uv;
 }
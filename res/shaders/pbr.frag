@@ -23,9 +23,14 @@ layout(binding = 0) uniform UniformBufferObject
 // material parameters
 layout(set = 1, binding = 0) uniform sampler2D albedoMap;
 layout(set = 1, binding = 1) uniform sampler2D normalMap;
+#ifdef PACKED_ORM
+// Occlusion, roughness and specular in r, g and b
+layout(set = 1, binding = 2) uniform sampler2D ormMap;
+#else
 layout(set = 1, binding = 2) uniform sampler2D specularMap;
 layout(set = 1, binding = 3) uniform sampler2D roughnessMap;
 layout(set = 1, binding = 4) uniform sampler2D aoMap;
+#endif
 
 // lights
 vec3 lightPositions[1] = vec3[1](vec3(0, 0, 0));
@@ -53,7 +58,10 @@ vec4 SRGBtoLINEAR(vec4 srgbIn)
 
 vec3 getNormalFromMap()
 {
-    vec3 tangentNormal = texture(normalMap, TexCoords).xyz * 2.0 - 1.0;
+    // Only xy is stored when the map is compressed to two channels
+    vec3 tangentNormal;
+    tangentNormal.xy = texture(normalMap, TexCoords).xy * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
     vec3 N  = normalize(Normal);
     vec3 T  = normalize(Tangent);
@@ -108,15 +116,25 @@ void main()
 
     vec3 camPos = scene.viewPos;
     vec3 albedo     = pow(texture(albedoMap, TexCoords).rgb, vec3(2.2));
+#ifdef PACKED_ORM
+    vec3 orm        = texture(ormMap, TexCoords).rgb;
+    float ao        = orm.r;
+    float roughness = orm.g;
+#else
     float roughness = texture(roughnessMap, TexCoords).r;
     float ao        = texture(aoMap, TexCoords).r;
+#endif
 
     vec3 N = getNormalFromMap();
     vec3 V = normalize(camPos - WorldPos);
 
     // calculate reflectance at normal incidence; if dia-electric (like plastic) use F0
     // of 0.04 and if it's a metal, use the albedo color as F0 (metallic workflow)
+#ifdef PACKED_ORM
+    vec3 F0 = vec3(orm.b);
+#else
     vec3 F0 = vec3(texture(specularMap, TexCoords));
+#endif
 
     // reflectance equation
     vec3 Lo = vec3(0.0);
@@ -12,15 +12,41 @@ layout(binding = 0) uniform UniformBufferObject
     float time;
 } scene;
 
-layout( push_constant ) uniform Constants {
+struct Instance
+{
     mat4 model;
+};
+
+layout(std430, binding = 2) readonly buffer Instances
+{
+    Instance instances[];
+};
+
+layout( push_constant ) uniform Constants {
+    vec4 positionOffset;
+    vec4 positionScale;
+    uint firstInstance;
 } constants;
 
+#ifdef PACKED_VERTEX
+layout(location = 0) in vec4 packedPosition;
+layout(location = 1) in vec2 packedNormal;
+layout(location = 3) in vec2 uv;
+layout(location = 4) in vec2 packedTangent;
+
+vec3 OctDecode(vec2 e)
+{
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0)
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(v);
+}
+#else
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normal;
-layout(location = 2) in vec3 color;
 layout(location = 3) in vec2 uv;
 layout(location = 4) in vec4 tangent;
+#endif
 
 layout(location = 0) out vec3 normalOut;
 layout(location = 1) out vec3 FragPos;
@@ -36,11 +62,18 @@ layout(location = 4) out vec3 bin;
 //    gl_Position = vec4(positio, 0.0f, 1.0f);
 //}
 void main() {
-    FragPos = vec3(constants.model * vec4(position, 1.f));
+    mat4 model = instances[constants.firstInstance + gl_InstanceIndex].model;
+#ifdef PACKED_VERTEX
+    vec3 position = constants.positionOffset.xyz + packedPosition.xyz * constants.positionScale.xyz;
+    vec3 normal = OctDecode(packedNormal);
+    vec4 tangent = vec4(OctDecode(packedTangent), packedPosition.w * 2.0 - 1.0);
+#endif
+
+    FragPos = vec3(model * vec4(position, 1.f));
     gl_Position = scene.projview * vec4(FragPos, 1.f);
     uvOut = uv;
 
-    mat3 normalMatrix = transpose(inverse(mat3(constants.model)));
+    mat3 normalMatrix = transpose(inverse(mat3(model)));
     vec3 T = normalize(normalMatrix * vec3(tangent));
     vec3 N = normalize(normalMatrix * normal);
     T = normalize(T - dot(T, N) * N);
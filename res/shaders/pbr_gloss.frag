@@ -53,7 +53,10 @@ vec4 SRGBtoLINEAR(vec4 srgbIn)
 
 vec3 getNormalFromMap()
 {
-    vec3 tangentNormal = texture(normalMap, TexCoords).xyz * 2.0 - 1.0;
+    // Only xy is stored when the map is compressed to two channels
+    vec3 tangentNormal;
+    tangentNormal.xy = texture(normalMap, TexCoords).xy * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
     vec3 N  = normalize(Normal);
     vec3 T  = normalize(Tangent);
@@ -7,5 +7,7 @@ layout(location = 0) out vec4 colorOut;
 layout(set = 1, binding = 1) uniform sampler2D normal;
 
 void main() {
-    colorOut = vec4(texture(normal, uv).xyz, 1);
+    vec2 xy = texture(normal, uv).xy * 2.0 - 1.0;
+    float z = sqrt(max(1.0 - dot(xy, xy), 0.0));
+    colorOut = vec4(vec3(xy, z) * 0.5 + 0.5, 1);
 }
@@ -9,6 +9,7 @@
 #include "mesh_object.hpp"
 #include <glm/gtx/closest_point.hpp>
 #include <algorithm>
+#include <array>
 
 void Editor::InitWindow()
 {
@@ -43,6 +44,7 @@ void Editor::InitEngine()
 void Editor::InitPipelines()
 {
     m_debug.Init(m_engine);
+    m_mesh_renderer.Init(m_engine);
     m_engine.AddRecreateCallback([&](Engine& engine) {m_debug.Recreate(engine);});
 }
 
@@ -237,98 +239,144 @@ void Editor::InitImGui()
 
 void Editor::InitDefaultObjects()
 {
+    // Baked meshes and textures go next to the executable, not the sources
+    m_texture_manager.SetCacheDirectory(Files::Local("cache"));
+    m_mesh_manager.SetCacheDirectory(Files::Local("cache"));
     m_texture_manager.Init();
 
+    VertexAttributes pbrAttributes = VertexAttribute::Position | VertexAttribute::Normal |
+        VertexAttribute::TextureCoord | VertexAttribute::Tangent;
+    VertexAttributes defaultAttributes = VertexAttribute::Position | VertexAttribute::Normal |
+        VertexAttribute::TextureCoord;
+
     m_material_manager.FromShaders("PBR",
                                    Files::Local("res/shaders/pbr.vert"),
-                                   Files::Local("res/shaders/pbr.frag"));
+                                   Files::Local("res/shaders/pbr.frag"),
+                                   pbrAttributes);
+    m_material_manager.PackedTextures("PBR_ORM",
+                                      Files::Local("res/shaders/pbr.vert"),
+                                      Files::Local("res/shaders/pbr.frag"),
+                                      pbrAttributes);
     m_material_manager.FromShaders("PBR_Gloss",
                                    Files::Local("res/shaders/pbr.vert"),
-                                   Files::Local("res/shaders/pbr_gloss.frag"));
+                                   Files::Local("res/shaders/pbr_gloss.frag"),
+                                   pbrAttributes);
     m_material_manager.FromShaders("Model_UV",
                                    Files::Local("res/shaders/default.vert"),
-                                   Files::Local("res/shaders/model_uv.frag"));
+                                   Files::Local("res/shaders/model_uv.frag"),
+                                   defaultAttributes);
     m_material_manager.FromShaders("Model_Normal",
                                    Files::Local("res/shaders/default.vert"),
-                                   Files::Local("res/shaders/model_normal.frag"));
+                                   Files::Local("res/shaders/model_normal.frag"),
+                                   defaultAttributes);
     m_material_manager.FromShaders("Texture_Albedo",
                                    Files::Local("res/shaders/default.vert"),
-                                   Files::Local("res/shaders/texture_albedo.frag"));
+                                   Files::Local("res/shaders/texture_albedo.frag"),
+                                   defaultAttributes);
     m_material_manager.FromShaders("Texture_Normal",
                                    Files::Local("res/shaders/default.vert"),
-                                   Files::Local("res/shaders/texture_normal.frag"));
+                                   Files::Local("res/shaders/texture_normal.frag"),
+                                   defaultAttributes);
     m_material_manager.FromShaders("Texture_Specular",
                                    Files::Local("res/shaders/default.vert"),
-                                   Files::Local("res/shaders/texture_specular.frag"));
+                                   Files::Local("res/shaders/texture_specular.frag"),
+                                   defaultAttributes);
     m_material_manager.FromShaders("Texture_Roughness",
                                    Files::Local("res/shaders/default.vert"),
-                                   Files::Local("res/shaders/texture_roughness.frag"));
+                                   Files::Local("res/shaders/texture_roughness.frag"),
+                                   defaultAttributes);
     m_material_manager.FromShaders("Texture_AO",
                                    Files::Local("res/shaders/default.vert"),
-                                   Files::Local("res/shaders/texture_ao.frag"));
+                                   Files::Local("res/shaders/texture_ao.frag"),
+                                   defaultAttributes);
     m_material_manager.Textureless("White_Bloom",
                                   Files::Local("res/shaders/default.vert"),
-                                  Files::Local("res/shaders/white_bloom.frag"));
-
-
-    m_mesh_manager.NewFromObj("flintlock", Files::Local("res/models/fa_flintlockPistol.obj"));
-    m_mesh_manager.NewFromObj("pot", Files::Local("res/models/Pot.obj"));
-    m_mesh_manager.NewFromObj("cherry", Files::Local("res/models/cherry.obj"));
-    m_mesh_manager.NewFromObj("paper", Files::Local("res/models/br_tpaperRoll.obj"));
-    m_mesh_manager.NewFromObj("orange", Files::Local("res/models/fr_caraOrange.obj"));
-    m_mesh_manager.NewFromObj("lemon", Files::Local("res/models/fr_avalonLemon.obj"));
-    m_mesh_manager.NewFromObj("sun", Files::Local("res/models/sun.obj"));
-
-    m_texture_manager.NewFromFile("paper_ao", Files::Local("res/textures/br_tpaperRoll_ao.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("paper_nrm", Files::Local("res/textures/br_tpaperRoll_nrm.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("paper_rough", Files::Local("res/textures/br_tpaperRoll_rough.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("paper_specular", Files::Local("res/textures/br_tpaperRoll_specular.jpg"));
-    m_texture_manager.NewFromFile("paper_albedo", Files::Local("res/textures/br_tpaperRoll_albedo.jpg"));
-    m_texture_manager.NewFromFile("paper_scattering", Files::Local("res/textures/br_tpaperRoll_scattering.jpg"));
-
-    m_texture_manager.NewFromFile("flintlock_ao", Files::Local("res/textures/fa_flintlockPistol_ao.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("flintlock_nrm", Files::Local("res/textures/fa_flintlockPistol_nrm.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("flintlock_rough", Files::Local("res/textures/fa_flintlockPistol_rough.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("flintlock_specular", Files::Local("res/textures/fa_flintlockPistol_specular.jpg"));
-    m_texture_manager.NewFromFile("flintlock_albedo", Files::Local("res/textures/fa_flintlockPistol_albedo.jpg"));
-
-    m_texture_manager.NewFromFile("lemon_nrm", Files::Local("res/textures/fr_avalonLemon_nrm.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("lemon_rough", Files::Local("res/textures/fr_avalonLemon_rough.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("lemon_specular", Files::Local("res/textures/fr_avalonLemon_specular.jpg"));
-    m_texture_manager.NewFromFile("lemon_albedo", Files::Local("res/textures/fr_avalonLemon_albedo.jpg"));
-
-    m_texture_manager.NewFromFile("orange_nrm", Files::Local("res/textures/fr_caraOrange_nrm.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("orange_rough", Files::Local("res/textures/fr_caraOrange_rough.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("orange_specular", Files::Local("res/textures/fr_caraOrange_specular.jpg"));
-    m_texture_manager.NewFromFile("orange_albedo", Files::Local("res/textures/fr_caraOrange_albedo.jpg"));
-    m_texture_manager.NewFromFile("orange_scattering", Files::Local("res/textures/fr_caraOrange_scattering.jpg"), vk::Format::eR8G8B8A8Unorm);
-
-    m_texture_manager.NewFromFile("pot_specular", Files::Local("res/textures/pot_specular.jpg"));
-    m_texture_manager.NewFromFile("pot_normal", Files::Local("res/textures/pot_normal.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("pot_gloss", Files::Local("res/textures/pot_gloss.jpg"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("pot_albedo", Files::Local("res/textures/pot_albedo.jpg"));
-
-    m_texture_manager.NewFromFile("cherry_specular", Files::Local("res/textures/cherry_specular.tga.png"));
-    m_texture_manager.NewFromFile("cherry_normal", Files::Local("res/textures/cherry_normal.tga.png"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("cherry_gloss", Files::Local("res/textures/cherry_gloss.tga.png"), vk::Format::eR8G8B8A8Unorm);
-    m_texture_manager.NewFromFile("cherry_color", Files::Local("res/textures/cherry_color.tga.png"));
-    m_texture_manager.NewFromFile("cherry_ao", Files::Local("res/textures/cherry_ao.tga.png"), vk::Format::eR8G8B8A8Unorm);
-
-    m_texture_manager.NewFromFile("sun_color", Files::Local("res/textures/sun.jpg"));
+                                  Files::Local("res/shaders/white_bloom.frag"),
+                                  defaultAttributes);
+
+
+    MeshImportOptions importOptions {
+        .optimize = true,
+        .vertexFormat = VertexFormat::Packed,
+        .split16 = true,
+        .lodCount = 4,
+        .meshlets = true,
+        .retention = MeshRetention::Drop
+    };
+    m_mesh_manager.LoadObjAsync("flintlock", Files::Local("res/models/fa_flintlockPistol.obj"), importOptions);
+    m_mesh_manager.LoadObjAsync("pot", Files::Local("res/models/Pot.obj"), importOptions);
+    m_mesh_manager.LoadObjAsync("cherry", Files::Local("res/models/cherry.obj"), importOptions);
+    m_mesh_manager.LoadObjAsync("paper", Files::Local("res/models/br_tpaperRoll.obj"), importOptions);
+    m_mesh_manager.LoadObjAsync("orange", Files::Local("res/models/fr_caraOrange.obj"), importOptions);
+    m_mesh_manager.LoadObjAsync("lemon", Files::Local("res/models/fr_avalonLemon.obj"), importOptions);
+    m_mesh_manager.LoadObjAsync("sun", Files::Local("res/models/sun.obj"), importOptions);
+
+    const TextureLoadOptions colorOptions {.compress = true};
+    const TextureLoadOptions normalOptions {.channels = TextureChannels::Rg, .compress = true};
+    TextureBatch textures;
+    textures.AddOrm("paper_orm", {
+            .occlusion = Files::Local("res/textures/br_tpaperRoll_ao.jpg"),
+            .roughness = Files::Local("res/textures/br_tpaperRoll_rough.jpg"),
+            .specular = Files::Local("res/textures/br_tpaperRoll_specular.jpg")
+        }, colorOptions);
+    textures.Add("paper_nrm", Files::Local("res/textures/br_tpaperRoll_nrm.jpg"), vk::Format::eR8G8B8A8Unorm, normalOptions);
+    textures.Add("paper_albedo", Files::Local("res/textures/br_tpaperRoll_albedo.jpg"), vk::Format::eR8G8B8A8Srgb, colorOptions);
+    textures.Add("paper_scattering", Files::Local("res/textures/br_tpaperRoll_scattering.jpg"), vk::Format::eR8G8B8A8Srgb, colorOptions);
+
+    textures.AddOrm("flintlock_orm", {
+            .occlusion = Files::Local("res/textures/fa_flintlockPistol_ao.jpg"),
+            .roughness = Files::Local("res/textures/fa_flintlockPistol_rough.jpg"),
+            .specular = Files::Local("res/textures/fa_flintlockPistol_specular.jpg")
+        }, colorOptions);
+    textures.Add("flintlock_nrm", Files::Local("res/textures/fa_flintlockPistol_nrm.jpg"), vk::Format::eR8G8B8A8Unorm, normalOptions);
+    textures.Add("flintlock_albedo", Files::Local("res/textures/fa_flintlockPistol_albedo.jpg"), vk::Format::eR8G8B8A8Srgb, colorOptions);
+
+    textures.Add("lemon_nrm", Files::Local("res/textures/fr_avalonLemon_nrm.jpg"), vk::Format::eR8G8B8A8Unorm, normalOptions);
+    textures.AddOrm("lemon_orm", {
+            .roughness = Files::Local("res/textures/fr_avalonLemon_rough.jpg"),
+            .specular = Files::Local("res/textures/fr_avalonLemon_specular.jpg")
+        }, colorOptions);
+    textures.Add("lemon_albedo", Files::Local("res/textures/fr_avalonLemon_albedo.jpg"), vk::Format::eR8G8B8A8Srgb, colorOptions);
+
+    textures.Add("orange_nrm", Files::Local("res/textures/fr_caraOrange_nrm.jpg"), vk::Format::eR8G8B8A8Unorm, normalOptions);
+    textures.AddOrm("orange_orm", {
+            .roughness = Files::Local("res/textures/fr_caraOrange_rough.jpg"),
+            .specular = Files::Local("res/textures/fr_caraOrange_specular.jpg")
+        }, colorOptions);
+    textures.Add("orange_albedo", Files::Local("res/textures/fr_caraOrange_albedo.jpg"), vk::Format::eR8G8B8A8Srgb, colorOptions);
+    textures.Add("orange_scattering", Files::Local("res/textures/fr_caraOrange_scattering.jpg"), vk::Format::eR8G8B8A8Unorm, colorOptions);
+
+    textures.AddOrm("pot_orm", {
+            .roughness = Files::Local("res/textures/pot_gloss.jpg"),
+            .specular = Files::Local("res/textures/pot_specular.jpg"),
+            .gloss = true
+        }, colorOptions);
+    textures.Add("pot_normal", Files::Local("res/textures/pot_normal.jpg"), vk::Format::eR8G8B8A8Unorm, normalOptions);
+    textures.Add("pot_albedo", Files::Local("res/textures/pot_albedo.jpg"), vk::Format::eR8G8B8A8Srgb, colorOptions);
+
+    textures.AddOrm("cherry_orm", {
+            .occlusion = Files::Local("res/textures/cherry_ao.tga.png"),
+            .roughness = Files::Local("res/textures/cherry_gloss.tga.png"),
+            .specular = Files::Local("res/textures/cherry_specular.tga.png"),
+            .gloss = true
+        }, colorOptions);
+    textures.Add("cherry_normal", Files::Local("res/textures/cherry_normal.tga.png"), vk::Format::eR8G8B8A8Unorm, normalOptions);
+    textures.Add("cherry_color", Files::Local("res/textures/cherry_color.tga.png"), vk::Format::eR8G8B8A8Srgb, colorOptions);
+
+    textures.Add("sun_color", Files::Local("res/textures/sun.jpg"));
+    m_texture_manager.LoadAsync(std::move(textures));
 
     auto paper = std::make_shared<MeshObject>(
         m_mesh_renderer,
         m_mesh_manager.Get("paper"),
-        m_material_manager.Get("PBR"),
-        m_texture_manager.NewTextureSet(
+        m_material_manager.Get("PBR_ORM"),
+        m_texture_manager.NewPackedTextureSet(
             m_texture_manager.Get("paper_albedo"),
             m_texture_manager.Get("paper_nrm"),
-            m_texture_manager.Get("paper_specular"),
-            m_texture_manager.Get("paper_rough"),
-            m_texture_manager.Get("paper_ao")
+            m_texture_manager.Get("paper_orm")
             ),
         m_material_manager);
-    paper->mesh_center = paper->GetMesh()->surfaceCenter;
+    paper->center_on_surface = true;
     paper->scale = 10;
 
     m_objects.Add("Paper", paper);
@@ -352,23 +400,21 @@ void Editor::InitDefaultObjects()
             nullptr
             ),
         m_material_manager);
-    sun->mesh_center = sun->GetMesh()->surfaceCenter;
+    sun->center_on_surface = true;
     m_objects.Add("Sun", sun);
 
     auto flintlock = std::make_shared<MeshObject>(
         m_mesh_renderer,
         m_mesh_manager.Get("flintlock"),
-        m_material_manager.Get("PBR"),
-        m_texture_manager.NewTextureSet(
+        m_material_manager.Get("PBR_ORM"),
+        m_texture_manager.NewPackedTextureSet(
             m_texture_manager.Get("flintlock_albedo"),
             m_texture_manager.Get("flintlock_nrm"),
-            m_texture_manager.Get("flintlock_specular"),
-            m_texture_manager.Get("flintlock_rough"),
-            m_texture_manager.Get("flintlock_ao")
+            m_texture_manager.Get("flintlock_orm")
             ),
         m_material_manager);
     flintlock->scale = 10;
-    flintlock->mesh_center = flintlock->GetMesh()->surfaceCenter;
+    flintlock->center_on_surface = true;
     m_objects.Add("Flintlock", flintlock);
     m_orbit.push_back({
             .object = flintlock,
@@ -378,20 +424,19 @@ void Editor::InitDefaultObjects()
             .objAxis = {glm::normalize(glm::vec3(2, 1, 2.5))}
         });
 
+    m_field_textures = m_texture_manager.NewPackedTextureSet(
+        m_texture_manager.Get("lemon_albedo"),
+        m_texture_manager.Get("lemon_nrm"),
+        m_texture_manager.Get("lemon_orm")
+        );
     auto lemon = std::make_shared<MeshObject>(
         m_mesh_renderer,
         m_mesh_manager.Get("lemon"),
-        m_material_manager.Get("PBR"),
-        m_texture_manager.NewTextureSet(
-            m_texture_manager.Get("lemon_albedo"),
-            m_texture_manager.Get("lemon_nrm"),
-            m_texture_manager.Get("lemon_specular"),
-            m_texture_manager.Get("lemon_rough"),
-            nullptr
-            ),
+        m_material_manager.Get("PBR_ORM"),
+        m_field_textures,
         m_material_manager);
     lemon->scale = 10;
-    lemon->mesh_center = lemon->GetMesh()->surfaceCenter;
+    lemon->center_on_surface = true;
     m_objects.Add("Lemon", lemon);
     m_orbit.push_back({
             .object = lemon,
@@ -404,17 +449,15 @@ void Editor::InitDefaultObjects()
     auto orange = std::make_shared<MeshObject>(
         m_mesh_renderer,
         m_mesh_manager.Get("orange"),
-        m_material_manager.Get("PBR"),
-        m_texture_manager.NewTextureSet(
+        m_material_manager.Get("PBR_ORM"),
+        m_texture_manager.NewPackedTextureSet(
             m_texture_manager.Get("orange_albedo"),
             m_texture_manager.Get("orange_nrm"),
-            m_texture_manager.Get("orange_specular"),
-            m_texture_manager.Get("orange_rough"),
-            nullptr
+            m_texture_manager.Get("orange_orm")
             ),
         m_material_manager);
     orange->scale = 10;
-    orange->mesh_center = orange->GetMesh()->surfaceCenter;
+    orange->center_on_surface = true;
     m_objects.Add("Orange", orange);
     m_orbit.push_back({
             .object = orange,
@@ -427,17 +470,15 @@ void Editor::InitDefaultObjects()
     auto pot = std::make_shared<MeshObject>(
         m_mesh_renderer,
         m_mesh_manager.Get("pot"),
-        m_material_manager.Get("PBR_Gloss"),
-        m_texture_manager.NewTextureSet(
+        m_material_manager.Get("PBR_ORM"),
+        m_texture_manager.NewPackedTextureSet(
             m_texture_manager.Get("pot_albedo"),
             m_texture_manager.Get("pot_normal"),
-            m_texture_manager.Get("pot_specular"),
-            m_texture_manager.Get("pot_gloss"),
-            nullptr
+            m_texture_manager.Get("pot_orm")
             ),
         m_material_manager);
     pot->scale = 0.001;
-    pot->mesh_center = pot->GetMesh()->surfaceCenter;
+    pot->center_on_surface = true;
 
     m_objects.Add("Pot", pot);
     m_orbit.push_back({
@@ -451,17 +492,15 @@ void Editor::InitDefaultObjects()
     auto cherry = std::make_shared<MeshObject>(
         m_mesh_renderer,
         m_mesh_manager.Get("cherry"),
-        m_material_manager.Get("PBR_Gloss"),
-        m_texture_manager.NewTextureSet(
+        m_material_manager.Get("PBR_ORM"),
+        m_texture_manager.NewPackedTextureSet(
             m_texture_manager.Get("cherry_color"),
             m_texture_manager.Get("cherry_normal"),
-            m_texture_manager.Get("cherry_specular"),
-            m_texture_manager.Get("cherry_gloss"),
-            m_texture_manager.Get("cherry_ao")
+            m_texture_manager.Get("cherry_orm")
             ),
         m_material_manager);
     cherry->scale = 0.001;
-    cherry->mesh_center = cherry->GetMesh()->surfaceCenter;
+    cherry->center_on_surface = true;
     m_orbit.push_back({
             .object = cherry,
             .center = {0, 0, 0},
@@ -487,6 +526,27 @@ void Editor::ImGuiFrame()
     ImGui::Text("Average %.3f ms/frame (%.1f FPS)",
                 1000.0f / ImGui::GetIO().Framerate,
                 ImGui::GetIO().Framerate);
+    ImGui::Text("Textures %.1f / %.1f MiB",
+                m_texture_manager.GetResidentBytes() / (1024.0f * 1024.0f),
+                m_texture_manager.GetBudget() / (1024.0f * 1024.0f));
+    const auto& stats = m_mesh_renderer.GetStats();
+    ImGui::Text("Draws %u (%u instances, %u culled), binds: %u pipeline, %u descriptor, %u buffer",
+                stats.draws, stats.instances, stats.culled, stats.pipelineBinds,
+                stats.descriptorBinds, stats.bufferBinds);
+    const std::array arenas {&m_engine.GetVertexArena(), &m_engine.GetIndexArena(),
+                             &m_engine.GetMeshletArena()};
+    vk::DeviceSize geometryUsed = 0;
+    vk::DeviceSize geometryCapacity = 0;
+    for (const GeometryArena* arena : arenas)
+    {
+        geometryUsed += arena->GetUsed();
+        geometryCapacity += arena->GetCapacity();
+    }
+    ImGui::Text("Geometry %.1f / %.1f MiB",
+                geometryUsed / (1024.0f * 1024.0f), geometryCapacity / (1024.0f * 1024.0f));
+    ImGui::Text("GPU scene %u objects in %u batches", stats.sceneObjects, stats.sceneBatches);
+    if (ImGui::SliderInt("Lemon field", &m_field_size, 0, 200))
+        ResizeField();
     if (ImGui::Button("Recompile Shaders"))
     {
         m_engine.GetDevice().waitIdle();
@@ -552,6 +612,28 @@ void Editor::ImGuiFrame()
     ImGui::End();
 }
 
+void Editor::ResizeField()
+{
+    for (auto id : m_field)
+        m_mesh_renderer.RemoveObject(id);
+    m_field.clear();
+
+    auto mesh = m_mesh_manager.Get("lemon");
+    auto material = m_material_manager.Get("PBR_ORM");
+    constexpr float spacing = 2.0f;
+    float offset = (m_field_size - 1) * spacing * 0.5f;
+    for (int x = 0; x < m_field_size; x++)
+    {
+        for (int z = 0; z < m_field_size; z++)
+        {
+            glm::vec3 position {x * spacing - offset, -5.0f, z * spacing - offset};
+            glm::mat4 model = glm::translate(glm::identity<glm::mat4>(), position);
+            model = glm::scale(model, glm::vec3(10.0f));
+            m_field.push_back(m_mesh_renderer.AddObject(mesh, material, m_field_textures, model));
+        }
+    }
+}
+
 void Editor::ImGuiEditorObjects()
 {
     if (ImGui::Begin("Objects"))
@@ -626,6 +708,10 @@ void Editor::Loop()
 
 void Editor::DrawFrame(float lag)
 {
+    // Assets that finished streaming in are swapped in between frames
+    m_mesh_manager.Update();
+    m_texture_manager.Update();
+
     m_debug.Begin();
     if (m_objects.SelectedSize())
     {
@@ -652,18 +738,24 @@ void Editor::DrawFrame(float lag)
     ImGui::Render();
     //m_engine.DrawFrame(lag);
     auto cmd = m_engine.BeginFrame();
-    m_engine.BeginRenderPass(cmd);
+    m_mesh_renderer.Cull(cmd, m_engine);
+    m_engine.BeginRenderPass(cmd, vk::SubpassContents::eSecondaryCommandBuffers);
 
-    m_mesh_renderer.WriteCmdBuffer(cmd, m_engine);
+    auto secondaries = m_mesh_renderer.WriteSecondary(m_engine);
 
+    // Editor objects and debug draws are few, they share one buffer
+    auto objects = m_engine.BeginSecondary(0);
     for (auto& entry : m_objects)
     {
         if (entry.is_enabled)
-            entry.object->Draw(cmd, m_engine);
+            entry.object->Draw(objects, m_engine);
     }
 
-    m_debug.WriteCmdBuffer(cmd, m_engine);
+    m_debug.WriteCmdBuffer(objects, m_engine);
+    objects.end();
+    secondaries.push_back(objects);
 
+    cmd.executeCommands(secondaries);
     m_engine.EndRenderPass(cmd);
     m_engine.EndFrame();
 }
@@ -45,6 +45,7 @@ private:
     void Update(float delta);
     void ImGuiFrame();
     void ImGuiEditorObjects();
+    void ResizeField();
     void DrawFrame(float lag);
     void Loop();
     void Terminate();
@@ -96,5 +97,10 @@ private:
     };
     std::vector<Orbit> m_orbit;
 
+    // Grid of lemons drawn through the GPU scene, side length in objects
+    int m_field_size = 0;
+    std::vector<MeshRenderer::ObjectId> m_field;
+    TextureSet::Ptr m_field_textures;
+
     std::optional<int> focused;
 };
@@ -18,6 +18,7 @@
 #include <Tracy.hpp>
 #include <TracyVulkan.hpp>
 #include "initializers.hpp"
+#include "thread_pool.hpp"
 
 const std::vector<const char*> Engine::s_validationLayers = {
     "VK_LAYER_KHRONOS_validation"
@@ -108,6 +109,8 @@ namespace {
     {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
+        // A transfer only family when there is one, graphics otherwise
+        uint32_t transferFamily;
 
         bool IsComplete()
         {
@@ -141,6 +144,27 @@ namespace {
             i++;
         }
 
+        // Prefer families without compute as well, those are the DMA engines
+        indices.transferFamily = indices.graphicsFamily.value_or(0);
+        int bestScore = 0;
+        for (uint32_t family = 0; family < queueFamilies.size(); family++)
+        {
+            const auto& properties = queueFamilies[family];
+            auto granularity = properties.minImageTransferGranularity;
+            if (!(properties.queueFlags & vk::QueueFlagBits::eTransfer) ||
+                properties.queueFlags & vk::QueueFlagBits::eGraphics ||
+                granularity.width != 1 || granularity.height != 1 ||
+                granularity.depth != 1)
+                continue;
+
+            int score = properties.queueFlags & vk::QueueFlagBits::eCompute ? 1 : 2;
+            if (score > bestScore)
+            {
+                bestScore = score;
+                indices.transferFamily = family;
+            }
+        }
+
         return indices;
     }
 
@@ -221,6 +245,51 @@ void Engine::SetupDebugMessenger()
         createInfo, nullptr, m_dispatcher);
 }
 
+namespace {
+    bool HasExtension(const std::vector<vk::ExtensionProperties>& available,
+                      std::string_view name)
+    {
+        return std::ranges::any_of(available, [name](const vk::ExtensionProperties& extension) {
+            return std::string_view(extension.extensionName) == name;
+        });
+    }
+
+    // Features core in Vulkan 1.2 that a 1.1 device may have as extensions
+    struct Vulkan12Support
+    {
+        bool core = false;
+        bool timelineSemaphore = false;
+        bool drawIndirectCount = false;
+    };
+
+    Vulkan12Support QueryVulkan12Support(const vk::PhysicalDevice& device)
+    {
+        Vulkan12Support result;
+        if (device.getProperties().apiVersion >= VK_API_VERSION_1_2)
+        {
+            auto supported = device.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                                 vk::PhysicalDeviceVulkan12Features>();
+            const auto& features = supported.get<vk::PhysicalDeviceVulkan12Features>();
+            result.core = true;
+            result.timelineSemaphore = features.timelineSemaphore;
+            result.drawIndirectCount = features.drawIndirectCount;
+            return result;
+        }
+
+        auto available = device.enumerateDeviceExtensionProperties();
+        if (HasExtension(available, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME))
+        {
+            auto supported = device.getFeatures2<vk::PhysicalDeviceFeatures2,
+                                                 vk::PhysicalDeviceTimelineSemaphoreFeatures>();
+            result.timelineSemaphore =
+                supported.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>().timelineSemaphore;
+        }
+        result.drawIndirectCount =
+            HasExtension(available, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        return result;
+    }
+}
+
 bool CheckDeviceExtensionSupport(const vk::PhysicalDevice& device) {
 
     auto availableExtensions = device.enumerateDeviceExtensionProperties();
@@ -248,7 +317,18 @@ bool Engine::IsDeviceSuitable(const vk::PhysicalDevice& device)
         swapChainOk = !details.formats.empty() && !details.presentModes.empty();
     }
 
-    return indices.IsComplete() && extensionsSupported && swapChainOk;
+    if (!indices.IsComplete() || !extensionsSupported || !swapChainOk)
+        return false;
+
+    // Upload completion is tracked with timeline semaphores
+    if (!QueryVulkan12Support(device).timelineSemaphore)
+    {
+        spdlog::warn("{} has neither Vulkan 1.2 nor VK_KHR_timeline_semaphore, skipping it",
+                     device.getProperties().deviceName);
+        return false;
+    }
+
+    return true;
 }
 
 void Engine::PickPhysicalDevice()
@@ -287,34 +367,87 @@ void Engine::CreateLogicalDevice()
     std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies
         {indices.graphicsFamily.value(),
-         indices.presentFamily.value()};
+         indices.presentFamily.value(),
+         indices.transferFamily};
 
+    // Read by createDevice, so it has to outlive the loop
+    const float priority = 1.f;
     for (auto queueFamily : uniqueQueueFamilies)
     {
         vk::DeviceQueueCreateInfo queueCreateInfo;
         queueCreateInfo.queueCount = 1;
-        queueCreateInfo.queueFamilyIndex = indices.graphicsFamily.value();
-        float priority = 1.f;
+        queueCreateInfo.queueFamilyIndex = queueFamily;
         queueCreateInfo.pQueuePriorities = &priority;
 
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    auto supportedFeatures = m_physicalDevice.getFeatures();
+
     vk::PhysicalDeviceFeatures deviceFeatures;
     deviceFeatures.fillModeNonSolid = VK_TRUE;
+    // Block compressed textures fall back to uncompressed without it
+    deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    // GPU driven draws issue one command per draw without them
+    deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    m_multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    // Indirect commands can only pick their instance with it, GPU driven
+    // draws pass it as a push constant otherwise
+    deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+    m_drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
 
     vk::DeviceCreateInfo createInfo;
     createInfo.queueCreateInfoCount = queueCreateInfos.size();
     createInfo.pEnabledFeatures = &deviceFeatures;
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
-    createInfo.enabledExtensionCount = s_deviceExtensions.size();
-    createInfo.ppEnabledExtensionNames = s_deviceExtensions.data();
+
+    // Memory budgets come from the driver when it reports them
+    std::vector<const char*> extensions = s_deviceExtensions;
+    auto available = m_physicalDevice.enumerateDeviceExtensionProperties();
+    m_memoryBudget = HasExtension(available, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (m_memoryBudget)
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    // Timeline semaphores are checked by IsDeviceSuitable, on Vulkan 1.1
+    // they and drawIndirectCount come from their extensions
+    auto vulkan12 = QueryVulkan12Support(m_physicalDevice);
+    m_drawIndirectCount = vulkan12.drawIndirectCount;
+    vk::PhysicalDeviceVulkan12Features vulkan12Features;
+    vk::PhysicalDeviceTimelineSemaphoreFeatures timelineFeatures;
+    if (vulkan12.core)
+    {
+        vulkan12Features.timelineSemaphore = VK_TRUE;
+        vulkan12Features.drawIndirectCount = vulkan12.drawIndirectCount;
+        createInfo.pNext = &vulkan12Features;
+    }
+    else
+    {
+        timelineFeatures.timelineSemaphore = VK_TRUE;
+        createInfo.pNext = &timelineFeatures;
+        extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+        if (m_drawIndirectCount)
+            extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+
+    createInfo.setPEnabledExtensionNames(extensions);
 
 
     m_device = m_physicalDevice.createDeviceUnique(createInfo);
 
+    // Calls promoted to 1.2 go through the dispatcher, which points them at
+    // the extension entry points on 1.1
+    m_dispatcher.init(*m_device);
+    if (!vulkan12.core)
+    {
+        m_dispatcher.vkWaitSemaphores = m_dispatcher.vkWaitSemaphoresKHR;
+        m_dispatcher.vkGetSemaphoreCounterValue = m_dispatcher.vkGetSemaphoreCounterValueKHR;
+        m_dispatcher.vkCmdDrawIndexedIndirectCount =
+            m_dispatcher.vkCmdDrawIndexedIndirectCountKHR;
+    }
+
     m_graphicsQueue = m_device->getQueue(indices.graphicsFamily.value(), 0);
     m_presentQueue = m_device->getQueue(indices.presentFamily.value(), 0);
+    m_transferQueue = m_device->getQueue(indices.transferFamily, 0);
 }
 
 void Engine::CreateSurface()
@@ -992,15 +1125,23 @@ void Engine::CreateCommandPool()
     poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
     poolInfo.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
 
+    // One recorder per pool thread and one for the calling thread
+    vk::CommandPoolCreateInfo recorderPoolInfo;
+    recorderPoolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+    recorderPoolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    std::size_t recorderCount = ThreadPool::Global().GetThreadCount() + 1;
+
     for (auto& frame : m_frames)
     {
         frame.commandPool = m_device->createCommandPoolUnique(poolInfo);
-    }
-
-    vk::CommandPoolCreateInfo uploadPoolInfo;
-    uploadPoolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-    m_uploadCommandPool = m_device->createCommandPoolUnique(uploadPoolInfo);
+        frame.recorders.clear();
+        frame.recorders.resize(recorderCount);
+        for (auto& recorder : frame.recorders)
+        {
+            recorder.pool = m_device->createCommandPoolUnique(recorderPoolInfo);
+        }
+    }
 }
 
 void Engine::CreateCommandBuffers()
@@ -1020,6 +1161,38 @@ void Engine::RecreateCommandBuffer()
 {
     ZoneScoped;
     CurrentFrame().commandBuffer->reset();
+    for (auto& recorder : CurrentFrame().recorders)
+    {
+        m_device->resetCommandPool(*recorder.pool);
+        recorder.used = 0;
+    }
+}
+
+vk::CommandBuffer Engine::BeginSecondary(std::size_t recorder)
+{
+    auto& current = CurrentFrame().recorders.at(recorder);
+    if (current.used == current.buffers.size())
+    {
+        vk::CommandBufferAllocateInfo allocInfo;
+        allocInfo.commandPool = *current.pool;
+        allocInfo.level = vk::CommandBufferLevel::eSecondary;
+        allocInfo.commandBufferCount = 1;
+        current.buffers.push_back(std::move(m_device->allocateCommandBuffersUnique(allocInfo).front()));
+    }
+    vk::CommandBuffer cmd = *current.buffers[current.used++];
+
+    vk::CommandBufferInheritanceInfo inheritanceInfo;
+    inheritanceInfo.renderPass = *m_renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = *m_sceneFramebuffers[m_currentImageIndex];
+
+    vk::CommandBufferBeginInfo beginInfo;
+    beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+        | vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+    cmd.begin(beginInfo);
+
+    return cmd;
 }
 
 void Engine::CreateSyncObjects()
@@ -1037,10 +1210,6 @@ void Engine::CreateSyncObjects()
         frame.presentSemaphore = m_device->createSemaphoreUnique(semaphoreInfo);
         frame.renderFence = m_device->createFenceUnique(fenceInfo);
     }
-
-
-    vk::FenceCreateInfo uploadFenceInfo;
-    m_uploadFence = m_device->createFenceUnique(uploadFenceInfo);
 }
 
 uint32_t Engine::FindMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties)
@@ -1107,7 +1276,14 @@ void Engine::CreateGlobalSetLayout()
     cubemapLayoutBinding.descriptorCount = 1;
     cubemapLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
 
-    auto bindings = {uboLayoutBinding, cubemapLayoutBinding};
+    // Instance transforms, written by MeshRenderer
+    vk::DescriptorSetLayoutBinding instanceLayoutBinding;
+    instanceLayoutBinding.binding = 2;
+    instanceLayoutBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+    instanceLayoutBinding.descriptorCount = 1;
+    instanceLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eVertex;
+
+    auto bindings = {uboLayoutBinding, cubemapLayoutBinding, instanceLayoutBinding};
     vk::DescriptorSetLayoutCreateInfo layoutInfo;
     layoutInfo.setBindings(bindings);
 
@@ -1153,6 +1329,48 @@ void Engine::CreateTextureSetLayout()
     m_textureSetLayout = m_device->createDescriptorSetLayoutUnique(layoutInfo);
 }
 
+void Engine::CreatePackedTextureSetLayout()
+{
+    vk::DescriptorSetLayoutBinding albedo;
+    albedo.binding = 0;
+    albedo.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    albedo.descriptorCount = 1;
+    albedo.stageFlags = vk::ShaderStageFlagBits::eFragment;
+
+    vk::DescriptorSetLayoutBinding normal;
+    normal.binding = 1;
+    normal.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    normal.descriptorCount = 1;
+    normal.stageFlags = vk::ShaderStageFlagBits::eFragment;
+
+    // Occlusion, roughness and specular in r, g and b
+    vk::DescriptorSetLayoutBinding orm;
+    orm.binding = 2;
+    orm.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    orm.descriptorCount = 1;
+    orm.stageFlags = vk::ShaderStageFlagBits::eFragment;
+
+    auto bindings = {albedo, normal, orm};
+    vk::DescriptorSetLayoutCreateInfo layoutInfo;
+    layoutInfo.setBindings(bindings);
+
+    m_packedTextureSetLayout = m_device->createDescriptorSetLayoutUnique(layoutInfo);
+}
+
+void Engine::CreateGeometryBlockSetLayout()
+{
+    vk::DescriptorSetLayoutBinding block;
+    block.binding = 0;
+    block.descriptorType = vk::DescriptorType::eStorageBuffer;
+    block.descriptorCount = 1;
+    block.stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+    vk::DescriptorSetLayoutCreateInfo layoutInfo;
+    layoutInfo.setBindings(block);
+
+    m_geometryBlockSetLayout = m_device->createDescriptorSetLayoutUnique(layoutInfo);
+}
+
 void Engine::CreateBloomDescriptorSetLayouts()
 {
     vk::DescriptorSetLayoutBinding inputImage;
@@ -1197,13 +1415,15 @@ void Engine::CreateDescriptorPool()
         {vk::DescriptorType::eUniformBuffer, 100},
         {vk::DescriptorType::eSampledImage, 100},
         {vk::DescriptorType::eSampler, 100},
-        {vk::DescriptorType::eCombinedImageSampler, 100}
+        {vk::DescriptorType::eCombinedImageSampler, 100},
+        {vk::DescriptorType::eStorageBuffer, 200}
     };
 
     vk::DescriptorPoolCreateInfo poolInfo;
+    poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
     poolInfo.setPoolSizes(sizes);
 
-    poolInfo.maxSets = 10;
+    poolInfo.maxSets = 100;
     m_descriptorPool = m_device->createDescriptorPoolUnique(poolInfo);
 }
 
@@ -1225,32 +1445,37 @@ void Engine::CreateBloomDescriptorPool()
 
 void Engine::CreateDescriptorSets()
 {
-    for (auto& frame : m_frames)
+    for (unsigned i = 0; i < m_frames.size(); i++)
     {
-        vk::DescriptorSetAllocateInfo allocInfo;
+        m_frames[i].globalDescriptor = CreateGlobalSet(i);
+    }
+}
 
-        allocInfo.descriptorPool = *m_descriptorPool;
-        allocInfo.descriptorSetCount = 1;
-        allocInfo.setSetLayouts(*m_globalSetLayout);
+vk::DescriptorSet Engine::CreateGlobalSet(unsigned frame)
+{
+    vk::DescriptorSetAllocateInfo allocInfo;
 
-        auto sets = m_device->allocateDescriptorSets(allocInfo);
-        frame.globalDescriptor = sets.front();
+    allocInfo.descriptorPool = *m_descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.setSetLayouts(*m_globalSetLayout);
 
-        vk::DescriptorBufferInfo bufferInfo;
-        bufferInfo.buffer = frame.sceneBuffer.buffer;
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(SceneData);
+    auto sets = m_device->allocateDescriptorSets(allocInfo);
 
-        vk::WriteDescriptorSet descriptorWrite;
-        descriptorWrite.dstSet = frame.globalDescriptor;
-        descriptorWrite.dstBinding = 0;
-        descriptorWrite.dstArrayElement = 0;
-        descriptorWrite.descriptorType = vk::DescriptorType::eUniformBuffer;
-        descriptorWrite.descriptorCount = 1;
-        descriptorWrite.setBufferInfo(bufferInfo);
+    vk::DescriptorBufferInfo bufferInfo;
+    bufferInfo.buffer = m_frames[frame].sceneBuffer.buffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = sizeof(SceneData);
 
-        m_device->updateDescriptorSets(descriptorWrite, nullptr);
-    }
+    vk::WriteDescriptorSet descriptorWrite;
+    descriptorWrite.dstSet = sets.front();
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = vk::DescriptorType::eUniformBuffer;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.setBufferInfo(bufferInfo);
+
+    m_device->updateDescriptorSets(descriptorWrite, nullptr);
+    return sets.front();
 }
 
 void Engine::Init(GLFWwindow* window)
@@ -1263,12 +1488,16 @@ void Engine::Init(GLFWwindow* window)
     PickPhysicalDevice();
     CreateLogicalDevice();
     CreateVmaAllocator();
+    CreateUploadService();
+    CreateGeometryArenas();
     CreateSwapChain();
     CreateImageViews();
     CreateRenderPass();
     CreateUniformBuffers();
     CreateGlobalSetLayout();
     CreateTextureSetLayout();
+    CreatePackedTextureSetLayout();
+    CreateGeometryBlockSetLayout();
     CreateDescriptorPool();
     CreateBloomDescriptorPool();
     CreateDescriptorSets();
@@ -1296,10 +1525,47 @@ void Engine::CreateVmaAllocator()
     createInfo.instance = *m_instance;
     createInfo.physicalDevice = m_physicalDevice;
     createInfo.vulkanApiVersion = VK_API_VERSION_1_2;
+    if (m_memoryBudget)
+        createInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
 
     vmaCreateAllocator(&createInfo, &m_vmaAllocator);
 }
 
+void Engine::CreateUploadService()
+{
+    auto indices = FindQueueFamilies(m_physicalDevice, *m_surface);
+
+    UploadService::Queues queues;
+    queues.graphicsFamily = indices.graphicsFamily.value();
+    queues.graphics = m_graphicsQueue;
+    queues.transferFamily = indices.transferFamily;
+    queues.transfer = m_transferQueue;
+
+    m_uploads.Init(*m_device, m_dispatcher, m_vmaAllocator, queues, 64 * 1024 * 1024);
+}
+
+void Engine::CreateGeometryArenas()
+{
+    auto defer = [this](std::function<void()> func) { Defer(std::move(func)); };
+
+    m_vertexArena.Init(*m_device, m_vmaAllocator,
+                       vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                       64 * 1024 * 1024, 1, defer);
+
+    // Index ranges of meshlet meshes are read by the culling shader
+    auto limits = m_physicalDevice.getProperties().limits;
+    m_indexArena.Init(*m_device, m_vmaAllocator,
+                      vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eStorageBuffer
+                      | vk::BufferUsageFlagBits::eTransferDst,
+                      32 * 1024 * 1024, std::max<vk::DeviceSize>(limits.minStorageBufferOffsetAlignment, 4),
+                      defer);
+
+    // Bound a whole block at a time, ranges are found with push constants
+    m_meshletArena.Init(*m_device, m_vmaAllocator,
+                        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+                        8 * 1024 * 1024, 16, defer);
+}
+
 
 vk::Format Engine::FindSupportedFormat(const std::vector<vk::Format>& candidates,
                                vk::ImageTiling tiling,
@@ -1391,12 +1657,26 @@ void Engine::WriteGlobalUniformBuffer()
 void Engine::Terminate()
 {
     m_device->waitIdle();
+    RunDeferred(UINT64_MAX);
     for (auto ctx : m_tracyCtxs)
         TracyVkDestroy(ctx);
 
+    m_vertexArena.Terminate();
+    m_indexArena.Terminate();
+    m_meshletArena.Terminate();
+    m_uploads.Terminate();
     vmaDestroyAllocator(m_vmaAllocator);
 }
 
+void Engine::RunDeferred(uint64_t frameNumber)
+{
+    while (!m_deferred.empty() && m_deferred.front().first <= frameNumber)
+    {
+        m_deferred.front().second();
+        m_deferred.pop_front();
+    }
+}
+
 void Engine::CreateTracyContexts()
 {
     for (auto& frame : m_frames)
@@ -1426,6 +1706,10 @@ vk::CommandBuffer Engine::BeginFrame()
     }
 
     WriteGlobalUniformBuffer();
+    // Budgets are refreshed once per frame
+    vmaSetCurrentFrameIndex(m_vmaAllocator, static_cast<uint32_t>(m_frameNumber));
+    m_uploads.Retire();
+    RunDeferred(m_frameNumber);
 
     uint32_t imageIndex = acquireResult.value;
     m_currentImageIndex = imageIndex;
@@ -1452,13 +1736,23 @@ void Engine::EndFrame()
     TracyVkCollect(m_tracyCtxs[m_currentFrame], *CurrentFrame().commandBuffer);
     CurrentFrame().commandBuffer->end();
 
+    // Uploads recorded so far run first, the frame may use any of them
+    auto uploads = m_uploads.Submit();
+
     vk::SubmitInfo submitInfo;
 
-    std::array waitSemaphores {*CurrentFrame().presentSemaphore};
+    std::array waitSemaphores {*CurrentFrame().presentSemaphore,
+                               m_uploads.GetTimeline()};
     vk::PipelineStageFlags waitStages[] {
-        vk::PipelineStageFlagBits::eColorAttachmentOutput
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        vk::PipelineStageFlagBits::eAllCommands
     };
+    std::array waitValues {uint64_t(0), uploads.value};
+
+    vk::TimelineSemaphoreSubmitInfo timelineInfo;
+    timelineInfo.setWaitSemaphoreValues(waitValues);
 
+    submitInfo.pNext = &timelineInfo;
     submitInfo.setWaitSemaphores(waitSemaphores);
     submitInfo.pWaitDstStageMask = waitStages;
     submitInfo.setCommandBuffers(*CurrentFrame().commandBuffer);
@@ -1469,6 +1763,7 @@ void Engine::EndFrame()
     m_device->resetFences(*CurrentFrame().renderFence);
 
     m_graphicsQueue.submit(submitInfo, *CurrentFrame().renderFence);
+    m_frameNumber++;
 
     std::array swapchains {*m_swapChain};
 
@@ -1496,7 +1791,7 @@ void Engine::EndFrame()
     m_currentFrame = (m_currentFrame + 1) % m_max_frames_in_flight;
 }
 
-void Engine::BeginRenderPass(vk::CommandBuffer cmd)
+void Engine::BeginRenderPass(vk::CommandBuffer cmd, vk::SubpassContents contents)
 {
     auto i = m_currentImageIndex;
     vk::RenderPassBeginInfo renderPassInfo;
@@ -1515,7 +1810,7 @@ void Engine::BeginRenderPass(vk::CommandBuffer cmd)
 
     renderPassInfo.setClearValues(clearValues);
 
-    cmd.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+    cmd.beginRenderPass(renderPassInfo, contents);
 }
 
 void Engine::EndRenderPass(vk::CommandBuffer cmd)
@@ -6,11 +6,16 @@
 #include <glm/glm.hpp>
 #include <chrono>
 #include <concepts>
+#include <span>
+#include <deque>
+#include <functional>
 #include "camera.hpp"
 #include <spdlog/spdlog.h>
 #include <TracyVulkan.hpp>
 #include <vk_mem_alloc.h>
 #include "allocated.hpp"
+#include "upload_service.hpp"
+#include "geometry_arena.hpp"
 
 class Engine
 {
@@ -23,6 +28,16 @@ private:
 
         AllocatedBuffer sceneBuffer;
         vk::DescriptorSet globalDescriptor;
+
+        // Secondary command buffers of the scene pass. Every recorder has
+        // its own pool, so recorders can be used from different threads
+        struct Recorder
+        {
+            vk::UniqueCommandPool pool;
+            std::vector<vk::UniqueCommandBuffer> buffers;
+            std::size_t used = 0;
+        };
+        std::vector<Recorder> recorders;
     };
 
 public:
@@ -43,17 +58,29 @@ public:
     vk::Extent2D GetSwapChainExtent() { return m_swapChainExtent; }
     vk::DescriptorSetLayout GetGlobalSetLayout() const { return *m_globalSetLayout; }
     vk::DescriptorSetLayout GetTextureSetLayout() const { return *m_textureSetLayout; }
+    vk::DescriptorSetLayout GetPackedTextureSetLayout() const { return *m_packedTextureSetLayout; }
+    // One storage buffer for compute, a whole geometry arena block
+    vk::DescriptorSetLayout GetGeometryBlockSetLayout() const { return *m_geometryBlockSetLayout; }
     TracyVkCtx GetCurrentTracyContext() { return m_tracyCtxs[m_currentFrame]; }
     unsigned GetCurrentFrame() const { return m_currentFrame; }
     unsigned GetCurrentImage() const { return m_currentImageIndex; }
     vk::DescriptorPool GetGlobalDescriptorPool() { return *m_descriptorPool; }
     vk::DescriptorSet GetCurrentGlobalSet() { return CurrentFrame().globalDescriptor; }
+    // Another global set with the scene data of the frame, for renderers
+    // that bind their own instance buffer
+    vk::DescriptorSet CreateGlobalSet(unsigned frame);
+    bool HasDrawIndirectCount() const { return m_drawIndirectCount; }
+    // Device level calls that are extensions before Vulkan 1.2
+    const vk::DispatchLoaderDynamic& GetDispatcher() const { return m_dispatcher; }
+    bool HasMultiDrawIndirect() const { return m_multiDrawIndirect; }
+    bool HasDrawIndirectFirstInstance() const { return m_drawIndirectFirstInstance; }
     unsigned GetMaxFramesInFlight() const { return m_max_frames_in_flight; }
     const std::vector<vk::UniqueImageView>& GetSwapChainImageViews()
     {
         return m_swapChainImageViews;
     }
     VmaAllocator GetVmaAllocator() { return m_vmaAllocator; }
+    uint64_t GetFrameNumber() const { return m_frameNumber; }
 
     vk::UniqueShaderModule CreateShaderModule(const std::vector<uint32_t>&);
 
@@ -62,34 +89,28 @@ public:
         m_recreateCallbacks.push_back(callback);
     }
 
-    template<std::invocable<vk::CommandBuffer&> T>
-    void ImmediateSubmit(T func)
+    // Runs func once no frame recorded so far can be in flight, for
+    // releasing objects those frames may use
+    void Defer(std::function<void()> func)
     {
-        vk::CommandBufferAllocateInfo allocInfo;
-        allocInfo.level = vk::CommandBufferLevel::ePrimary;
-        allocInfo.commandBufferCount = 1;
-        allocInfo.setCommandPool(*m_uploadCommandPool);
-
-        auto commandBuffers = m_device->allocateCommandBuffersUnique(allocInfo);
-        auto commandBuffer = *commandBuffers.front();
+        m_deferred.push_back({m_frameNumber + m_max_frames_in_flight, std::move(func)});
+    }
 
-        vk::CommandBufferBeginInfo beginInfo;
-        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    UploadService& GetUploads() { return m_uploads; }
+    // Shared vertex, index and meshlet buffers of all meshes
+    GeometryArena& GetVertexArena() { return m_vertexArena; }
+    GeometryArena& GetIndexArena() { return m_indexArena; }
+    GeometryArena& GetMeshletArena() { return m_meshletArena; }
 
-        commandBuffer.begin(beginInfo);
+    // Records func after every pending upload and blocks until it is done
+    template<std::invocable<vk::CommandBuffer&> T>
+    void ImmediateSubmit(T func)
+    {
+        auto commandBuffer = m_uploads.AfterTransfer();
 
         func(commandBuffer);
 
-        commandBuffer.end();
-
-        vk::SubmitInfo submitInfo;
-        submitInfo.setCommandBuffers(commandBuffer);
-
-        m_graphicsQueue.submit(submitInfo, *m_uploadFence);
-
-        auto r = m_device->waitForFences(*m_uploadFence, true, UINT64_MAX);
-        m_device->resetFences(*m_uploadFence);
-        m_device->resetCommandPool(*m_uploadCommandPool);
+        m_uploads.Wait(m_uploads.Submit());
     }
 
     struct SceneData
@@ -114,9 +135,17 @@ public:
     vk::CommandBuffer BeginFrame();
     void EndFrame();
 
-    void BeginRenderPass(vk::CommandBuffer);
+    void BeginRenderPass(vk::CommandBuffer,
+                         vk::SubpassContents contents = vk::SubpassContents::eInline);
     void EndRenderPass(vk::CommandBuffer);
 
+    // Begins a secondary command buffer that continues the scene pass, for
+    // a pass begun with secondary contents. The buffer is recycled once
+    // the frame is done. One recorder must not be used by two threads at
+    // once
+    vk::CommandBuffer BeginSecondary(std::size_t recorder);
+    std::size_t GetRecorderCount() const { return m_frames.front().recorders.size(); }
+
     vk::Format FindSupportedFormat(const std::vector<vk::Format>&, vk::ImageTiling,
                                    vk::FormatFeatureFlags);
     vk::Format FindDepthFormat()
@@ -155,26 +184,45 @@ public:
 
     template<typename T>
     AllocatedBuffer CopyToGPU(const std::vector<T>& data, vk::BufferUsageFlags flags)
+    {
+        return CopyToGPU(std::span<const T>(data), flags);
+    }
+
+    template<typename T>
+    AllocatedBuffer CopyToGPU(std::span<const T> data, vk::BufferUsageFlags flags)
     {
         auto data_size = data.size() * sizeof(data[0]);
+        return WriteToGPU(data_size, flags, [&](std::span<uint8_t> staging) {
+            memcpy(staging.data(), data.data(), data_size);
+        });
+    }
+
+    // Lets write fill the staging memory of a new buffer in place. The copy
+    // runs with the next upload batch, at the latest before the frame that
+    // is being recorded
+    template<std::invocable<std::span<uint8_t>> F>
+    AllocatedBuffer WriteToGPU(vk::DeviceSize size, vk::BufferUsageFlags flags, F write)
+    {
         AllocatedBuffer result = CreateBuffer(
-            data_size, flags | vk::BufferUsageFlagBits::eTransferDst,
+            size, flags | vk::BufferUsageFlagBits::eTransferDst,
             VMA_MEMORY_USAGE_GPU_ONLY);
 
-        AllocatedBuffer stage = CreateBuffer(
-            data_size, vk::BufferUsageFlagBits::eTransferSrc,
-            VMA_MEMORY_USAGE_CPU_ONLY);
-
-        void* data_ptr;
-        vmaMapMemory(GetVmaAllocator(), stage.allocation, &data_ptr);
-        memcpy(data_ptr, data.data(), data_size);
-        vmaUnmapMemory(GetVmaAllocator(), stage.allocation);
-
-        CopyBuffer(stage.buffer, result.buffer, data_size);
+        auto stage = m_uploads.Stage(size);
+        write(stage.data);
+        m_uploads.CopyToBuffer(stage, result.buffer);
 
         return result;
     }
 
+    // Same for a range of an arena
+    template<std::invocable<std::span<uint8_t>> F>
+    void WriteToGPU(const GeometryRange& range, F write)
+    {
+        auto stage = m_uploads.Stage(range.size);
+        write(stage.data);
+        m_uploads.CopyToBuffer(stage, range.buffer, range.offset);
+    }
+
 
 private:
     std::vector<const char*> GetRequiredExtensions();
@@ -202,11 +250,15 @@ private:
     void CreateSyncObjects();
     void CreateGlobalSetLayout();
     void CreateTextureSetLayout();
+    void CreatePackedTextureSetLayout();
+    void CreateGeometryBlockSetLayout();
     void CreateUniformBuffers();
     void CreateDescriptorPool();
     void CreateBloomDescriptorPool();
     void CreateDescriptorSets();
     void CreateVmaAllocator();
+    void CreateUploadService();
+    void CreateGeometryArenas();
 
     void RecreateSwapChain()
     {
@@ -252,6 +304,10 @@ private:
     //Device should be destroyed last
     vk::UniqueInstance m_instance;
     vk::UniqueDevice m_device;
+    UploadService m_uploads;
+    GeometryArena m_vertexArena;
+    GeometryArena m_indexArena;
+    GeometryArena m_meshletArena;
 
     std::vector<std::optional<vk::Fence>> m_imagesInFlight;
 
@@ -262,6 +318,7 @@ private:
     vk::UniqueSurfaceKHR m_surface;
     vk::Queue m_graphicsQueue;
     vk::Queue m_presentQueue;
+    vk::Queue m_transferQueue;
     vk::UniqueSwapchainKHR m_swapChain;
     vk::Format m_swapChainFormat;
 
@@ -293,6 +350,8 @@ private:
     vk::UniqueDescriptorPool m_bloomDescriptorPool;
     vk::UniqueDescriptorSetLayout m_globalSetLayout;
     vk::UniqueDescriptorSetLayout m_textureSetLayout;
+    vk::UniqueDescriptorSetLayout m_packedTextureSetLayout;
+    vk::UniqueDescriptorSetLayout m_geometryBlockSetLayout;
     vk::UniqueDescriptorPool m_imguiDescriptorPool;
 
     vk::UniqueSampler m_bloomSampler;
@@ -339,9 +398,16 @@ private:
     std::vector<TracyVkCtx> m_tracyCtxs;
 
     VmaAllocator m_vmaAllocator;
+    // VMA budgets come from VK_EXT_memory_budget, estimates otherwise
+    bool m_memoryBudget = false;
+    bool m_drawIndirectCount = false;
+    bool m_multiDrawIndirect = false;
+    bool m_drawIndirectFirstInstance = false;
 
     std::vector<std::function<void(Engine&)>> m_recreateCallbacks;
 
-    vk::UniqueCommandPool m_uploadCommandPool;
-    vk::UniqueFence m_uploadFence;
+    // Frames submitted so far
+    uint64_t m_frameNumber = 0;
+    std::deque<std::pair<uint64_t, std::function<void()>>> m_deferred;
+    void RunDeferred(uint64_t frameNumber);
 };
@@ -1,3 +1,141 @@
 #include "files.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 std::filesystem::path Files::s_local;
+
+namespace {
+    // XXH64
+    constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr uint64_t Prime3 = 0x165667B19E3779F9ULL;
+    constexpr uint64_t Prime4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
+
+    uint64_t Rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    uint64_t Read64(const unsigned char* p)
+    {
+        uint64_t result;
+        std::memcpy(&result, p, sizeof(result));
+        return result;
+    }
+
+    uint32_t Read32(const unsigned char* p)
+    {
+        uint32_t result;
+        std::memcpy(&result, p, sizeof(result));
+        return result;
+    }
+
+    uint64_t Round(uint64_t acc, uint64_t input)
+    {
+        acc += input * Prime2;
+        acc = Rotl(acc, 31);
+        return acc * Prime1;
+    }
+
+    uint64_t MergeRound(uint64_t acc, uint64_t value)
+    {
+        acc ^= Round(0, value);
+        return acc * Prime1 + Prime4;
+    }
+}
+
+uint64_t Files::Hash(const void* data, std::size_t size, uint64_t seed)
+{
+    auto p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t h;
+
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + Prime1 + Prime2;
+        uint64_t v2 = seed + Prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - Prime1;
+
+        const unsigned char* limit = end - 32;
+        do
+        {
+            v1 = Round(v1, Read64(p)); p += 8;
+            v2 = Round(v2, Read64(p)); p += 8;
+            v3 = Round(v3, Read64(p)); p += 8;
+            v4 = Round(v4, Read64(p)); p += 8;
+        } while (p <= limit);
+
+        h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+        h = MergeRound(h, v1);
+        h = MergeRound(h, v2);
+        h = MergeRound(h, v3);
+        h = MergeRound(h, v4);
+    }
+    else
+    {
+        h = seed + Prime5;
+    }
+
+    h += static_cast<uint64_t>(size);
+
+    while (p + 8 <= end)
+    {
+        h ^= Round(0, Read64(p));
+        h = Rotl(h, 27) * Prime1 + Prime4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        h ^= static_cast<uint64_t>(Read32(p)) * Prime1;
+        h = Rotl(h, 23) * Prime2 + Prime3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        h ^= (*p) * Prime5;
+        h = Rotl(h, 11) * Prime1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED)
+        {
+            m_data = static_cast<const char*>(ptr);
+            m_size = st.st_size;
+        }
+    }
+
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+    {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <filesystem>
+#include <cstdint>
 
 class Files
 {
@@ -13,6 +14,48 @@ public:
     {
         return s_local / path;
     }
+
+    // 64 bit content hash, stable between runs and machines
+    static uint64_t Hash(const void* data, std::size_t size, uint64_t seed = 0);
 private:
     static std::filesystem::path s_local;
 };
+
+// Read only memory mapping of a whole file. Empty when the file could not
+// be opened
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::filesystem::path& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&& rhs)
+    {
+        swap(*this, rhs);
+    }
+
+    friend void swap(MappedFile& lhs, MappedFile& rhs)
+    {
+        using std::swap;
+
+        swap(lhs.m_data, rhs.m_data);
+        swap(lhs.m_size, rhs.m_size);
+    }
+
+    MappedFile& operator=(MappedFile&& other)
+    {
+        MappedFile tmp(std::move(other));
+        swap(tmp, *this);
+        return *this;
+    }
+
+    ~MappedFile();
+
+    const char* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    explicit operator bool() const { return m_data != nullptr; }
+
+private:
+    const char* m_data = nullptr;
+    std::size_t m_size = 0;
+};
@@ -0,0 +1,70 @@
+#include "frustum_culler.hpp"
+#include <glm/gtc/matrix_access.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLER_SSE
+#include <emmintrin.h>
+#endif
+
+FrustumCuller::Planes FrustumCuller::Extract(const glm::mat4& projview)
+{
+    glm::vec4 x = glm::row(projview, 0);
+    glm::vec4 y = glm::row(projview, 1);
+    glm::vec4 z = glm::row(projview, 2);
+    glm::vec4 w = glm::row(projview, 3);
+
+    Planes planes {w + x, w - x, w + y, w - y, z, w - z};
+    for (auto& plane : planes)
+        plane /= glm::length(glm::vec3(plane));
+    return planes;
+}
+
+void FrustumCuller::Cull(const Planes& planes, const SphereList& spheres,
+                         std::size_t begin, std::size_t end, std::span<uint8_t> visible)
+{
+    std::size_t i = begin;
+
+#ifdef FRUSTUM_CULLER_SSE
+    // Plane components broadcast once, each lane is one sphere
+    __m128 px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; p++)
+    {
+        px[p] = _mm_set1_ps(planes[p].x);
+        py[p] = _mm_set1_ps(planes[p].y);
+        pz[p] = _mm_set1_ps(planes[p].z);
+        pw[p] = _mm_set1_ps(planes[p].w);
+    }
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&spheres.x[i]);
+        __m128 y = _mm_loadu_ps(&spheres.y[i]);
+        __m128 z = _mm_loadu_ps(&spheres.z[i]);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(px[p], x), _mm_mul_ps(py[p], y)),
+                _mm_add_ps(_mm_mul_ps(pz[p], z), pw[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        visible[i] = mask & 1;
+        visible[i + 1] = (mask >> 1) & 1;
+        visible[i + 2] = (mask >> 2) & 1;
+        visible[i + 3] = (mask >> 3) & 1;
+    }
+#endif
+
+    for (; i < end; i++)
+    {
+        glm::vec3 center(spheres.x[i], spheres.y[i], spheres.z[i]);
+        bool inside = true;
+        for (const auto& plane : planes)
+            inside &= glm::dot(glm::vec3(plane), center) + plane.w >= -spheres.radius[i];
+        visible[i] = inside;
+    }
+}
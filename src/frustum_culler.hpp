@@ -0,0 +1,41 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Bounding spheres in structure of arrays layout
+struct SphereList
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+
+    void Resize(std::size_t count)
+    {
+        x.resize(count);
+        y.resize(count);
+        z.resize(count);
+        radius.resize(count);
+    }
+
+    std::size_t Size() const { return x.size(); }
+};
+
+// Tests bounding spheres against the planes of a view frustum, four at a
+// time with SSE where the target has it
+class FrustumCuller
+{
+public:
+    using Planes = std::array<glm::vec4, 6>;
+
+    // Normalized Gribb-Hartmann planes, clip space depth is 0..w. Points
+    // inside have non-negative distance to all of them
+    static Planes Extract(const glm::mat4& projview);
+
+    // Writes whether each sphere in [begin, end) intersects the frustum
+    static void Cull(const Planes& planes, const SphereList& spheres,
+                     std::size_t begin, std::size_t end, std::span<uint8_t> visible);
+};
@@ -0,0 +1,96 @@
+#include "geometry_arena.hpp"
+#include <spdlog/spdlog.h>
+#include <numeric>
+
+GeometryRange::~GeometryRange()
+{
+    if (arena && size > 0)
+        arena->Free(*this);
+}
+
+void GeometryArena::Init(vk::Device device, VmaAllocator allocator, vk::BufferUsageFlags usage,
+                         vk::DeviceSize blockSize, vk::DeviceSize minAlignment, DeferFunc defer)
+{
+    m_device = device;
+    m_allocator = allocator;
+    m_usage = usage;
+    m_blockSize = blockSize;
+    m_minAlignment = minAlignment;
+    m_defer = std::move(defer);
+}
+
+void GeometryArena::Terminate()
+{
+    m_blocks.clear();
+}
+
+GeometryRange GeometryArena::Allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    alignment = std::lcm(alignment, m_minAlignment);
+
+    GeometryRange result;
+    result.arena = this;
+    result.size = size;
+
+    for (uint32_t i = 0; i < m_blocks.size(); i++)
+    {
+        if (auto offset = m_blocks[i].ranges.Allocate(size, alignment))
+        {
+            result.buffer = m_blocks[i].buffer.buffer;
+            result.block = i;
+            result.offset = *offset;
+            return result;
+        }
+    }
+
+    Block block;
+    block.ranges = RangeAllocator(std::max(size, m_blockSize));
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = block.ranges.GetSize();
+    bufferInfo.usage = static_cast<VkBufferUsageFlags>(m_usage);
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    if (vmaCreateBuffer(m_allocator, &bufferInfo, &allocInfo, &block.buffer.buffer,
+                        &block.buffer.allocation, nullptr) != VK_SUCCESS)
+    {
+        spdlog::error("Failed to allocate a geometry block of {} bytes", bufferInfo.size);
+        throw std::runtime_error("");
+    }
+    block.buffer.allocator = m_allocator;
+    block.buffer.device = m_device;
+
+    result.buffer = block.buffer.buffer;
+    result.block = m_blocks.size();
+    result.offset = *block.ranges.Allocate(size, alignment);
+    m_blocks.push_back(std::move(block));
+    return result;
+}
+
+void GeometryArena::Free(const GeometryRange& range)
+{
+    m_defer([this, block = range.block, offset = range.offset, size = range.size] {
+        // Blocks are gone once the arena is terminated
+        if (block < m_blocks.size())
+            m_blocks[block].ranges.Free(offset, size);
+    });
+}
+
+vk::DeviceSize GeometryArena::GetUsed() const
+{
+    vk::DeviceSize used = 0;
+    for (const auto& block : m_blocks)
+        used += block.ranges.GetUsed();
+    return used;
+}
+
+vk::DeviceSize GeometryArena::GetCapacity() const
+{
+    vk::DeviceSize capacity = 0;
+    for (const auto& block : m_blocks)
+        capacity += block.ranges.GetSize();
+    return capacity;
+}
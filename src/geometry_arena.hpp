@@ -0,0 +1,88 @@
+#pragma once
+#include "allocated.hpp"
+#include "range_allocator.hpp"
+#include <vulkan/vulkan.hpp>
+#include <vk_mem_alloc.h>
+#include <functional>
+#include <vector>
+
+class GeometryArena;
+
+// Range of a GeometryArena block, returned to the arena when destroyed
+struct GeometryRange
+{
+    GeometryArena* arena = nullptr;
+    vk::Buffer buffer;
+    uint32_t block = 0;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size = 0;
+
+    GeometryRange() = default;
+    GeometryRange(const GeometryRange&) = delete;
+    GeometryRange(GeometryRange&& rhs)
+    {
+        swap(*this, rhs);
+    }
+
+    friend void swap(GeometryRange& lhs, GeometryRange& rhs)
+    {
+        using std::swap;
+
+        swap(lhs.arena, rhs.arena);
+        swap(lhs.buffer, rhs.buffer);
+        swap(lhs.block, rhs.block);
+        swap(lhs.offset, rhs.offset);
+        swap(lhs.size, rhs.size);
+    }
+
+    GeometryRange& operator=(GeometryRange&& other)
+    {
+        GeometryRange tmp(std::move(other));
+        swap(tmp, *this);
+        return *this;
+    }
+
+    ~GeometryRange();
+};
+
+// Vertices or indices of many meshes in a few large buffers, so draws of
+// different meshes share their bindings. Ranges are placed first fit into
+// fixed size blocks, payloads larger than a block get one of their own
+class GeometryArena
+{
+public:
+    // Runs a function once frames in flight are done, see Engine::Defer
+    using DeferFunc = std::function<void(std::function<void()>)>;
+
+    // Ranges are aligned to at least minAlignment, for binding them as
+    // storage buffers
+    void Init(vk::Device device, VmaAllocator allocator, vk::BufferUsageFlags usage,
+              vk::DeviceSize blockSize, vk::DeviceSize minAlignment, DeferFunc defer);
+    void Terminate();
+
+    GeometryRange Allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+
+    vk::DeviceSize GetUsed() const;
+    vk::DeviceSize GetCapacity() const;
+    std::size_t GetBlockCount() const { return m_blocks.size(); }
+
+private:
+    friend struct GeometryRange;
+
+    struct Block
+    {
+        AllocatedBuffer buffer;
+        RangeAllocator ranges;
+    };
+
+    // Frames in flight may still read the range, it is reused after them
+    void Free(const GeometryRange& range);
+
+    vk::Device m_device;
+    VmaAllocator m_allocator = {};
+    vk::BufferUsageFlags m_usage;
+    vk::DeviceSize m_blockSize = 0;
+    vk::DeviceSize m_minAlignment = 1;
+    DeferFunc m_defer;
+    std::vector<Block> m_blocks;
+};
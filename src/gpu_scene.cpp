@@ -0,0 +1,508 @@
+#include "gpu_scene.hpp"
+#include "shader_compiler.hpp"
+#include "files.hpp"
+#include "frustum_culler.hpp"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <unordered_map>
+#include <Tracy.hpp>
+
+namespace
+{
+    // Layouts of object_cull.comp
+    struct ObjectData
+    {
+        glm::vec4 sphere;
+        uint32_t firstRange;
+        uint32_t rangeCount;
+        uint32_t batch;
+        uint32_t firstCommand;
+    };
+
+    struct RangeData
+    {
+        uint32_t indexCount;
+        uint32_t firstIndex;
+        int32_t vertexOffset;
+        uint32_t padding;
+    };
+
+    struct CullConstants
+    {
+        glm::vec4 planes[6];
+        uint32_t objectCount;
+        uint32_t compact;
+        uint32_t firstInstance;
+    };
+
+    constexpr uint32_t s_groupSize = 64;
+}
+
+void GpuScene::Init(Engine& engine)
+{
+    m_engine = &engine;
+    auto device = engine.GetDevice();
+
+    std::array<vk::DescriptorSetLayoutBinding, 6> bindings;
+    for (uint32_t i = 0; i < bindings.size(); i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = vk::ShaderStageFlagBits::eCompute;
+    }
+
+    vk::DescriptorSetLayoutCreateInfo setLayoutInfo;
+    setLayoutInfo.setBindings(bindings);
+    m_cullSetLayout = device.createDescriptorSetLayoutUnique(setLayoutInfo);
+
+    vk::PushConstantRange range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullConstants));
+    vk::PipelineLayoutCreateInfo layoutInfo;
+    layoutInfo.setSetLayouts(*m_cullSetLayout);
+    layoutInfo.setPushConstantRanges(range);
+    m_cullPipelineLayout = device.createPipelineLayoutUnique(layoutInfo);
+
+    auto computeModule = engine.CreateShaderModule(
+        ShaderCompiler::CompileFromFile(
+            Files::Local("res/shaders/object_cull.comp"),
+            shaderc_shader_kind::shaderc_glsl_compute_shader));
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.module = *computeModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = *m_cullPipelineLayout;
+    m_cullPipeline = device.createComputePipelineUnique(VK_NULL_HANDLE, pipelineInfo).value;
+
+    m_frames.resize(engine.GetMaxFramesInFlight());
+    for (unsigned i = 0; i < m_frames.size(); i++)
+    {
+        vk::DescriptorSetAllocateInfo allocInfo;
+        allocInfo.descriptorPool = engine.GetGlobalDescriptorPool();
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.setSetLayouts(*m_cullSetLayout);
+        m_frames[i].cullDescriptor = device.allocateDescriptorSets(allocInfo)[0];
+        m_frames[i].globalDescriptor = engine.CreateGlobalSet(i);
+    }
+
+    if (!engine.HasDrawIndirectFirstInstance())
+    {
+        spdlog::info("drawIndirectFirstInstance is not supported, GPU culled objects draw "
+                     "one indirect command at a time");
+    }
+    else if (!engine.HasDrawIndirectCount())
+    {
+        spdlog::info("drawIndirectCount is not supported, GPU culled objects draw "
+                     "with zero instances instead");
+    }
+}
+
+GpuScene::ObjectId GpuScene::Add(Mesh::Ptr mesh, Material::Ptr material,
+                                 TextureSet::Ptr textures, const glm::mat4& model)
+{
+    ObjectId id;
+    if (m_free.empty())
+    {
+        id = static_cast<ObjectId>(m_objects.size());
+        m_objects.emplace_back();
+    }
+    else
+    {
+        id = m_free.back();
+        m_free.pop_back();
+    }
+
+    m_objects[id] = Object{std::move(mesh), std::move(material), std::move(textures), model};
+    m_objectCount++;
+    m_changed = true;
+    return id;
+}
+
+void GpuScene::SetTransform(ObjectId id, const glm::mat4& model)
+{
+    if (!m_objects.at(id))
+    {
+        spdlog::warn("Moving removed scene object {}", id);
+        return;
+    }
+
+    m_objects[id]->model = model;
+    m_moved.push_back(id);
+}
+
+void GpuScene::Remove(ObjectId id)
+{
+    if (!m_objects.at(id))
+    {
+        spdlog::warn("Removing scene object {} twice", id);
+        return;
+    }
+
+    m_objects[id].reset();
+    m_free.push_back(id);
+    m_objectCount--;
+    m_changed = true;
+}
+
+bool GpuScene::Reserve(SceneBuffer& buffer, vk::DeviceSize count, vk::DeviceSize size,
+                       vk::BufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+{
+    if (buffer.capacity >= count && buffer.buffer.buffer)
+        return false;
+
+    buffer.capacity = std::max<vk::DeviceSize>(count + count / 2, 1);
+    auto old = std::make_shared<AllocatedBuffer>(std::move(buffer.buffer));
+    m_engine->Defer([old] {});
+    buffer.buffer = m_engine->CreateBuffer(buffer.capacity * size, usage, memoryUsage);
+    return true;
+}
+
+void GpuScene::Write(vk::CommandBuffer cmd, vk::Buffer buffer, vk::DeviceSize offset,
+                     const void* data, vk::DeviceSize size)
+{
+    if (size == 0)
+        return;
+
+    auto stage = m_engine->GetUploads().Stage(size);
+    memcpy(stage.data.data(), data, size);
+    cmd.copyBuffer(stage.buffer, buffer, vk::BufferCopy(stage.offset, offset, size));
+}
+
+void GpuScene::Rebuild(vk::CommandBuffer cmd)
+{
+    ZoneScoped;
+    std::map<BatchKey, uint32_t> batchIds;
+    std::unordered_map<const Mesh*, uint32_t> meshRanges;
+    std::vector<RangeData> ranges;
+    std::vector<ObjectData> objects(m_objects.size(), ObjectData{});
+    std::vector<InstanceData> instances(m_objects.size());
+
+    m_batches.clear();
+    m_loading.clear();
+    for (ObjectId id = 0; id < m_objects.size(); id++)
+    {
+        if (!m_objects[id])
+            continue;
+
+        const Object& object = *m_objects[id];
+        const Mesh& mesh = *object.mesh;
+        instances[id].model = object.model;
+        if (mesh.submeshes.empty())
+        {
+            m_loading.push_back(id);
+            continue;
+        }
+
+        const TextureSet* textures = object.material->textures ? object.textures.get() : nullptr;
+        BatchKey key {object.material.get(), textures, mesh.vertexFormat,
+                      mesh.vertexRange.buffer, mesh.indexRange.buffer, mesh.indexType,
+                      {mesh.positionOffset.x, mesh.positionOffset.y, mesh.positionOffset.z,
+                       mesh.positionScale.x, mesh.positionScale.y, mesh.positionScale.z}};
+        auto [batchIt, newBatch] = batchIds.try_emplace(key, m_batches.size());
+        if (newBatch)
+            m_batches.push_back({object.material, object.textures, object.mesh});
+
+        auto [rangeIt, newMesh] = meshRanges.try_emplace(&mesh, ranges.size());
+        if (newMesh)
+        {
+            for (const auto& submesh : mesh.submeshes)
+            {
+                if (submesh.lod == 0)
+                {
+                    ranges.push_back({submesh.indexCount, mesh.baseIndex + submesh.firstIndex,
+                                      mesh.baseVertex + submesh.vertexOffset, 0});
+                }
+            }
+        }
+
+        Batch& batch = m_batches[batchIt->second];
+        ObjectData& data = objects[id];
+        data.sphere = glm::vec4(mesh.sphereCenter, mesh.sphereRadius);
+        data.firstRange = rangeIt->second;
+        data.rangeCount = static_cast<uint32_t>(
+            std::ranges::count(mesh.submeshes, 0u, &Submesh::lod));
+        data.batch = batchIt->second;
+        // Offset in the batch until the batches are placed
+        data.firstCommand = batch.commandCount;
+        batch.commandCount += data.rangeCount;
+    }
+
+    std::vector<uint32_t> batchData;
+    m_commandCount = 0;
+    for (auto& batch : m_batches)
+    {
+        batch.firstCommand = m_commandCount;
+        batchData.push_back(m_commandCount);
+        m_commandCount += batch.commandCount;
+    }
+
+    m_commandObjects.assign(m_commandCount, 0);
+    for (ObjectId id = 0; id < objects.size(); id++)
+    {
+        ObjectData& data = objects[id];
+        if (data.rangeCount == 0)
+            continue;
+
+        data.firstCommand += m_batches[data.batch].firstCommand;
+        std::fill_n(m_commandObjects.begin() + data.firstCommand, data.rangeCount, id);
+    }
+
+    auto usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    bool grown = false;
+    grown |= Reserve(m_instances, instances.size(), sizeof(InstanceData), usage,
+                     VMA_MEMORY_USAGE_GPU_ONLY);
+    grown |= Reserve(m_objectData, objects.size(), sizeof(ObjectData), usage,
+                     VMA_MEMORY_USAGE_GPU_ONLY);
+    grown |= Reserve(m_ranges, ranges.size(), sizeof(RangeData), usage,
+                     VMA_MEMORY_USAGE_GPU_ONLY);
+    grown |= Reserve(m_batchData, batchData.size(), sizeof(uint32_t), usage,
+                     VMA_MEMORY_USAGE_GPU_ONLY);
+    if (grown)
+        m_generation++;
+
+    Write(cmd, m_instances.buffer.buffer, 0, instances.data(),
+          instances.size() * sizeof(InstanceData));
+    Write(cmd, m_objectData.buffer.buffer, 0, objects.data(),
+          objects.size() * sizeof(ObjectData));
+    Write(cmd, m_ranges.buffer.buffer, 0, ranges.data(), ranges.size() * sizeof(RangeData));
+    Write(cmd, m_batchData.buffer.buffer, 0, batchData.data(),
+          batchData.size() * sizeof(uint32_t));
+
+    m_moved.clear();
+    m_changed = false;
+}
+
+void GpuScene::UploadTransforms(vk::CommandBuffer cmd)
+{
+    ZoneScoped;
+    std::ranges::sort(m_moved);
+    auto [last, end] = std::ranges::unique(m_moved);
+    m_moved.erase(last, end);
+
+    // Runs of neighbouring objects are copied together
+    for (std::size_t begin = 0; begin < m_moved.size();)
+    {
+        std::size_t count = 1;
+        while (begin + count < m_moved.size() && m_moved[begin + count] == m_moved[begin] + count)
+            count++;
+
+        std::vector<InstanceData> instances(count);
+        for (std::size_t i = 0; i < count; i++)
+        {
+            if (const auto& object = m_objects[m_moved[begin + i]])
+                instances[i].model = object->model;
+        }
+        Write(cmd, m_instances.buffer.buffer, m_moved[begin] * sizeof(InstanceData),
+              instances.data(), count * sizeof(InstanceData));
+        begin += count;
+    }
+    m_moved.clear();
+}
+
+void GpuScene::WriteDescriptors(Frame& frame)
+{
+    std::array infos {
+        vk::DescriptorBufferInfo(m_instances.buffer.buffer, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(m_objectData.buffer.buffer, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(m_ranges.buffer.buffer, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(m_batchData.buffer.buffer, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(frame.commands.buffer.buffer, 0, VK_WHOLE_SIZE),
+        vk::DescriptorBufferInfo(frame.counts.buffer.buffer, 0, VK_WHOLE_SIZE),
+    };
+
+    std::vector<vk::WriteDescriptorSet> writes(infos.size() + 1);
+    for (uint32_t i = 0; i < infos.size(); i++)
+    {
+        writes[i].dstSet = frame.cullDescriptor;
+        writes[i].dstBinding = i;
+        writes[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+        writes[i].setBufferInfo(infos[i]);
+    }
+    writes.back().dstSet = frame.globalDescriptor;
+    writes.back().dstBinding = 2;
+    writes.back().descriptorType = vk::DescriptorType::eStorageBuffer;
+    writes.back().setBufferInfo(infos[0]);
+
+    m_engine->GetDevice().updateDescriptorSets(writes, nullptr);
+    frame.generation = m_generation;
+}
+
+void GpuScene::Cull(vk::CommandBuffer cmd)
+{
+    ZoneScoped;
+    m_changed |= std::ranges::any_of(m_loading, [this](ObjectId id) {
+        return m_objects[id] && !m_objects[id]->mesh->submeshes.empty();
+    });
+
+    if (m_changed || !m_moved.empty())
+    {
+        // Scene buffers are written on the graphics queue, after frames
+        // still in flight are done reading them
+        auto uploads = m_engine->GetUploads().AfterTransfer();
+        vk::MemoryBarrier before(vk::AccessFlagBits::eShaderRead,
+                                 vk::AccessFlagBits::eTransferWrite);
+        uploads.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader
+                                | vk::PipelineStageFlagBits::eVertexShader,
+                                vk::PipelineStageFlagBits::eTransfer,
+                                {}, before, nullptr, nullptr);
+
+        if (m_changed)
+            Rebuild(uploads);
+        else
+            UploadTransforms(uploads);
+
+        vk::MemoryBarrier after(vk::AccessFlagBits::eTransferWrite,
+                                vk::AccessFlagBits::eShaderRead);
+        uploads.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                vk::PipelineStageFlagBits::eComputeShader
+                                | vk::PipelineStageFlagBits::eVertexShader,
+                                {}, after, nullptr, nullptr);
+    }
+
+    if (m_commandCount == 0)
+        return;
+
+    uint64_t frameNumber = m_engine->GetFrameNumber();
+    for (const auto& batch : m_batches)
+    {
+        if (batch.textures)
+            batch.textures->Touch(frameNumber);
+    }
+
+    // Called after the frame's fence was waited on, so its buffers and
+    // descriptors are no longer in use
+    Frame& frame = m_frames[m_engine->GetCurrentFrame()];
+    bool grown = Reserve(frame.commands, m_commandCount, sizeof(vk::DrawIndexedIndirectCommand),
+                         vk::BufferUsageFlagBits::eStorageBuffer
+                         | vk::BufferUsageFlagBits::eIndirectBuffer,
+                         VMA_MEMORY_USAGE_GPU_ONLY);
+    grown |= Reserve(frame.counts, m_batches.size(), sizeof(uint32_t),
+                     vk::BufferUsageFlagBits::eStorageBuffer
+                     | vk::BufferUsageFlagBits::eIndirectBuffer
+                     | vk::BufferUsageFlagBits::eTransferDst,
+                     VMA_MEMORY_USAGE_GPU_ONLY);
+    if (grown || frame.generation != m_generation)
+        WriteDescriptors(frame);
+
+    TracyVkZone(m_engine->GetCurrentTracyContext(), cmd, "Object culling");
+    // Compacted commands move around, so they can only be told apart by
+    // their firstInstance
+    bool firstInstance = m_engine->HasDrawIndirectFirstInstance();
+    bool compact = m_engine->HasDrawIndirectCount() && firstInstance;
+    if (compact)
+    {
+        cmd.fillBuffer(frame.counts.buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+        vk::MemoryBarrier cleared(vk::AccessFlagBits::eTransferWrite,
+                                  vk::AccessFlagBits::eShaderRead
+                                  | vk::AccessFlagBits::eShaderWrite);
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                            vk::PipelineStageFlagBits::eComputeShader,
+                            {}, cleared, nullptr, nullptr);
+    }
+
+    const auto& scene = m_engine->m_ubo;
+    auto planes = FrustumCuller::Extract(scene.proj * scene.view);
+
+    CullConstants constants;
+    std::ranges::copy(planes, constants.planes);
+    constants.objectCount = static_cast<uint32_t>(m_objects.size());
+    constants.compact = compact;
+    constants.firstInstance = firstInstance;
+
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *m_cullPipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *m_cullPipelineLayout, 0,
+                           frame.cullDescriptor, nullptr);
+    cmd.pushConstants(*m_cullPipelineLayout, vk::ShaderStageFlagBits::eCompute,
+                      0, sizeof(constants), &constants);
+    cmd.dispatch((constants.objectCount + s_groupSize - 1) / s_groupSize, 1, 1);
+
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite,
+                              vk::AccessFlagBits::eIndirectCommandRead);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                        vk::PipelineStageFlagBits::eDrawIndirect,
+                        {}, barrier, nullptr, nullptr);
+}
+
+void GpuScene::WriteCmdBuffer(vk::CommandBuffer cmd, MeshRenderer::Stats& stats)
+{
+    if (m_commandCount == 0)
+        return;
+
+    const Frame& frame = m_frames[m_engine->GetCurrentFrame()];
+    constexpr uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+
+    TracyVkZone(m_engine->GetCurrentTracyContext(), cmd, "GPU scene");
+    for (uint32_t i = 0; i < m_batches.size(); i++)
+    {
+        const Batch& batch = m_batches[i];
+        const Mesh& mesh = *batch.mesh;
+        const auto& layout = *batch.material->pipelineLayout;
+
+        cmd.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                         batch.material->GetPipeline(mesh.vertexFormat));
+        cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0,
+                               frame.globalDescriptor, nullptr);
+        if (batch.material->textures && batch.textures)
+        {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 1,
+                                   batch.textures->descriptor, nullptr);
+            stats.descriptorBinds++;
+        }
+        stats.pipelineBinds++;
+        stats.descriptorBinds++;
+
+        PushConstants constants;
+        constants.positionOffset = glm::vec4(mesh.positionOffset, 0.0f);
+        constants.positionScale = glm::vec4(mesh.positionScale, 0.0f);
+        cmd.pushConstants(layout, vk::ShaderStageFlagBits::eAllGraphics, 0,
+                          sizeof(constants), &constants);
+
+        vk::DeviceSize offset = 0;
+        cmd.bindVertexBuffers(0, mesh.vertexRange.buffer, offset);
+        cmd.bindIndexBuffer(mesh.indexRange.buffer, 0, mesh.indexType);
+        stats.bufferBinds += 2;
+
+        vk::DeviceSize first = batch.firstCommand * stride;
+        if (!m_engine->HasDrawIndirectFirstInstance())
+        {
+            // Commands keep their fixed places, the object of each one is
+            // pushed before drawing it
+            for (uint32_t command = 0; command < batch.commandCount; command++)
+            {
+                ObjectId id = m_commandObjects[batch.firstCommand + command];
+                if (command == 0 || id != constants.firstInstance)
+                {
+                    constants.firstInstance = id;
+                    cmd.pushConstants(layout, vk::ShaderStageFlagBits::eAllGraphics, 0,
+                                      sizeof(constants), &constants);
+                }
+                cmd.drawIndexedIndirect(frame.commands.buffer.buffer,
+                                        first + command * stride, 1, stride);
+            }
+            stats.draws += batch.commandCount;
+        }
+        else if (m_engine->HasDrawIndirectCount())
+        {
+            cmd.drawIndexedIndirectCount(frame.commands.buffer.buffer, first,
+                                         frame.counts.buffer.buffer, i * sizeof(uint32_t),
+                                         batch.commandCount, stride,
+                                         m_engine->GetDispatcher());
+            stats.draws++;
+        }
+        else if (m_engine->HasMultiDrawIndirect())
+        {
+            cmd.drawIndexedIndirect(frame.commands.buffer.buffer, first,
+                                    batch.commandCount, stride);
+            stats.draws++;
+        }
+        else
+        {
+            for (uint32_t command = 0; command < batch.commandCount; command++)
+            {
+                cmd.drawIndexedIndirect(frame.commands.buffer.buffer,
+                                        first + command * stride, 1, stride);
+            }
+            stats.draws += batch.commandCount;
+        }
+    }
+}
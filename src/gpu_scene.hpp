@@ -0,0 +1,119 @@
+#pragma once
+#include "mesh_renderer.hpp"
+#include <array>
+#include <map>
+#include <tuple>
+#include <vector>
+
+// Objects that stay between frames and are drawn without per object work
+// on the CPU. Transforms, bounds and submesh ranges live in device local
+// buffers that only get the changes uploaded. A compute pass culls the
+// objects against the frustum and writes the indirect commands of every
+// batch of objects that share their state, which are then drawn with one
+// indirect call each. Only the finest level of detail is drawn
+class GpuScene
+{
+public:
+    using ObjectId = uint32_t;
+
+    void Init(Engine& engine);
+
+    ObjectId Add(Mesh::Ptr mesh, Material::Ptr material, TextureSet::Ptr textures,
+                 const glm::mat4& model);
+    void SetTransform(ObjectId id, const glm::mat4& model);
+    void Remove(ObjectId id);
+
+    // Uploads the changes and culls the objects into this frame's
+    // commands, must be recorded before the render pass begins
+    void Cull(vk::CommandBuffer cmd);
+    void WriteCmdBuffer(vk::CommandBuffer cmd, MeshRenderer::Stats& stats);
+
+    uint32_t GetObjectCount() const { return m_objectCount; }
+    uint32_t GetBatchCount() const { return static_cast<uint32_t>(m_batches.size()); }
+private:
+    struct Object
+    {
+        Mesh::Ptr mesh;
+        Material::Ptr material;
+        TextureSet::Ptr textures;
+        glm::mat4 model;
+    };
+
+    // Objects drawn with the same bindings and push constants
+    struct Batch
+    {
+        Material::Ptr material;
+        TextureSet::Ptr textures;
+        Mesh::Ptr mesh;
+        uint32_t firstCommand = 0;
+        uint32_t commandCount = 0;
+    };
+
+    // Material, texture set, vertex format, vertex and index buffer, index
+    // type and position dequantization
+    using BatchKey = std::tuple<const Material*, const TextureSet*, VertexFormat,
+                                vk::Buffer, vk::Buffer, vk::IndexType,
+                                std::array<float, 6>>;
+
+    // A persistent buffer and how many elements it has room for
+    struct SceneBuffer
+    {
+        AllocatedBuffer buffer;
+        vk::DeviceSize capacity = 0;
+    };
+
+    struct Frame
+    {
+        SceneBuffer commands;
+        // Visible commands of every batch, unused without drawIndirectCount
+        SceneBuffer counts;
+        vk::DescriptorSet cullDescriptor;
+        // Global set with the instance buffer of the scene at binding 2
+        vk::DescriptorSet globalDescriptor;
+        // Buffers the descriptors were written with
+        uint64_t generation = 0;
+    };
+
+    // Groups the objects into batches and uploads everything but the
+    // transforms
+    void Rebuild(vk::CommandBuffer cmd);
+    void UploadTransforms(vk::CommandBuffer cmd);
+    // Grows the buffer to hold count elements of size bytes, the old one is
+    // released once frames in flight are done. Returns whether it changed
+    bool Reserve(SceneBuffer& buffer, vk::DeviceSize count, vk::DeviceSize size,
+                 vk::BufferUsageFlags usage, VmaMemoryUsage memoryUsage);
+    void Write(vk::CommandBuffer cmd, vk::Buffer buffer, vk::DeviceSize offset,
+               const void* data, vk::DeviceSize size);
+    void WriteDescriptors(Frame& frame);
+
+    Engine* m_engine = nullptr;
+    std::vector<std::optional<Object>> m_objects;
+    std::vector<ObjectId> m_free;
+    uint32_t m_objectCount = 0;
+    // Objects that moved since their transform was last uploaded
+    std::vector<ObjectId> m_moved;
+    bool m_changed = false;
+    // Objects left out of the last rebuild because their mesh was still
+    // loading
+    std::vector<ObjectId> m_loading;
+
+    std::vector<Batch> m_batches;
+    uint32_t m_commandCount = 0;
+    // Object drawn by every command, pushed as a constant on devices
+    // without drawIndirectFirstInstance
+    std::vector<ObjectId> m_commandObjects;
+
+    // Per object, indexed by id
+    SceneBuffer m_instances;
+    SceneBuffer m_objectData;
+    // Submeshes of all meshes in the scene
+    SceneBuffer m_ranges;
+    // First command of every batch
+    SceneBuffer m_batchData;
+    uint64_t m_generation = 1;
+
+    vk::UniqueDescriptorSetLayout m_cullSetLayout;
+    vk::UniquePipelineLayout m_cullPipelineLayout;
+    vk::UniquePipeline m_cullPipeline;
+    std::vector<Frame> m_frames;
+};
@@ -0,0 +1,146 @@
+#include "mesh_cache.hpp"
+#include "mesh_renderer.hpp"
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/fmt.h>
+#include <fstream>
+#include <cstring>
+
+namespace {
+    constexpr char s_magic[8] = {'M', 'E', 'S', 'H', 'C', 'C', 'H', '\0'};
+
+    static_assert(sizeof(MeshCache::Header) % alignof(Vertex) == 0);
+    static_assert(std::is_trivially_copyable_v<Vertex>);
+    static_assert(std::is_trivially_copyable_v<Submesh>);
+    static_assert(std::is_trivially_copyable_v<Meshlet>);
+}
+
+std::filesystem::path MeshCache::PathFor(const std::filesystem::path& source,
+                                         uint64_t sourceHash) const
+{
+    if (m_directory.empty())
+    {
+        auto result = source;
+        result += ".meshcache";
+        return result;
+    }
+
+    return m_directory / fmt::format("{}-{:016x}.meshcache",
+                                     source.stem().string(), sourceHash);
+}
+
+std::optional<MeshCache::Entry> MeshCache::Load(const std::filesystem::path& path,
+                                                uint64_t sourceHash) const
+{
+    MappedFile file(path);
+    if (!file || file.size() < sizeof(Header))
+        return std::nullopt;
+
+    Header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, s_magic, sizeof(s_magic)) != 0
+        || header.version != s_version
+        || header.vertexSize != sizeof(Vertex)
+        || header.sourceHash != sourceHash)
+    {
+        return std::nullopt;
+    }
+
+    // Counts come from the file, bound them before multiplying so the
+    // section sizes can not wrap around
+    if (header.vertexCount > file.size() / sizeof(Vertex)
+        || header.indexCount > file.size() / sizeof(uint32_t)
+        || header.submeshCount > file.size() / sizeof(Submesh)
+        || header.meshletCount > file.size() / sizeof(Meshlet))
+    {
+        spdlog::warn("Mesh cache {} is truncated", path.c_str());
+        return std::nullopt;
+    }
+
+    std::size_t verticesSize = header.vertexCount * sizeof(Vertex);
+    std::size_t indicesSize = header.indexCount * sizeof(uint32_t);
+    std::size_t submeshesSize = header.submeshCount * sizeof(Submesh);
+    std::size_t meshletsSize = header.meshletCount * sizeof(Meshlet);
+    if (file.size() != sizeof(Header) + verticesSize + indicesSize + submeshesSize + meshletsSize)
+    {
+        spdlog::warn("Mesh cache {} is truncated", path.c_str());
+        return std::nullopt;
+    }
+
+    Entry result;
+    const char* vertices = file.data() + sizeof(Header);
+    const char* indices = vertices + verticesSize;
+    const char* submeshes = indices + indicesSize;
+    const char* meshlets = submeshes + submeshesSize;
+    result.vertices = {reinterpret_cast<const Vertex*>(vertices), header.vertexCount};
+    result.indices = {reinterpret_cast<const uint32_t*>(indices), header.indexCount};
+    result.submeshes = {reinterpret_cast<const Submesh*>(submeshes), header.submeshCount};
+    result.meshlets = {reinterpret_cast<const Meshlet*>(meshlets), header.meshletCount};
+    result.surfaceCenter = header.surfaceCenter;
+    result.min = header.min;
+    result.max = header.max;
+    result.sphereCenter = header.sphereCenter;
+    result.sphereRadius = header.sphereRadius;
+    result.file = std::move(file);
+    return result;
+}
+
+void MeshCache::Store(const std::filesystem::path& path, uint64_t sourceHash,
+                      const Mesh& mesh) const
+{
+    Header header {};
+    std::memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = s_version;
+    header.vertexSize = sizeof(Vertex);
+    header.sourceHash = sourceHash;
+    header.vertexCount = mesh.vertices.size();
+    header.indexCount = mesh.indices.size();
+    header.submeshCount = mesh.submeshes.size();
+    header.meshletCount = mesh.meshlets.size();
+    header.surfaceCenter = mesh.surfaceCenter;
+    header.min = mesh.min;
+    header.max = mesh.max;
+    header.sphereCenter = mesh.sphereCenter;
+    header.sphereRadius = mesh.sphereRadius;
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    // Write to a temporary file first so an interrupted write never
+    // leaves a valid looking entry behind
+    auto temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            spdlog::warn("Failed to write mesh cache {}", path.c_str());
+            return;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(mesh.vertices.data()),
+                   mesh.vertices.size() * sizeof(Vertex));
+        file.write(reinterpret_cast<const char*>(mesh.indices.data()),
+                   mesh.indices.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(mesh.submeshes.data()),
+                   mesh.submeshes.size() * sizeof(Submesh));
+        file.write(reinterpret_cast<const char*>(mesh.meshlets.data()),
+                   mesh.meshlets.size() * sizeof(Meshlet));
+
+        if (!file)
+        {
+            spdlog::warn("Failed to write mesh cache {}", path.c_str());
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+        spdlog::warn("Failed to write mesh cache {}: {}", path.c_str(), error.message());
+        std::filesystem::remove(temporary, error);
+    }
+}
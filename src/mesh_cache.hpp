@@ -0,0 +1,67 @@
+#pragma once
+#include "vertex.hpp"
+#include "files.hpp"
+#include "mesh_processing.hpp"
+#include "meshlet_builder.hpp"
+#include <filesystem>
+#include <optional>
+#include <span>
+
+struct Mesh;
+
+// Binary cache of fully processed meshes. A cache entry holds the final
+// vertex and index arrays, so warm loads skip parsing, vertex deduplication
+// and tangent generation. Entries are keyed by the content hash of the
+// source file and are written next to it unless a cache directory is set
+class MeshCache
+{
+public:
+    static constexpr uint32_t s_version = 7;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t vertexSize;
+        uint64_t sourceHash;
+        uint64_t vertexCount;
+        uint64_t indexCount;
+        glm::vec3 surfaceCenter;
+        glm::vec3 min;
+        glm::vec3 max;
+        glm::vec3 sphereCenter;
+        float sphereRadius;
+        uint32_t submeshCount;
+        uint32_t meshletCount;
+    };
+
+    struct Entry
+    {
+        MappedFile file;
+        std::span<const Vertex> vertices;
+        std::span<const uint32_t> indices;
+        std::span<const Submesh> submeshes;
+        std::span<const Meshlet> meshlets;
+        glm::vec3 surfaceCenter;
+        glm::vec3 min;
+        glm::vec3 max;
+        glm::vec3 sphereCenter;
+        float sphereRadius;
+    };
+
+    void SetDirectory(const std::filesystem::path& directory)
+    {
+        m_directory = directory;
+    }
+
+    std::filesystem::path PathFor(const std::filesystem::path& source,
+                                  uint64_t sourceHash) const;
+
+    std::optional<Entry> Load(const std::filesystem::path& path,
+                              uint64_t sourceHash) const;
+    void Store(const std::filesystem::path& path, uint64_t sourceHash,
+               const Mesh& mesh) const;
+
+private:
+    std::filesystem::path m_directory;
+};
@@ -23,9 +23,9 @@ public:
 
         rot = glm::yawPitchRoll(yaw, pitch, roll);
         trans = glm::translate(trans, position);
-        displ = glm::translate(displ, -mesh_center);
+        displ = glm::translate(displ, -(center_on_surface ? m_mesh->surfaceCenter : mesh_center));
         s = glm::scale(s, {scale, scale, scale});
-        m_renderer.Add(m_mesh, m_material, m_textures, trans * rot * s * displ);
+        m_renderer.Add(m_mesh, m_material, m_textures, trans * rot * s * displ, &m_lod);
     }
 
     void ImGuiOptions() override
@@ -35,9 +35,14 @@ public:
         {
             for (const auto& name : m_materialManager.GetNames())
             {
+                // Packed and separate texture sets use different layouts
+                auto material = m_materialManager.Get(name);
+                if (material->textures && m_textures && material->packed != m_textures->packed)
+                    continue;
+
                 if (ImGui::Selectable(name.c_str()))
                 {
-                    m_material = m_materialManager.Get(name);
+                    m_material = material;
                 }
             }
             ImGui::EndCombo();
@@ -45,6 +50,9 @@ public:
     };
 
     glm::vec3 mesh_center = {0, 0, 0};
+    // Use the surface center of the mesh instead, it is only known once
+    // the mesh has loaded
+    bool center_on_surface = false;
 
     Mesh::Ptr GetMesh() const { return m_mesh; }
 
@@ -53,5 +61,6 @@ private:
     Mesh::Ptr m_mesh;
     Material::Ptr m_material;
     TextureSet::Ptr m_textures;
+    MeshRenderer::LodState m_lod;
     MaterialManager& m_materialManager;
 };
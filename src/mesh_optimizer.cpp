@@ -0,0 +1,316 @@
+#include "mesh_optimizer.hpp"
+#include <Tracy.hpp>
+#include <algorithm>
+#include <numeric>
+
+namespace {
+    // Vertex to triangle adjacency, a triangle is listed once per corner
+    struct Adjacency
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+
+        Adjacency(std::span<const uint32_t> indices, std::size_t vertexCount)
+            : offsets(vertexCount + 1, 0), triangles(indices.size())
+        {
+            for (uint32_t index : indices)
+                offsets[index + 1]++;
+
+            for (std::size_t i = 0; i < vertexCount; i++)
+                offsets[i + 1] += offsets[i];
+
+            std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+            for (std::size_t i = 0; i < indices.size(); i++)
+                triangles[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        std::span<const uint32_t> Of(uint32_t vertex) const
+        {
+            return {triangles.data() + offsets[vertex], offsets[vertex + 1] - offsets[vertex]};
+        }
+    };
+
+    // FIFO post transform cache. A vertex is cached while fewer than size
+    // misses happened since it was loaded
+    class CacheSimulator
+    {
+    public:
+        CacheSimulator(std::size_t vertexCount, uint32_t size)
+            : m_stamps(vertexCount, 0), m_size(size), m_time(size + 1)
+        {}
+
+        uint32_t Triangle(const uint32_t* triangle)
+        {
+            uint32_t misses = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t& stamp = m_stamps[triangle[k]];
+                if (m_time - stamp > m_size)
+                {
+                    stamp = m_time++;
+                    misses++;
+                }
+            }
+            return misses;
+        }
+
+        void Flush()
+        {
+            m_time += m_size + 1;
+        }
+
+    private:
+        std::vector<uint32_t> m_stamps;
+        uint32_t m_size;
+        uint32_t m_time;
+    };
+
+    // Splits the triangle order into runs that can be reordered without
+    // losing much cache efficiency
+    std::vector<uint32_t> FindClusters(std::span<const uint32_t> indices,
+                                       std::size_t vertexCount, float threshold)
+    {
+        std::size_t triangleCount = indices.size() / 3;
+        CacheSimulator cache(vertexCount, MeshOptimizer::s_cacheSize);
+
+        // Hard boundaries where the cache got fully flushed
+        std::vector<uint32_t> hard;
+        for (std::size_t i = 0; i < triangleCount; i++)
+        {
+            if (cache.Triangle(&indices[3 * i]) == 3 || i == 0)
+                hard.push_back(static_cast<uint32_t>(i));
+        }
+        hard.push_back(static_cast<uint32_t>(triangleCount));
+
+        // Soft boundaries once a run has reached the cluster's efficiency
+        std::vector<uint32_t> result;
+        for (std::size_t c = 0; c + 1 < hard.size(); c++)
+        {
+            uint32_t begin = hard[c];
+            uint32_t end = hard[c + 1];
+
+            cache.Flush();
+            uint32_t clusterMisses = 0;
+            for (uint32_t i = begin; i < end; i++)
+                clusterMisses += cache.Triangle(&indices[3 * i]);
+
+            float clusterThreshold = threshold * clusterMisses / (end - begin);
+
+            cache.Flush();
+            result.push_back(begin);
+            uint32_t runMisses = 0;
+            uint32_t runTriangles = 0;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                runMisses += cache.Triangle(&indices[3 * i]);
+                runTriangles++;
+
+                if (i + 1 < end && float(runMisses) / runTriangles <= clusterThreshold)
+                {
+                    result.push_back(i + 1);
+                    cache.Flush();
+                    runMisses = 0;
+                    runTriangles = 0;
+                }
+            }
+        }
+
+        return result;
+    }
+}
+
+void MeshOptimizer::Optimize(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+    ZoneScoped;
+    OptimizeVertexCache(indices, vertices.size());
+    OptimizeOverdraw(indices, vertices);
+    OptimizeVertexFetch(vertices, indices);
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::span<uint32_t> indices, std::size_t vertexCount)
+{
+    ZoneScoped;
+    std::size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    std::vector<uint32_t> source(indices.begin(), indices.begin() + triangleCount * 3);
+    Adjacency adjacency(source, vertexCount);
+
+    std::vector<uint32_t> live(vertexCount);
+    for (std::size_t v = 0; v < vertexCount; v++)
+        live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    deadEnd.reserve(source.size());
+
+    uint32_t time = s_cacheSize + 1;
+    std::size_t cursor = 0;
+    std::size_t output = 0;
+
+    auto skipDeadEnd = [&]() -> int64_t {
+        while (!deadEnd.empty())
+        {
+            uint32_t vertex = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[vertex] > 0)
+                return vertex;
+        }
+
+        for (; cursor < vertexCount; cursor++)
+        {
+            if (live[cursor] > 0)
+                return static_cast<int64_t>(cursor);
+        }
+        return -1;
+    };
+
+    for (int64_t fanning = skipDeadEnd(); fanning >= 0;)
+    {
+        candidates.clear();
+        for (uint32_t triangle : adjacency.Of(static_cast<uint32_t>(fanning)))
+        {
+            if (emitted[triangle])
+                continue;
+
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t vertex = source[3 * triangle + k];
+                indices[output++] = vertex;
+                deadEnd.push_back(vertex);
+                candidates.push_back(vertex);
+                live[vertex]--;
+
+                if (time - cacheTime[vertex] > s_cacheSize)
+                {
+                    cacheTime[vertex] = time;
+                    time++;
+                }
+            }
+            emitted[triangle] = true;
+        }
+
+        // Prefer the vertex that stays in the cache longest, as long as
+        // its remaining triangles still fit before it gets evicted
+        int64_t best = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t vertex : candidates)
+        {
+            if (live[vertex] == 0)
+                continue;
+
+            int64_t age = time - cacheTime[vertex];
+            int64_t priority = age + 2 * live[vertex] <= s_cacheSize ? age : 0;
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                best = vertex;
+            }
+        }
+
+        fanning = best >= 0 ? best : skipDeadEnd();
+    }
+}
+
+void MeshOptimizer::OptimizeOverdraw(std::span<uint32_t> indices, std::span<const Vertex> vertices,
+                                     float threshold)
+{
+    ZoneScoped;
+    std::size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    std::vector<uint32_t> clusters = FindClusters(indices, vertices.size(), threshold);
+    clusters.push_back(static_cast<uint32_t>(triangleCount));
+    std::size_t clusterCount = clusters.size() - 1;
+
+    std::vector<glm::vec3> centers(clusterCount, glm::vec3(0));
+    std::vector<glm::vec3> normals(clusterCount, glm::vec3(0));
+    glm::vec3 meshCenter(0);
+    float meshArea = 0;
+
+    for (std::size_t c = 0; c < clusterCount; c++)
+    {
+        float clusterArea = 0;
+        for (uint32_t i = clusters[c]; i < clusters[c + 1]; i++)
+        {
+            glm::vec3 p0 = vertices[indices[3 * i]].position;
+            glm::vec3 p1 = vertices[indices[3 * i + 1]].position;
+            glm::vec3 p2 = vertices[indices[3 * i + 2]].position;
+
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+
+            centers[c] += (p0 + p1 + p2) * (area / 3.f);
+            normals[c] += normal;
+            clusterArea += area;
+        }
+
+        meshCenter += centers[c];
+        meshArea += clusterArea;
+        centers[c] = clusterArea > 0 ? centers[c] / clusterArea : centers[c];
+    }
+    meshCenter = meshArea > 0 ? meshCenter / meshArea : meshCenter;
+
+    // Clusters facing away from the center occlude the rest, draw them first
+    std::vector<float> keys(clusterCount);
+    for (std::size_t c = 0; c < clusterCount; c++)
+    {
+        float length = glm::length(normals[c]);
+        keys[c] = length > 0 ? glm::dot(centers[c] - meshCenter, normals[c] / length) : 0.0f;
+    }
+
+    std::vector<uint32_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::stable_sort(order, [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+    std::vector<uint32_t> source(indices.begin(), indices.begin() + triangleCount * 3);
+    std::size_t output = 0;
+    for (uint32_t c : order)
+    {
+        for (uint32_t i = 3 * clusters[c]; i < 3 * clusters[c + 1]; i++)
+            indices[output++] = source[i];
+    }
+}
+
+void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::span<uint32_t> indices)
+{
+    ZoneScoped;
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<Vertex> result;
+    result.reserve(vertices.size());
+
+    for (uint32_t& index : indices)
+    {
+        if (remap[index] == UINT32_MAX)
+        {
+            remap[index] = static_cast<uint32_t>(result.size());
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    vertices = std::move(result);
+}
+
+MeshOptimizer::CacheStatistics MeshOptimizer::AnalyzeVertexCache(std::span<const uint32_t> indices,
+                                                                 std::size_t vertexCount,
+                                                                 uint32_t cacheSize)
+{
+    CacheStatistics result;
+    std::size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || vertexCount == 0)
+        return result;
+
+    CacheSimulator cache(vertexCount, cacheSize);
+    std::size_t misses = 0;
+    for (std::size_t i = 0; i < triangleCount; i++)
+        misses += cache.Triangle(&indices[3 * i]);
+
+    result.acmr = float(misses) / triangleCount;
+    result.atvr = float(misses) / vertexCount;
+    return result;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "vertex.hpp"
+#include <span>
+#include <vector>
+
+// Index and vertex reordering for GPU efficiency. Triangles are ordered for
+// the post transform cache with Tipsify (Sander et al. 2007), the resulting
+// clusters are sorted front to back around the mesh center to reduce
+// overdraw and vertices are finally renumbered in order of first use
+class MeshOptimizer
+{
+public:
+    struct CacheStatistics
+    {
+        // Average cache miss ratio, transformed vertices per triangle
+        float acmr = 0.0f;
+        // Average transform to vertex ratio, 1 is optimal
+        float atvr = 0.0f;
+    };
+
+    static constexpr uint32_t s_cacheSize = 16;
+
+    static void Optimize(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+    static void OptimizeVertexCache(std::span<uint32_t> indices, std::size_t vertexCount);
+    // Clusters may only grow the ACMR by threshold over the cache
+    // optimized order
+    static void OptimizeOverdraw(std::span<uint32_t> indices, std::span<const Vertex> vertices,
+                                 float threshold = 1.05f);
+    static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::span<uint32_t> indices);
+
+    // Simulates a FIFO cache of cacheSize entries
+    static CacheStatistics AnalyzeVertexCache(std::span<const uint32_t> indices,
+                                              std::size_t vertexCount,
+                                              uint32_t cacheSize = s_cacheSize);
+};
@@ -0,0 +1,361 @@
+#include "mesh_processing.hpp"
+#include "thread_pool.hpp"
+#include <Tracy.hpp>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // Per triangle terms stored as structure of arrays
+    struct TriangleTerms
+    {
+        explicit TriangleTerms(std::size_t count)
+            : sdirX(count), sdirY(count), sdirZ(count),
+              tdirX(count), tdirY(count), tdirZ(count),
+              weightedX(count), weightedY(count), weightedZ(count),
+              area(count)
+        {}
+
+        std::vector<float> sdirX, sdirY, sdirZ;
+        std::vector<float> tdirX, tdirY, tdirZ;
+        std::vector<float> weightedX, weightedY, weightedZ;
+        std::vector<float> area;
+    };
+
+    // Triangles referencing each vertex in corner order, a triangle shows up
+    // once per corner it has on that vertex
+    struct VertexTriangles
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+    };
+
+    void ComputeTriangleTerms(std::span<const Vertex> vertices,
+                              std::span<const uint32_t> indices,
+                              TriangleTerms& terms, ThreadPool& pool)
+    {
+        ZoneScoped;
+        std::size_t triangleCount = indices.size() / 3;
+
+        pool.ParallelFor(triangleCount, pool.BatchSize(triangleCount),
+                         [&](std::size_t begin, std::size_t end, std::size_t) {
+            for (std::size_t i = begin; i < end; i++)
+            {
+                const Vertex& vertex0 = vertices[indices[3 * i]];
+                const Vertex& vertex1 = vertices[indices[3 * i + 1]];
+                const Vertex& vertex2 = vertices[indices[3 * i + 2]];
+
+                glm::vec3 v1 = vertex0.position;
+                glm::vec3 v2 = vertex1.position;
+                glm::vec3 v3 = vertex2.position;
+
+                glm::vec2 w1 = vertex0.textureCoord;
+                glm::vec2 w2 = vertex1.textureCoord;
+                glm::vec2 w3 = vertex2.textureCoord;
+
+                float x1 = v2.x - v1.x;
+                float x2 = v3.x - v1.x;
+                float y1 = v2.y - v1.y;
+                float y2 = v3.y - v1.y;
+                float z1 = v2.z - v1.z;
+                float z2 = v3.z - v1.z;
+
+                float s1 = w2.x - w1.x;
+                float s2 = w3.x - w1.x;
+                float t1 = w2.y - w1.y;
+                float t2 = w3.y - w1.y;
+
+                float r = 1.0F / (s1 * t2 - s2 * t1);
+                terms.sdirX[i] = (t2 * x1 - t1 * x2) * r;
+                terms.sdirY[i] = (t2 * y1 - t1 * y2) * r;
+                terms.sdirZ[i] = (t2 * z1 - t1 * z2) * r;
+                terms.tdirX[i] = (s1 * x2 - s2 * x1) * r;
+                terms.tdirY[i] = (s1 * y2 - s2 * y1) * r;
+                terms.tdirZ[i] = (s1 * z2 - s2 * z1) * r;
+
+                glm::vec3 center = (v1 + v2 + v3) / 3.f;
+                float area = 0.5 * glm::length(glm::cross(v2 - v1, v3 - v1));
+                glm::vec3 weighted = area * center;
+                terms.weightedX[i] = weighted.x;
+                terms.weightedY[i] = weighted.y;
+                terms.weightedZ[i] = weighted.z;
+                terms.area[i] = area;
+            }
+        });
+    }
+
+    VertexTriangles BuildVertexTriangles(std::size_t vertexCount,
+                                         std::span<const uint32_t> indices)
+    {
+        ZoneScoped;
+        VertexTriangles result;
+        result.offsets.assign(vertexCount + 1, 0);
+        result.triangles.resize(indices.size());
+
+        for (uint32_t index : indices)
+        {
+            result.offsets[index + 1]++;
+        }
+
+        for (std::size_t i = 0; i < vertexCount; i++)
+        {
+            result.offsets[i + 1] += result.offsets[i];
+        }
+
+        std::vector<uint32_t> cursor(result.offsets.begin(), result.offsets.end() - 1);
+        for (std::size_t i = 0; i < indices.size(); i++)
+        {
+            result.triangles[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        return result;
+    }
+
+    // Degenerate directions end up as +Z
+    glm::vec2 OctEncode(const glm::vec3& direction)
+    {
+        float sum = std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z);
+        if (!(sum > 0.0f) || !std::isfinite(sum))
+            return glm::vec2(0.0f);
+
+        glm::vec2 result = glm::vec2(direction.x, direction.y) / sum;
+        if (direction.z < 0.0f)
+        {
+            glm::vec2 sign(result.x >= 0.0f ? 1.0f : -1.0f, result.y >= 0.0f ? 1.0f : -1.0f);
+            result = (1.0f - glm::abs(glm::vec2(result.y, result.x))) * sign;
+        }
+        return result;
+    }
+
+    int16_t PackSnorm16(float value)
+    {
+        return static_cast<int16_t>(std::round(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+    }
+
+    uint16_t PackUnorm16(float value)
+    {
+        return static_cast<uint16_t>(std::round(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+    }
+}
+
+MeshProcessing::Summary MeshProcessing::GenerateTangents(std::span<Vertex> vertices,
+                                                         std::span<const uint32_t> indices,
+                                                         ThreadPool& pool)
+{
+    ZoneScoped;
+    Summary summary {};
+    if (vertices.empty())
+        return summary;
+
+    std::size_t triangleCount = indices.size() / 3;
+    indices = indices.first(triangleCount * 3);
+
+    TriangleTerms terms(triangleCount);
+    ComputeTriangleTerms(vertices, indices, terms, pool);
+    VertexTriangles vertexTriangles = BuildVertexTriangles(vertices.size(), indices);
+
+    std::size_t batchSize = pool.BatchSize(vertices.size());
+    std::size_t batchCount = (vertices.size() + batchSize - 1) / batchSize;
+    std::vector<glm::vec3> batchMin(batchCount, vertices.front().position);
+    std::vector<glm::vec3> batchMax(batchCount, vertices.front().position);
+
+    {
+        ZoneScopedN("Orthogonalize");
+        pool.ParallelFor(vertices.size(), batchSize,
+                         [&](std::size_t begin, std::size_t end, std::size_t batch) {
+            glm::vec3 min = batchMin[batch];
+            glm::vec3 max = batchMax[batch];
+
+            for (std::size_t a = begin; a < end; a++)
+            {
+                // Summed in triangle order, matching a serial scatter
+                glm::vec3 t(0);
+                glm::vec3 bitangent(0);
+                for (uint32_t i = vertexTriangles.offsets[a];
+                     i < vertexTriangles.offsets[a + 1]; i++)
+                {
+                    uint32_t triangle = vertexTriangles.triangles[i];
+                    t += glm::vec3(terms.sdirX[triangle], terms.sdirY[triangle],
+                                   terms.sdirZ[triangle]);
+                    bitangent += glm::vec3(terms.tdirX[triangle], terms.tdirY[triangle],
+                                           terms.tdirZ[triangle]);
+                }
+
+                Vertex& vertex = vertices[a];
+                const glm::vec3& n = vertex.normal;
+
+                // Gram-Schmidt orthogonalize
+                vertex.tangent = glm::vec4(glm::normalize(t - n * glm::dot(n, t)), 1.f);
+
+                // Calculate handedness
+                vertex.tangent.w =
+                    (glm::dot(glm::cross(n, t), bitangent) < 0.0F) ? -1.0F : 1.0F;
+
+                min = glm::min(min, vertex.position);
+                max = glm::max(max, vertex.position);
+            }
+
+            batchMin[batch] = min;
+            batchMax[batch] = max;
+        });
+    }
+
+    summary.min = batchMin.front();
+    summary.max = batchMax.front();
+    for (std::size_t i = 1; i < batchCount; i++)
+    {
+        summary.min = glm::min(summary.min, batchMin[i]);
+        summary.max = glm::max(summary.max, batchMax[i]);
+    }
+
+    // Kept serial, reordering the float sums would change the result
+    float areaSum = 0.0;
+    glm::vec3 centroid(0.0);
+    for (std::size_t i = 0; i < triangleCount; i++)
+    {
+        centroid += glm::vec3(terms.weightedX[i], terms.weightedY[i], terms.weightedZ[i]);
+        areaSum += terms.area[i];
+    }
+    summary.surfaceCenter = centroid / areaSum;
+
+    return summary;
+}
+
+glm::vec4 MeshProcessing::BoundingSphere(std::span<const Vertex> vertices,
+                                         const glm::vec3& min, const glm::vec3& max)
+{
+    ZoneScoped;
+    glm::vec3 center = (min + max) * 0.5f;
+    float radiusSquared = 0.0f;
+    for (const auto& vertex : vertices)
+    {
+        glm::vec3 offset = vertex.position - center;
+        radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+    }
+    return glm::vec4(center, std::sqrt(radiusSquared));
+}
+
+MeshProcessing::PositionQuantization MeshProcessing::PackVertices(
+    std::span<const Vertex> vertices, std::span<PackedVertex> output)
+{
+    ZoneScoped;
+    PositionQuantization result;
+    result.positionOffset = glm::vec3(0);
+    result.positionScale = glm::vec3(1);
+    if (vertices.empty())
+        return result;
+
+    auto& pool = ThreadPool::Global();
+    std::size_t batchSize = pool.BatchSize(vertices.size());
+    std::size_t batchCount = (vertices.size() + batchSize - 1) / batchSize;
+    std::vector<glm::vec3> batchMin(batchCount, vertices.front().position);
+    std::vector<glm::vec3> batchMax(batchCount, vertices.front().position);
+
+    pool.ParallelFor(vertices.size(), batchSize,
+                     [&](std::size_t begin, std::size_t end, std::size_t batch) {
+        for (std::size_t i = begin; i < end; i++)
+        {
+            batchMin[batch] = glm::min(batchMin[batch], vertices[i].position);
+            batchMax[batch] = glm::max(batchMax[batch], vertices[i].position);
+        }
+    });
+
+    glm::vec3 min = batchMin.front();
+    glm::vec3 max = batchMax.front();
+    for (std::size_t i = 1; i < batchCount; i++)
+    {
+        min = glm::min(min, batchMin[i]);
+        max = glm::max(max, batchMax[i]);
+    }
+
+    glm::vec3 extent = max - min;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (!(extent[axis] > 0.0f))
+            extent[axis] = 1.0f;
+    }
+    result.positionOffset = min;
+    result.positionScale = extent;
+
+    pool.ParallelFor(vertices.size(), batchSize,
+                     [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++)
+        {
+            const Vertex& vertex = vertices[i];
+            PackedVertex& packed = output[i];
+
+            glm::vec3 position = (vertex.position - min) / extent;
+            packed.position[0] = PackUnorm16(position.x);
+            packed.position[1] = PackUnorm16(position.y);
+            packed.position[2] = PackUnorm16(position.z);
+            packed.position[3] = vertex.tangent.w < 0.0f ? 0 : 65535;
+
+            glm::vec2 normal = OctEncode(vertex.normal);
+            packed.normal[0] = PackSnorm16(normal.x);
+            packed.normal[1] = PackSnorm16(normal.y);
+
+            glm::vec2 tangent = OctEncode(glm::vec3(vertex.tangent));
+            packed.tangent[0] = PackSnorm16(tangent.x);
+            packed.tangent[1] = PackSnorm16(tangent.y);
+
+            packed.textureCoord[0] = glm::packHalf1x16(vertex.textureCoord.x);
+            packed.textureCoord[1] = glm::packHalf1x16(vertex.textureCoord.y);
+        }
+    });
+
+    return result;
+}
+
+MeshProcessing::SplitMesh MeshProcessing::Split(std::span<const Vertex> vertices,
+                                                std::span<const uint32_t> indices,
+                                                uint32_t maxVertices)
+{
+    ZoneScoped;
+    SplitMesh result;
+    result.vertices.reserve(vertices.size());
+    result.indices.reserve(indices.size());
+
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<uint32_t> used;
+    Submesh current {};
+
+    for (std::size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        uint32_t a = indices[i];
+        uint32_t b = indices[i + 1];
+        uint32_t c = indices[i + 2];
+
+        uint32_t added = (remap[a] == UINT32_MAX)
+            + (b != a && remap[b] == UINT32_MAX)
+            + (c != a && c != b && remap[c] == UINT32_MAX);
+
+        if (current.vertexCount + added > maxVertices)
+        {
+            result.submeshes.push_back(current);
+            for (uint32_t vertex : used)
+                remap[vertex] = UINT32_MAX;
+            used.clear();
+
+            current = {};
+            current.firstIndex = static_cast<uint32_t>(result.indices.size());
+            current.vertexOffset = static_cast<int32_t>(result.vertices.size());
+        }
+
+        for (uint32_t vertex : {a, b, c})
+        {
+            if (remap[vertex] == UINT32_MAX)
+            {
+                remap[vertex] = current.vertexCount++;
+                used.push_back(vertex);
+                result.vertices.push_back(vertices[vertex]);
+            }
+            result.indices.push_back(remap[vertex]);
+        }
+        current.indexCount += 3;
+    }
+
+    if (current.indexCount > 0)
+        result.submeshes.push_back(current);
+
+    return result;
+}
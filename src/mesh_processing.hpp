@@ -0,0 +1,72 @@
+#pragma once
+#include "vertex.hpp"
+#include "thread_pool.hpp"
+#include <span>
+#include <vector>
+
+// Range of a mesh drawn with one indexed draw, indices are relative to
+// vertexOffset. Levels of detail of a submesh share its vertex range
+struct Submesh
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+    uint32_t vertexCount;
+    uint32_t lod = 0;
+    // Simplification error of the level in object space units
+    float error = 0.0f;
+    // Range in Mesh::meshlets, empty when meshlets were not built
+    uint32_t firstMeshlet = 0;
+    uint32_t meshletCount = 0;
+};
+
+// CPU side processing applied to every mesh before upload. Work is split
+// across the global thread pool, per vertex sums are gathered in triangle
+// order so the output does not depend on the thread count
+class MeshProcessing
+{
+public:
+    struct Summary
+    {
+        glm::vec3 surfaceCenter;
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    // Dequantized position is offset + packed position * scale
+    struct PositionQuantization
+    {
+        glm::vec3 positionOffset;
+        glm::vec3 positionScale;
+    };
+
+    struct SplitMesh
+    {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<Submesh> submeshes;
+    };
+
+    // Fills vertex tangents with handedness in w and returns the area
+    // weighted surface center together with the position bounds. The
+    // result is the same for any pool size
+    static Summary GenerateTangents(std::span<Vertex> vertices,
+                                    std::span<const uint32_t> indices,
+                                    ThreadPool& pool = ThreadPool::Global());
+
+    // Sphere around the center of the bounds that holds every vertex,
+    // center in xyz and radius in w
+    static glm::vec4 BoundingSphere(std::span<const Vertex> vertices,
+                                    const glm::vec3& min, const glm::vec3& max);
+
+    // Output has room for every vertex, it may be mapped staging memory
+    static PositionQuantization PackVertices(std::span<const Vertex> vertices,
+                                             std::span<PackedVertex> output);
+
+    // Splits triangles, in order, into submeshes referencing at most
+    // maxVertices vertices each. Vertices shared by several submeshes are
+    // duplicated
+    static SplitMesh Split(std::span<const Vertex> vertices,
+                           std::span<const uint32_t> indices,
+                           uint32_t maxVertices = 1 << 16);
+};
@@ -1,10 +1,23 @@
 #include "mesh_renderer.hpp"
 #include "initializers.hpp"
-#include <tiny_obj_loader.h>
+#include "obj_loader.hpp"
+#include "mesh_processing.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_simplifier.hpp"
+#include "thread_pool.hpp"
+#include "mip_generator.hpp"
+#include "texture_compressor.hpp"
+#include "radix_sort.hpp"
+#include "gpu_scene.hpp"
 #include <spdlog/spdlog.h>
 #include "shader_compiler.hpp"
 #include <stb_image.h>
 #include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <bit>
+#include <exception>
+#include <Tracy.hpp>
 
 std::array<vk::VertexInputAttributeDescription, 5>
 Vertex::AttributeDescriptions()
@@ -48,152 +61,1125 @@ vk::VertexInputBindingDescription Vertex::BindingDescription()
     return bindingDescription;
 }
 
-Texture::Ptr TextureManager::NewFromFile(const std::string &name,
-                                         const std::filesystem::path &filename,
-                                         vk::Format view_format)
+std::array<vk::VertexInputAttributeDescription, 4>
+PackedVertex::AttributeDescriptions()
 {
-    int texWidth, texHeight, texChannels;
+    std::array<vk::VertexInputAttributeDescription, 4> attributeDescriptions;
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = vk::Format::eR16G16B16A16Unorm;
+    attributeDescriptions[0].offset = offsetof(PackedVertex, position);
 
-    stbi_uc* pixels = stbi_load(filename.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = vk::Format::eR16G16Snorm;
+    attributeDescriptions[1].offset = offsetof(PackedVertex, normal);
 
-    if (!pixels) {
-        spdlog::error("Failed to load texture file {}", filename.c_str());
-        throw std::runtime_error("");
+    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].location = 3;
+    attributeDescriptions[2].format = vk::Format::eR16G16Sfloat;
+    attributeDescriptions[2].offset = offsetof(PackedVertex, textureCoord);
+
+    attributeDescriptions[3].binding = 0;
+    attributeDescriptions[3].location = 4;
+    attributeDescriptions[3].format = vk::Format::eR16G16Snorm;
+    attributeDescriptions[3].offset = offsetof(PackedVertex, tangent);
+
+    return attributeDescriptions;
+}
+
+vk::VertexInputBindingDescription PackedVertex::BindingDescription()
+{
+    vk::VertexInputBindingDescription bindingDescription;
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(PackedVertex);
+    bindingDescription.inputRate = vk::VertexInputRate::eVertex;
+    return bindingDescription;
+}
+
+vk::VertexInputBindingDescription VertexBindingDescription(VertexFormat format)
+{
+    switch (format)
+    {
+    case VertexFormat::Packed:
+        return PackedVertex::BindingDescription();
+    default:
+        return Vertex::BindingDescription();
     }
-    auto result = NewFromPixels(name, pixels, texWidth, texHeight, view_format);
+}
 
-    stbi_image_free(pixels);
+std::vector<vk::VertexInputAttributeDescription>
+VertexAttributeDescriptions(VertexFormat format, VertexAttributes attributes)
+{
+    std::vector<vk::VertexInputAttributeDescription> all;
+    if (format == VertexFormat::Packed)
+    {
+        auto descriptions = PackedVertex::AttributeDescriptions();
+        all.assign(descriptions.begin(), descriptions.end());
+    }
+    else
+    {
+        auto descriptions = Vertex::AttributeDescriptions();
+        all.assign(descriptions.begin(), descriptions.end());
+    }
+
+    std::vector<vk::VertexInputAttributeDescription> result;
+    for (const auto& description : all)
+    {
+        if (attributes & (1u << description.location))
+            result.push_back(description);
+    }
+    return result;
+}
+
+namespace {
+    TexelEncoding EncodingOf(vk::Format format)
+    {
+        switch (format)
+        {
+        case vk::Format::eR8G8B8A8Srgb:
+            return TexelEncoding::Srgb;
+        case vk::Format::eR8G8B8A8Snorm:
+        case vk::Format::eR8G8Snorm:
+        case vk::Format::eR8Snorm:
+            return TexelEncoding::Snorm;
+        default:
+            return TexelEncoding::Unorm;
+        }
+    }
+
+    uint32_t ChannelCount(TextureChannels channels)
+    {
+        switch (channels)
+        {
+        case TextureChannels::R:
+            return 1;
+        case TextureChannels::Rg:
+            return 2;
+        default:
+            return 4;
+        }
+    }
+
+    // The view format gives the encoding, the channels give the layout.
+    // Fewer than four channels are always linear, sRGB support for R8 and
+    // R8G8 is optional
+    vk::Format ChannelFormat(vk::Format view_format, TextureChannels channels)
+    {
+        bool snorm = EncodingOf(view_format) == TexelEncoding::Snorm;
+        switch (channels)
+        {
+        case TextureChannels::R:
+            return snorm ? vk::Format::eR8Snorm : vk::Format::eR8Unorm;
+        case TextureChannels::Rg:
+            return snorm ? vk::Format::eR8G8Snorm : vk::Format::eR8G8Unorm;
+        default:
+            return view_format;
+        }
+    }
+
+    const std::array<float, 256>& SrgbToLinear()
+    {
+        static const std::array<float, 256> table = [] {
+            std::array<float, 256> result;
+            for (int i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                result[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return result;
+        }();
+        return table;
+    }
+
+    // Keeps the first channels of every RGBA texel, in place
+    void PackChannels(uint8_t* texels, std::size_t count, uint32_t channels)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            for (uint32_t c = 0; c < channels; c++)
+                texels[i * channels + c] = texels[i * 4 + c];
+        }
+    }
+
+    std::optional<BlockFormat> BlockFormatOf(vk::Format view_format, TextureChannels channels)
+    {
+        // Signed data has no matching encoder
+        if (EncodingOf(view_format) == TexelEncoding::Snorm)
+            return std::nullopt;
+
+        switch (channels)
+        {
+        case TextureChannels::R:
+            return BlockFormat::BC4;
+        case TextureChannels::Rg:
+            return BlockFormat::BC5;
+        default:
+            return BlockFormat::BC7;
+        }
+    }
+
+    vk::Format CompressedFormat(BlockFormat block, vk::Format view_format)
+    {
+        switch (block)
+        {
+        case BlockFormat::BC4:
+            return vk::Format::eBc4UnormBlock;
+        case BlockFormat::BC5:
+            return vk::Format::eBc5UnormBlock;
+        default:
+            return EncodingOf(view_format) == TexelEncoding::Srgb
+                ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+        }
+    }
+
+    // Batch of entry i alone, to load it again later
+    TextureBatch Single(const TextureBatch& batch, std::size_t i)
+    {
+        TextureBatch result;
+        if (i < batch.files.size())
+            result.files.push_back(batch.files[i]);
+        else
+            result.orms.push_back(batch.orms[i - batch.files.size()]);
+        return result;
+    }
+
+    // Textures do not lose levels below this size
+    constexpr uint32_t minResidentExtent = 64;
+    // Restores allowed to load at once
+    constexpr std::size_t maxRestores = 4;
+}
+
+Texture::Ptr TextureManager::NewFromFile(const std::string &name,
+                                         const std::filesystem::path &filename,
+                                         vk::Format view_format,
+                                         const TextureLoadOptions& options)
+{
+    ZoneScoped;
+    Prepared prepared = PrepareFile(filename, view_format, options);
+    auto result = Upload({&prepared, 1}).front();
     m_textures[name] = result;
+
+    TextureBatch source;
+    source.Add(name, filename, view_format, options);
+    Track(name, std::move(source), *result);
+    return result;
+}
+
+Texture::Ptr TextureManager::NewOrmFromFiles(const std::string& name,
+                                             const OrmSources& sources,
+                                             const TextureLoadOptions& options)
+{
+    ZoneScoped;
+    Prepared prepared = PrepareOrm(name, sources, options);
+    auto result = Upload({&prepared, 1}).front();
+    m_textures[name] = result;
+
+    TextureBatch source;
+    source.AddOrm(name, sources, options);
+    Track(name, std::move(source), *result);
     return result;
 }
 
 Texture::Ptr TextureManager::NewFromPixels(const std::string& name,
                                            void* pixel_ptr,
                                            int texWidth, int texHeight,
-                                           vk::Format view_format)
+                                           vk::Format view_format,
+                                           const TextureLoadOptions& options)
 {
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    ZoneScoped;
+    // The pixels are uploaded from where they are, no copy is kept
+    const auto* pixels = static_cast<const uint8_t*>(pixel_ptr);
+    TextureCache::Level image {static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight),
+        {pixels, std::size_t(texWidth) * texHeight * ChannelCount(options.channels)}};
+
+    Prepared prepared = PreparePixels(image, view_format, options);
+    auto result = Upload({&prepared, 1}).front();
+    m_textures[name] = result;
+    return result;
+}
 
-    //the format R8G8B8A8 matches exactly with the pixels loaded from stb_image lib
-    VkFormat image_format = static_cast<VkFormat>(view_format);
+void TextureManager::Load(const TextureBatch& batch)
+{
+    ZoneScoped;
+    auto prepared = PrepareBatch(batch);
+    for (const auto& error : prepared.errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
 
-    //allocate temporary buffer for holding texture data to upload
-    AllocatedBuffer stagingBuffer =
-        m_engine.CreateBuffer(imageSize,
-                              vk::BufferUsageFlagBits::eTransferSrc,
-                              VMA_MEMORY_USAGE_CPU_ONLY);
+    auto textures = Upload(prepared.textures);
+    for (std::size_t i = 0; i < batch.Size(); i++)
+    {
+        m_textures[batch.Name(i)] = textures[i];
+        Track(batch.Name(i), Single(batch, i), *textures[i]);
+    }
+}
 
-    //copy data to buffer
-    void* data;
-    vmaMapMemory(m_engine.GetVmaAllocator(), stagingBuffer.allocation, &data);
-    memcpy(data, pixel_ptr, static_cast<size_t>(imageSize));
-    vmaUnmapMemory(m_engine.GetVmaAllocator(), stagingBuffer.allocation);
-    //we no longer need the loaded data, so we can free the pixels as they are now in the staging buffer
+void TextureManager::LoadAsync(TextureBatch batch)
+{
+    if (batch.Size() == 0)
+        return;
 
-    VkExtent3D imageExtent;
-    imageExtent.width = static_cast<uint32_t>(texWidth);
-    imageExtent.height = static_cast<uint32_t>(texHeight);
-    imageExtent.depth = 1;
+    PendingBatch& pending = Enqueue(std::move(batch));
+    for (std::size_t i = 0; i < pending.batch.Size(); i++)
+    {
+        auto handle = std::make_shared<Texture>();
+        m_textures[pending.batch.Name(i)] = handle;
+        pending.handles.push_back(handle);
+    }
+}
 
-    VkImageCreateInfo dimg_info {};
-    dimg_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    dimg_info.imageType = VK_IMAGE_TYPE_2D;
-    dimg_info.mipLevels = 1;
-    dimg_info.arrayLayers = 1;
-    dimg_info.samples = VK_SAMPLE_COUNT_1_BIT;
-    dimg_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+TextureManager::PendingBatch& TextureManager::Enqueue(TextureBatch batch)
+{
+    PendingBatch pending;
+    pending.batch = std::move(batch);
+    pending.prepared = ThreadPool::Global().Async([this, batch = pending.batch] {
+        return PrepareBatch(batch);
+    });
+    m_pending.push_back(std::move(pending));
+    return m_pending.back();
+}
+
+void TextureManager::Update()
+{
+    ZoneScoped;
+    auto& uploads = m_engine.GetUploads();
+    std::unordered_set<const Texture*> changed;
+    std::erase_if(m_pending, [&](PendingBatch& pending) {
+        if (pending.loaded.empty())
+        {
+            if (pending.prepared.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return false;
+
+            // Failed textures keep showing the defaults
+            auto prepared = pending.prepared.get();
+            std::vector<Prepared> succeeded;
+            std::vector<std::size_t> indices;
+            for (std::size_t i = 0; i < pending.handles.size(); i++)
+            {
+                if (!prepared.errors[i])
+                {
+                    succeeded.push_back(std::move(prepared.textures[i]));
+                    indices.push_back(i);
+                    continue;
+                }
+
+                try
+                {
+                    std::rethrow_exception(prepared.errors[i]);
+                }
+                catch (const std::exception& e)
+                {
+                    spdlog::error("Failed to load texture {}: {}", pending.batch.Name(i), e.what());
+                }
+            }
 
-    dimg_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-    dimg_info.extent = imageExtent;
-    dimg_info.format = image_format;
+            auto textures = Upload(succeeded);
+            pending.loaded.resize(pending.handles.size());
+            for (std::size_t i = 0; i < textures.size(); i++)
+                pending.loaded[indices[i]] = textures[i];
+            pending.upload = uploads.Submit();
+        }
 
-    AllocatedImage newImage;
+        if (!uploads.IsComplete(pending.upload))
+            return false;
 
-    VmaAllocationCreateInfo dimg_allocinfo = {};
-    dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        for (std::size_t i = 0; i < pending.handles.size(); i++)
+        {
+            const auto& name = pending.batch.Name(i);
+            if (pending.restore)
+            {
+                if (auto it = m_residency.find(name); it != m_residency.end())
+                    it->second.restoring = false;
+            }
 
-    //allocate and create the image
-    vmaCreateImage(m_engine.GetVmaAllocator(), &dimg_info, &dimg_allocinfo,
-                   &newImage.image, &newImage.allocation, nullptr);
-    newImage.allocator = m_engine.GetVmaAllocator();
-    newImage.device = m_engine.GetDevice();
+            if (!pending.loaded[i])
+                continue;
+
+            if (!pending.restore)
+                Track(name, Single(pending.batch, i), *pending.loaded[i]);
+            Replace(*pending.handles[i], std::move(*pending.loaded[i]));
+            changed.insert(pending.handles[i].get());
+        }
+        return true;
+    });
+
+    UpdateResidency(changed);
+    RewriteSets(changed);
+}
+
+void TextureManager::Track(const std::string& name, TextureBatch source, const Texture& texture)
+{
+    m_residency[name] = {std::move(source), texture.mipLevels};
+}
+
+vk::DeviceSize TextureManager::GetBudget() const
+{
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetBudget(m_engine.GetVmaAllocator(), budgets);
+
+    // Everything else in the heap stays where it is, textures get the rest
+    const auto& heap = budgets[m_textureHeap];
+    vk::DeviceSize other = heap.usage > m_residentBytes ? heap.usage - m_residentBytes : 0;
+    vk::DeviceSize available = heap.budget > other ? heap.budget - other : 0;
+    return m_budget > 0 ? std::min(m_budget, available) : available;
+}
+
+void TextureManager::UpdateResidency(std::unordered_set<const Texture*>& changed)
+{
+    ZoneScoped;
+    struct Candidate
+    {
+        Texture* texture;
+        Residency* residency;
+        const std::string* name;
+    };
+
+    std::vector<Candidate> candidates;
+    m_residentBytes = 0;
+    for (auto& [name, texture] : m_textures)
+    {
+        m_residentBytes += texture->memorySize;
+        auto it = m_residency.find(name);
+        if (it != m_residency.end() && texture->image.image != VK_NULL_HANDLE)
+            candidates.push_back({texture.get(), &it->second, &name});
+    }
+    std::ranges::sort(candidates, {}, [](const Candidate& candidate) {
+        return candidate.texture->lastUsed;
+    });
+
+    // Least recently drawn textures lose levels first, each level is about
+    // a quarter of the one above it
+    vk::DeviceSize budget = GetBudget();
+    std::vector<Texture*> downgraded;
+    for (auto& candidate : candidates)
+    {
+        if (m_residentBytes <= budget)
+            break;
+
+        auto& texture = *candidate.texture;
+        if (candidate.residency->restoring)
+            continue;
+
+        uint32_t dropped = 0;
+        vk::DeviceSize size = texture.memorySize;
+        while (dropped + 1 < texture.mipLevels &&
+               std::max(texture.extent.width, texture.extent.height) >> (dropped + 1) >= minResidentExtent &&
+               m_residentBytes - texture.memorySize + size > budget)
+        {
+            dropped++;
+            size /= 4;
+        }
+        if (dropped == 0)
+            continue;
+
+        m_residentBytes -= texture.memorySize;
+        Replace(texture, Downgrade(texture, dropped));
+        m_residentBytes += texture.memorySize;
+        downgraded.push_back(&texture);
+        changed.insert(&texture);
+    }
+
+    if (!downgraded.empty())
+    {
+        UploadTicket ticket = m_engine.GetUploads().Submit();
+        for (auto* texture : downgraded)
+            texture->upload = ticket;
+    }
+
+    // Textures drawn last frame get their levels back when they fit with
+    // some headroom, so they are not dropped again right away
+    uint64_t frame = m_engine.GetFrameNumber();
+    std::size_t restoring = std::ranges::count_if(m_residency, [](const auto& entry) {
+        return entry.second.restoring;
+    });
+    vk::DeviceSize expected = m_residentBytes;
+    for (auto& candidate : candidates | std::views::reverse)
+    {
+        if (restoring >= maxRestores)
+            break;
+
+        auto& texture = *candidate.texture;
+        auto& residency = *candidate.residency;
+        if (residency.restoring || texture.mipLevels >= residency.fullLevels ||
+            texture.lastUsed + 1 < frame)
+            continue;
+
+        vk::DeviceSize fullSize = texture.memorySize << (2 * (residency.fullLevels - texture.mipLevels));
+        if (expected - texture.memorySize + fullSize > budget / 10 * 9)
+            continue;
+        expected += fullSize - texture.memorySize;
+
+        TextureBatch batch = residency.source;
+        for (auto& file : batch.files)
+            file.options.residentMips = residency.fullLevels;
+        for (auto& orm : batch.orms)
+            orm.options.residentMips = residency.fullLevels;
+
+        PendingBatch& pending = Enqueue(std::move(batch));
+        pending.handles.push_back(m_textures.at(*candidate.name));
+        pending.restore = true;
+        residency.restoring = true;
+        restoring++;
+    }
+}
+
+Texture TextureManager::Downgrade(const Texture& texture, uint32_t dropped)
+{
+    ZoneScoped;
+    Texture result;
+    result.format = texture.format;
+    result.extent = vk::Extent2D{std::max(texture.extent.width >> dropped, 1u),
+                                 std::max(texture.extent.height >> dropped, 1u)};
+    result.mipLevels = texture.mipLevels - dropped;
+    result.lastUsed = texture.lastUsed;
+    CreateImage(result);
+
+    // Frames recorded so far may still sample the old image, the copy
+    // waits for them
+    vk::ImageMemoryBarrier toSource;
+    toSource.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toSource.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toSource.image = texture.image.image;
+    toSource.subresourceRange = {vk::ImageAspectFlagBits::eColor, dropped, result.mipLevels, 0, 1};
+    toSource.oldLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    toSource.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+    toSource.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toSource.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+
+    vk::ImageMemoryBarrier toDestination;
+    toDestination.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toDestination.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toDestination.image = result.image.image;
+    toDestination.subresourceRange = {vk::ImageAspectFlagBits::eColor, 0, result.mipLevels, 0, 1};
+    toDestination.oldLayout = vk::ImageLayout::eUndefined;
+    toDestination.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    toDestination.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+
+    std::vector<vk::ImageCopy> regions;
+    for (uint32_t i = 0; i < result.mipLevels; i++)
+    {
+        vk::ImageCopy region;
+        region.srcSubresource = {vk::ImageAspectFlagBits::eColor, dropped + i, 0, 1};
+        region.dstSubresource = {vk::ImageAspectFlagBits::eColor, i, 0, 1};
+        region.extent = vk::Extent3D{std::max(result.extent.width >> i, 1u),
+                                     std::max(result.extent.height >> i, 1u), 1};
+        regions.push_back(region);
+    }
+
+    vk::ImageMemoryBarrier toReadable = toDestination;
+    toReadable.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    toReadable.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    toReadable.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    toReadable.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+    vk::CommandBuffer cmd = m_engine.GetUploads().AfterTransfer();
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eTransfer,
+                        vk::PipelineStageFlagBits::eTransfer, {}, nullptr, nullptr,
+                        {toSource, toDestination});
+    cmd.copyImage(texture.image.image, vk::ImageLayout::eTransferSrcOptimal,
+                  result.image.image, vk::ImageLayout::eTransferDstOptimal, regions);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader,
+                        {}, nullptr, nullptr, toReadable);
+
+    CreateView(result);
+    return result;
+}
+
+void TextureManager::Replace(Texture& texture, Texture&& replacement)
+{
+    replacement.lastUsed = std::max(texture.lastUsed, replacement.lastUsed);
+    auto old = std::make_shared<Texture>(std::move(texture));
+    texture = std::move(replacement);
+    m_engine.Defer([old] {});
+}
+
+void TextureManager::RewriteSets(const std::unordered_set<const Texture*>& changed)
+{
+    if (changed.empty())
+        return;
+
+    // Sets in use by frames in flight can not be updated, they get new
+    // descriptors and the old ones are freed later
+    vk::Device device = m_engine.GetDevice();
+    vk::DescriptorPool pool = m_engine.GetGlobalDescriptorPool();
+    std::erase_if(m_sets, [&](const std::weak_ptr<TextureSet>& weak) {
+        auto set = weak.lock();
+        if (!set)
+            return true;
+
+        bool uses = std::ranges::any_of(
+            std::array {&set->albedo, &set->normal, &set->specular, &set->roughness, &set->ao, &set->orm},
+            [&](const Texture::Ptr* texture) { return *texture && changed.contains(texture->get()); });
+        if (!uses)
+            return false;
+
+        vk::DescriptorSet old = set->descriptor;
+        WriteTextureSet(*set);
+        m_engine.Defer([device, pool, old] { device.freeDescriptorSets(pool, old); });
+        return false;
+    });
+}
+
+TextureManager::~TextureManager()
+{
+    // Batches still being prepared use the manager
+    for (auto& pending : m_pending)
+    {
+        if (pending.prepared.valid())
+            pending.prepared.wait();
+    }
+}
+
+TextureManager::PreparedBatch TextureManager::PrepareBatch(const TextureBatch& batch) const
+{
+    ZoneScoped;
+    std::size_t count = batch.Size();
+    PreparedBatch result;
+    result.textures.resize(count);
+    result.errors.resize(count);
+
+    // Decoding, mip generation and baking run on the pool, failures are
+    // kept per texture
+    auto& pool = ThreadPool::Global();
+    pool.ParallelFor(count, 1, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++)
+        {
+            try
+            {
+                if (i < batch.files.size())
+                {
+                    const auto& file = batch.files[i];
+                    result.textures[i] = PrepareFile(file.filename, file.view_format, file.options);
+                }
+                else
+                {
+                    const auto& orm = batch.orms[i - batch.files.size()];
+                    result.textures[i] = PrepareOrm(orm.name, orm.sources, orm.options);
+                }
+            }
+            catch (...)
+            {
+                result.errors[i] = std::current_exception();
+            }
+        }
+    });
+
+    return result;
+}
+
+TextureManager::Prepared TextureManager::PrepareFile(const std::filesystem::path& filename,
+                                                     vk::Format view_format,
+                                                     const TextureLoadOptions& options) const
+{
+    ZoneScoped;
+    MappedFile source(filename);
+    if (!source)
+    {
+        spdlog::error("Failed to load texture file {}", filename.c_str());
+        throw std::runtime_error("");
+    }
+
+    // Two channel stb output is grey and alpha, so the channels are picked
+    // out of RGBA instead
+    auto decode = [&] {
+        int texWidth, texHeight, texChannels;
+        stbi_uc* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(source.data()),
+                                                source.size(), &texWidth, &texHeight,
+                                                &texChannels, STBI_rgb_alpha);
+        if (!pixels) {
+            spdlog::error("Failed to load texture file {}", filename.c_str());
+            throw std::runtime_error("");
+        }
+
+        MipGenerator::Level image {static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), {}};
+        image.texels.assign(pixels, pixels + std::size_t(texWidth) * texHeight * 4);
+        stbi_image_free(pixels);
+        return image;
+    };
+
+    if (options.compress && CompressedFormatFor(view_format, options))
+    {
+        uint64_t sourceHash = Files::Hash(source.data(), source.size());
+        return PrepareCompressed(filename, sourceHash, view_format, options, decode);
+    }
 
-    m_engine.ImmediateSubmit([&](VkCommandBuffer cmd) {
-        VkImageSubresourceRange range;
-        range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    MipGenerator::Level image = decode();
+    uint32_t channels = ChannelCount(options.channels);
+    if (channels < 4)
+    {
+        PackChannels(image.texels.data(), std::size_t(image.width) * image.height, channels);
+        image.texels.resize(std::size_t(image.width) * image.height * channels);
+    }
+
+    return PreparePixels(std::move(image), view_format, options);
+}
+
+TextureManager::Prepared TextureManager::PrepareOrm(const std::string& name,
+                                                    const OrmSources& sources,
+                                                    const TextureLoadOptions& options) const
+{
+    ZoneScoped;
+    // No occlusion, medium roughness and a dielectric reflectance of 0.04
+    constexpr std::array<uint8_t, 3> defaults {255, 128, 10};
+
+    std::array<const std::filesystem::path*, 3> paths {
+        &sources.occlusion, &sources.roughness, &sources.specular};
+    std::array<MappedFile, 3> files;
+    const std::filesystem::path* first = nullptr;
+    uint64_t sourceHash = Files::Hash(&sources.gloss, sizeof(sources.gloss));
+    for (std::size_t i = 0; i < paths.size(); i++)
+    {
+        if (paths[i]->empty())
+            continue;
+
+        files[i] = MappedFile(*paths[i]);
+        if (!files[i])
+        {
+            spdlog::error("Failed to load texture file {}", paths[i]->c_str());
+            throw std::runtime_error("");
+        }
+        sourceHash = Files::Hash(&i, sizeof(i), sourceHash);
+        sourceHash = Files::Hash(files[i].data(), files[i].size(), sourceHash);
+        if (!first)
+            first = paths[i];
+    }
+
+    if (!first)
+    {
+        spdlog::error("No sources to pack into {}", name);
+        throw std::runtime_error("");
+    }
+
+    auto pack = [&] {
+        MipGenerator::Level image {};
+        const auto& srgb = SrgbToLinear();
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            if (!files[i])
+                continue;
+
+            int texWidth, texHeight, texChannels;
+            stbi_uc* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(files[i].data()),
+                                                    files[i].size(), &texWidth, &texHeight,
+                                                    &texChannels, STBI_rgb_alpha);
+            if (!pixels) {
+                spdlog::error("Failed to load texture file {}", paths[i]->c_str());
+                throw std::runtime_error("");
+            }
+
+            if (image.texels.empty())
+            {
+                image.width = texWidth;
+                image.height = texHeight;
+                image.texels.resize(std::size_t(texWidth) * texHeight * 4);
+                for (std::size_t t = 0; t < std::size_t(texWidth) * texHeight; t++)
+                {
+                    std::copy(defaults.begin(), defaults.end(), &image.texels[t * 4]);
+                    image.texels[t * 4 + 3] = 255;
+                }
+            }
+            else if (image.width != static_cast<uint32_t>(texWidth)
+                     || image.height != static_cast<uint32_t>(texHeight))
+            {
+                stbi_image_free(pixels);
+                spdlog::error("Packed texture {} sources differ in size", name);
+                throw std::runtime_error("");
+            }
+
+            for (std::size_t t = 0; t < std::size_t(texWidth) * texHeight; t++)
+            {
+                uint8_t value = pixels[t * 4];
+                if (i == 1 && sources.gloss)
+                    value = 255 - value;
+                // Specular maps are sRGB, the packed map is linear
+                if (i == 2)
+                {
+                    float linear = (srgb[pixels[t * 4]] + srgb[pixels[t * 4 + 1]]
+                                    + srgb[pixels[t * 4 + 2]]) / 3.0f;
+                    value = static_cast<uint8_t>(std::lround(linear * 255.0f));
+                }
+                image.texels[t * 4 + i] = value;
+            }
+            stbi_image_free(pixels);
+        }
+        return image;
+    };
+
+    constexpr vk::Format view_format = vk::Format::eR8G8B8A8Unorm;
+    TextureLoadOptions packedOptions = options;
+    packedOptions.channels = TextureChannels::Rgba;
+
+    if (options.compress && CompressedFormatFor(view_format, packedOptions))
+    {
+        return PrepareCompressed(first->parent_path() / name, sourceHash,
+                                 view_format, packedOptions, pack);
+    }
+
+    return PreparePixels(pack(), view_format, packedOptions);
+}
+
+std::optional<vk::Format> TextureManager::CompressedFormatFor(vk::Format view_format,
+                                                              const TextureLoadOptions& options) const
+{
+    auto blockFormat = BlockFormatOf(view_format, options.channels);
+    if (!blockFormat)
+        return std::nullopt;
+
+    vk::Format format = CompressedFormat(*blockFormat, view_format);
+    auto properties = m_engine.GetPhysicalDevice().getFormatProperties(format);
+    if (!(properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage))
+    {
+        spdlog::warn("Block compressed format {} is not supported, loading uncompressed",
+                     vk::to_string(format));
+        return std::nullopt;
+    }
+    return format;
+}
+
+TextureManager::Prepared TextureManager::PrepareCompressed(const std::filesystem::path& cacheSource,
+                                                           uint64_t sourceHash,
+                                                           vk::Format view_format,
+                                                           const TextureLoadOptions& options,
+                                                           const std::function<MipGenerator::Level()>& decode) const
+{
+    ZoneScoped;
+    BlockFormat blockFormat = *BlockFormatOf(view_format, options.channels);
+
+    Prepared result;
+    result.format = CompressedFormat(blockFormat, view_format);
+
+    // Resident levels are picked at upload, the cache keeps the full chain
+    sourceHash = Files::Hash(&result.format, sizeof(result.format), sourceHash);
+    sourceHash = Files::Hash(&options.mipmaps, sizeof(options.mipmaps), sourceHash);
+    std::filesystem::path cachePath = m_cache.PathFor(cacheSource, sourceHash);
+
+    auto keepResident = [&] {
+        if (options.residentMips > 0 && options.residentMips < result.levels.size())
+            result.levels.erase(result.levels.begin(), result.levels.end() - options.residentMips);
+        result.levelCount = result.levels.size();
+        return std::move(result);
+    };
+
+    auto levelSize = [blockFormat](uint32_t width, uint32_t height) {
+        return TextureCompressor::EncodedSize(width, height, blockFormat);
+    };
+    if (auto entry = m_cache.Load(cachePath, sourceHash, result.format, levelSize))
+    {
+        result.levels = entry->levels;
+        result.cached = std::move(entry->file);
+        return keepResident();
+    }
+
+    constexpr uint32_t channels = 4;
+    MipGenerator::Level level = decode();
+    uint32_t levelCount = options.mipmaps ? MipGenerator::LevelCount(level.width, level.height) : 1;
+
+    for (uint32_t i = 0; i < levelCount; i++)
+    {
+        if (i > 0)
+        {
+            level = MipGenerator::Downsample(level.texels, level.width, level.height,
+                                             channels, EncodingOf(view_format));
+        }
+
+        result.storage.push_back(TextureCompressor::Encode(level.texels, level.width, level.height,
+                                                           channels, blockFormat));
+        result.levels.push_back({level.width, level.height, result.storage.back()});
+    }
+
+    m_cache.Store(cachePath, sourceHash, result.format, result.levels);
+    return keepResident();
+}
+
+TextureManager::Prepared TextureManager::PreparePixels(MipGenerator::Level image,
+                                                       vk::Format view_format,
+                                                       const TextureLoadOptions& options) const
+{
+    // Moving the texels keeps the levels referencing them valid
+    TextureCache::Level view {image.width, image.height, image.texels};
+    Prepared result = PreparePixels(view, view_format, options);
+    result.storage.push_back(std::move(image.texels));
+    return result;
+}
+
+TextureManager::Prepared TextureManager::PreparePixels(const TextureCache::Level& image,
+                                                       vk::Format view_format,
+                                                       const TextureLoadOptions& options) const
+{
+    ZoneScoped;
+    view_format = ChannelFormat(view_format, options.channels);
+    uint32_t channels = ChannelCount(options.channels);
+    TexelEncoding encoding = EncodingOf(view_format);
+
+    uint32_t fullLevels = options.mipmaps
+        ? MipGenerator::LevelCount(image.width, image.height) : 1;
+    uint32_t levelCount = options.residentMips > 0
+        ? std::min(options.residentMips, fullLevels) : fullLevels;
+
+    // Levels that are not kept are only filtered on the CPU down to the
+    // first resident one
+    TextureCache::Level first = image;
+    MipGenerator::Level dropped;
+    for (uint32_t i = levelCount; i < fullLevels; i++)
+    {
+        dropped = MipGenerator::Downsample(first.data, first.width, first.height, channels, encoding);
+        first = {dropped.width, dropped.height, dropped.texels};
+    }
+
+    vk::FormatFeatureFlags blitFeatures = vk::FormatFeatureFlagBits::eBlitSrc
+        | vk::FormatFeatureFlagBits::eBlitDst
+        | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+    auto formatProperties = m_engine.GetPhysicalDevice().getFormatProperties(view_format);
+    bool blit = levelCount > 1
+        && (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+
+    Prepared result;
+    result.format = view_format;
+    result.levelCount = levelCount;
+    if (!dropped.texels.empty())
+        result.storage.push_back(std::move(dropped.texels));
+    result.levels.push_back(first);
+
+    // Without blits every level is uploaded
+    if (!blit)
+    {
+        for (uint32_t i = 1; i < levelCount; i++)
+        {
+            const auto& previous = result.levels.back();
+            auto level = MipGenerator::Downsample(
+                previous.data, previous.width, previous.height, channels, encoding);
+            result.storage.push_back(std::move(level.texels));
+            result.levels.push_back({level.width, level.height, result.storage.back()});
+        }
+    }
+
+    return result;
+}
+
+std::vector<Texture::Ptr> TextureManager::Upload(std::span<Prepared> textures)
+{
+    ZoneScoped;
+    if (textures.empty())
+        return {};
+
+    // Level offsets are kept 16 byte aligned, enough for block compressed
+    // as well as R8 and R8G8 copies
+    auto alignOffset = [](vk::DeviceSize offset) { return (offset + 15) & ~vk::DeviceSize(15); };
+
+    std::vector<std::vector<vk::BufferImageCopy>> copyRegions(textures.size());
+    std::vector<vk::DeviceSize> stagingSizes(textures.size(), 0);
+    for (std::size_t t = 0; t < textures.size(); t++)
+    {
+        const auto& levels = textures[t].levels;
+        for (uint32_t i = 0; i < levels.size(); i++)
+        {
+            stagingSizes[t] = alignOffset(stagingSizes[t]);
+
+            vk::BufferImageCopy copyRegion;
+            copyRegion.bufferOffset = stagingSizes[t];
+            copyRegion.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+            copyRegion.imageSubresource.mipLevel = i;
+            copyRegion.imageSubresource.baseArrayLayer = 0;
+            copyRegion.imageSubresource.layerCount = 1;
+            copyRegion.imageExtent = vk::Extent3D{levels[i].width, levels[i].height, 1};
+            copyRegions[t].push_back(copyRegion);
+
+            stagingSizes[t] += levels[i].data.size();
+        }
+    }
+
+    std::vector<Texture::Ptr> results;
+    results.reserve(textures.size());
+    for (const auto& texture : textures)
+    {
+        Texture::Ptr result = std::make_shared<Texture>();
+        result->format = texture.format;
+        result->extent = vk::Extent2D{texture.levels.front().width, texture.levels.front().height};
+        result->mipLevels = texture.levelCount;
+        result->lastUsed = m_engine.GetFrameNumber();
+        CreateImage(*result);
+        results.push_back(result);
+    }
+
+    // Copies go to the transfer queue, images that still need their
+    // smaller levels blitted stay writable until they reach graphics
+    auto& uploads = m_engine.GetUploads();
+    std::vector<StagingAllocation> staging(textures.size());
+    bool anyBlit = false;
+    for (std::size_t t = 0; t < textures.size(); t++)
+    {
+        const auto& texture = textures[t];
+        bool blit = texture.levelCount > texture.levels.size();
+        anyBlit |= blit;
+
+        vk::ImageSubresourceRange range;
+        range.aspectMask = vk::ImageAspectFlagBits::eColor;
         range.baseMipLevel = 0;
-        range.levelCount = 1;
+        range.levelCount = texture.levelCount;
         range.baseArrayLayer = 0;
         range.layerCount = 1;
 
-        VkImageMemoryBarrier imageBarrier_toTransfer = {};
-        imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        staging[t] = uploads.Stage(stagingSizes[t]);
+        uploads.CopyToImage(staging[t], results[t]->image.image, range, copyRegions[t],
+                            blit ? vk::ImageLayout::eTransferDstOptimal
+                                 : vk::ImageLayout::eShaderReadOnlyOptimal);
+    }
 
-        imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        imageBarrier_toTransfer.image = newImage.image;
-        imageBarrier_toTransfer.subresourceRange = range;
+    //copy data to the staging memory
+    auto& pool = ThreadPool::Global();
+    pool.ParallelFor(textures.size(), 1, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t t = begin; t < end; t++)
+        {
+            const auto& levels = textures[t].levels;
+            for (std::size_t i = 0; i < levels.size(); i++)
+            {
+                memcpy(staging[t].data.data() + copyRegions[t][i].bufferOffset,
+                       levels[i].data.data(), levels[i].data.size());
+            }
+        }
+    });
 
-        imageBarrier_toTransfer.srcAccessMask = 0;
-        imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    if (anyBlit)
+    {
+        VkCommandBuffer cmd = uploads.AfterTransfer();
+        std::vector<VkImageMemoryBarrier> toReadable;
+        for (std::size_t t = 0; t < textures.size(); t++)
+        {
+            const auto& texture = textures[t];
+            if (texture.levelCount <= texture.levels.size())
+                continue;
+
+            // Each level is blitted from the previous one, which is then
+            // done and moved to the shader readable layout
+            VkImageMemoryBarrier toSource = {};
+            toSource.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            toSource.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            toSource.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            toSource.image = results[t]->image.image;
+            toSource.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+            toSource.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            toSource.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            toSource.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            toSource.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+            VkImageMemoryBarrier sourceToReadable = toSource;
+            sourceToReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            sourceToReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            sourceToReadable.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            sourceToReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+            int32_t width = texture.levels.back().width;
+            int32_t height = texture.levels.back().height;
+            for (uint32_t i = texture.levels.size(); i < texture.levelCount; i++)
+            {
+                toSource.subresourceRange.baseMipLevel = i - 1;
+                vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toSource);
+
+                int32_t nextWidth = std::max(width / 2, 1);
+                int32_t nextHeight = std::max(height / 2, 1);
+
+                VkImageBlit region = {};
+                region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, i - 1, 0, 1};
+                region.srcOffsets[1] = {width, height, 1};
+                region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1};
+                region.dstOffsets[1] = {nextWidth, nextHeight, 1};
+                vkCmdBlitImage(cmd, results[t]->image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               results[t]->image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               1, &region, VK_FILTER_LINEAR);
+
+                sourceToReadable.subresourceRange.baseMipLevel = i - 1;
+                vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &sourceToReadable);
+
+                width = nextWidth;
+                height = nextHeight;
+            }
 
-        //barrier the image into the transfer-receive layout
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toTransfer);
+            VkImageMemoryBarrier lastToReadable = toSource;
+            lastToReadable.subresourceRange.baseMipLevel = texture.levelCount - 1;
+            lastToReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            lastToReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            toReadable.push_back(lastToReadable);
+        }
 
-        VkBufferImageCopy copyRegion = {};
-        copyRegion.bufferOffset = 0;
-        copyRegion.bufferRowLength = 0;
-        copyRegion.bufferImageHeight = 0;
+        //barrier the last levels into the shader readable layout
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+                             toReadable.size(), toReadable.data());
+    }
 
-        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        copyRegion.imageSubresource.mipLevel = 0;
-        copyRegion.imageSubresource.baseArrayLayer = 0;
-        copyRegion.imageSubresource.layerCount = 1;
-        copyRegion.imageExtent = imageExtent;
+    // Every copy and transition of the batch goes into one submission
+    UploadTicket ticket = uploads.Submit();
 
-        //copy the buffer into the image
-        vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+    for (auto& result : results)
+    {
+        result->upload = ticket;
+        CreateView(*result);
+    }
 
-        VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
+    return results;
+}
 
-        imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        imageBarrier_toReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+void TextureManager::CreateImage(Texture& texture)
+{
+    VkImageCreateInfo dimg_info {};
+    dimg_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    dimg_info.imageType = VK_IMAGE_TYPE_2D;
+    dimg_info.mipLevels = texture.mipLevels;
+    dimg_info.arrayLayers = 1;
+    dimg_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    dimg_info.tiling = VK_IMAGE_TILING_OPTIMAL;
 
-        imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    // Levels are blitted from their predecessor and copied out when the
+    // texture is downgraded
+    dimg_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    dimg_info.extent = {texture.extent.width, texture.extent.height, 1};
+    dimg_info.format = static_cast<VkFormat>(texture.format);
 
-        //barrier the image into the shader readable layout
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toReadable);
-    });
+    VmaAllocationCreateInfo dimg_allocinfo = {};
+    dimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
-    Texture::Ptr result = std::make_shared<Texture>();
-    result->image = std::move(newImage);
+    //allocate and create the image
+    VmaAllocationInfo allocationInfo;
+    vmaCreateImage(m_engine.GetVmaAllocator(), &dimg_info, &dimg_allocinfo,
+                   &texture.image.image, &texture.image.allocation, &allocationInfo);
+    texture.image.allocator = m_engine.GetVmaAllocator();
+    texture.image.device = m_engine.GetDevice();
+    texture.memorySize = allocationInfo.size;
+
+    const VkPhysicalDeviceMemoryProperties* memoryProperties;
+    vmaGetMemoryProperties(m_engine.GetVmaAllocator(), &memoryProperties);
+    m_textureHeap = memoryProperties->memoryTypes[allocationInfo.memoryType].heapIndex;
+}
 
+void TextureManager::CreateView(Texture& texture) const
+{
     vk::ImageViewCreateInfo imageViewInfo;
     imageViewInfo.viewType = vk::ImageViewType::e2D;
-    imageViewInfo.image = result->image.image;
-    imageViewInfo.format = view_format;
+    imageViewInfo.image = texture.image.image;
+    imageViewInfo.format = texture.format;
     imageViewInfo.subresourceRange.baseMipLevel = 0;
-    imageViewInfo.subresourceRange.levelCount = 1;
+    imageViewInfo.subresourceRange.levelCount = texture.mipLevels;
     imageViewInfo.subresourceRange.baseArrayLayer = 0;
     imageViewInfo.subresourceRange.layerCount = 1;
     imageViewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
 
-    result->imageView = m_engine.GetDevice().createImageViewUnique(imageViewInfo);
+    texture.imageView = m_engine.GetDevice().createImageViewUnique(imageViewInfo);
 
     //create a sampler for the texture
     vk::SamplerCreateInfo samplerInfo;
     samplerInfo.magFilter = vk::Filter::eLinear;
     samplerInfo.minFilter = vk::Filter::eLinear;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
     samplerInfo.addressModeU = vk::SamplerAddressMode::eRepeat;
     samplerInfo.addressModeV = vk::SamplerAddressMode::eRepeat;
     samplerInfo.addressModeW = vk::SamplerAddressMode::eRepeat;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = static_cast<float>(texture.mipLevels);
 
-    result->sampler =
-        m_engine.GetDevice().createSamplerUnique(samplerInfo);
-
-    m_textures[name] = result;
-    return result;
+    texture.sampler = m_engine.GetDevice().createSamplerUnique(samplerInfo);
 }
 
 TextureSet::Ptr TextureManager::NewTextureSet(
@@ -210,283 +1196,468 @@ TextureSet::Ptr TextureManager::NewTextureSet(
     result->roughness = roughness;
     result->ao = ao;
 
+    WriteTextureSet(*result);
+    m_sets.push_back(result);
+    return result;
+}
+
+TextureSet::Ptr TextureManager::NewPackedTextureSet(
+    Texture::Ptr albedo,
+    Texture::Ptr normal,
+    Texture::Ptr orm)
+{
+    auto result = std::make_shared<TextureSet>();
+    result->albedo = albedo;
+    result->normal = normal;
+    result->orm = orm;
+    result->packed = true;
+
+    WriteTextureSet(*result);
+    m_sets.push_back(result);
+    return result;
+}
+
+void TextureManager::WriteTextureSet(TextureSet& set)
+{
     //allocate the descriptor set for single-texture to use on the material
     vk::DescriptorSetAllocateInfo allocInfo;
     allocInfo.descriptorPool = m_engine.GetGlobalDescriptorPool();
     allocInfo.descriptorSetCount = 1;
-    auto layout = m_engine.GetTextureSetLayout();
+    auto layout = set.packed
+        ? m_engine.GetPackedTextureSetLayout() : m_engine.GetTextureSetLayout();
     allocInfo.setSetLayouts(layout);
 
-    result->descriptor = m_engine.GetDevice().allocateDescriptorSets(allocInfo)[0];
+    set.descriptor = m_engine.GetDevice().allocateDescriptorSets(allocInfo)[0];
+
+    // Missing textures and ones still loading show the defaults
+    auto imageInfo = [](const Texture::Ptr& texture, const Texture::Ptr& fallback) {
+        const auto& used = texture && texture->imageView ? texture : fallback;
+        return vk::DescriptorImageInfo(*used->sampler, *used->imageView,
+                                       vk::ImageLayout::eShaderReadOnlyOptimal);
+    };
+
+    auto albedoInfo = imageInfo(set.albedo, m_default_albedo);
+    auto normalInfo = imageInfo(set.normal, m_default_normal);
+    if (set.packed)
+    {
+        auto ormInfo = imageInfo(set.orm, m_default_orm);
+
+        auto writes = {
+            init::ImageWriteDescriptorSet(0, set.descriptor, albedoInfo),
+            init::ImageWriteDescriptorSet(1, set.descriptor, normalInfo),
+            init::ImageWriteDescriptorSet(2, set.descriptor, ormInfo)
+        };
+        m_engine.GetDevice().updateDescriptorSets(writes, nullptr);
+    }
+    else
+    {
+        auto specularInfo = imageInfo(set.specular, m_default_specular);
+        auto roughnessInfo = imageInfo(set.roughness, m_default_roughness);
+        auto aoInfo = imageInfo(set.ao, m_default_ao);
+
+        auto writes = {
+            init::ImageWriteDescriptorSet(0, set.descriptor, albedoInfo),
+            init::ImageWriteDescriptorSet(1, set.descriptor, normalInfo),
+            init::ImageWriteDescriptorSet(2, set.descriptor, specularInfo),
+            init::ImageWriteDescriptorSet(3, set.descriptor, roughnessInfo),
+            init::ImageWriteDescriptorSet(4, set.descriptor, aoInfo)
+        };
+        m_engine.GetDevice().updateDescriptorSets(writes, nullptr);
+    }
+}
+
+uint64_t MeshImportOptions::Hash() const
+{
+    uint64_t seed = Files::Hash(&weldEpsilon, sizeof(weldEpsilon));
+    seed = Files::Hash(&optimize, sizeof(optimize), seed);
+    seed = Files::Hash(&split16, sizeof(split16), seed);
+    seed = Files::Hash(&lodCount, sizeof(lodCount), seed);
+    seed = Files::Hash(&lodReduction, sizeof(lodReduction), seed);
+    return Files::Hash(&meshlets, sizeof(meshlets), seed);
+}
+
+Mesh::Ptr MeshManager::NewFromObj(const std::string &name, const std::filesystem::path &filename,
+                                  const MeshImportOptions& options)
+{
+    ZoneScoped;
+    Mesh::Ptr result = ImportObj(name, filename, options);
+    Upload(*result, options);
+    m_meshes[name] = result;
+    return result;
+}
+
+Mesh::Ptr MeshManager::NewFromVertices(const std::string& name,
+                                       std::vector<Vertex> vertices,
+                                       std::vector<uint32_t> indices,
+                                       const MeshImportOptions& options)
+{
+    ZoneScoped;
+    Mesh::Ptr result = Process(std::move(vertices), std::move(indices), options);
+    Upload(*result, options);
+    m_meshes[name] = result;
+    return result;
+}
+
+Mesh::Ptr MeshManager::LoadObjAsync(const std::string& name, const std::filesystem::path& filename,
+                                    const MeshImportOptions& options)
+{
+    Mesh::Ptr handle = std::make_shared<Mesh>();
+    auto imported = ThreadPool::Global().Async([this, name, filename, options] {
+        return ImportObj(name, filename, options);
+    });
+    m_pending.push_back({handle, name, options, std::move(imported)});
+
+    m_meshes[name] = handle;
+    return handle;
+}
+
+MeshManager::~MeshManager()
+{
+    // Imports still running use the manager
+    for (auto& pending : m_pending)
+    {
+        if (pending.imported.valid())
+            pending.imported.wait();
+    }
+}
+
+void MeshManager::Update()
+{
+    ZoneScoped;
+    auto& uploads = m_engine.GetUploads();
+    std::erase_if(m_pending, [&](Pending& pending) {
+        if (!pending.loaded)
+        {
+            if (pending.imported.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return false;
+
+            try
+            {
+                pending.loaded = pending.imported.get();
+            }
+            catch (const std::exception& e)
+            {
+                spdlog::error("Failed to load mesh {}: {}", pending.name, e.what());
+                return true;
+            }
+            Upload(*pending.loaded, pending.options);
+            pending.upload = uploads.Submit();
+        }
+
+        if (!uploads.IsComplete(pending.upload))
+            return false;
+
+        // Nothing is drawn from the empty handle, so it can be filled in
+        // place between frames
+        *pending.handle = std::move(*pending.loaded);
+        return true;
+    });
+}
+
+Mesh::Ptr MeshManager::ImportObj(const std::string& name, const std::filesystem::path& filename,
+                                 const MeshImportOptions& options) const
+{
+    ZoneScoped;
+    MappedFile source(filename);
+    if (!source)
+    {
+        spdlog::error("Could not open mesh file {}", filename.string());
+        throw std::runtime_error("Could not load mesh");
+    }
+
+    uint64_t sourceHash = Files::Hash(source.data(), source.size(), options.Hash());
+    std::filesystem::path cachePath = m_cache.PathFor(filename, sourceHash);
+
+    if (auto entry = m_cache.Load(cachePath, sourceHash))
+    {
+        return FromCache(*entry);
+    }
+
+    auto [vertices, indices] = ObjLoader::Load(
+        {source.data(), source.size()}, {.weldEpsilon = options.weldEpsilon});
+
+    if (options.optimize)
+    {
+        auto before = MeshOptimizer::AnalyzeVertexCache(indices, vertices.size());
+        MeshOptimizer::Optimize(vertices, indices);
+        auto after = MeshOptimizer::AnalyzeVertexCache(indices, vertices.size());
+        spdlog::info("Optimized mesh {}: ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}",
+                     name, before.acmr, after.acmr, before.atvr, after.atvr);
+    }
+
+    auto result = Process(std::move(vertices), std::move(indices), options);
+    m_cache.Store(cachePath, sourceHash, *result);
+    return result;
+}
+
+Mesh::Ptr MeshManager::FromCache(const MeshCache::Entry& entry)
+{
+    Mesh::Ptr result = std::make_shared<Mesh>();
+
+    result->vertices.assign(entry.vertices.begin(), entry.vertices.end());
+    SetSubmeshes(*result, {entry.submeshes.begin(), entry.submeshes.end()});
+    result->meshlets.assign(entry.meshlets.begin(), entry.meshlets.end());
+    result->indices.assign(entry.indices.begin(), entry.indices.end());
+
+    result->surfaceCenter = entry.surfaceCenter;
+    result->min = entry.min;
+    result->max = entry.max;
+    result->sphereCenter = entry.sphereCenter;
+    result->sphereRadius = entry.sphereRadius;
+
+    return result;
+}
+
+Mesh::Ptr MeshManager::Process(std::vector<Vertex> vertices,
+                               std::vector<uint32_t> indices,
+                               const MeshImportOptions& options) const
+{
+    ZoneScoped;
+    auto summary = MeshProcessing::GenerateTangents(vertices, indices);
+
+    Mesh::Ptr result = std::make_shared<Mesh>();
 
-    vk::DescriptorImageInfo albedoInfo;
-    if (albedo)
+    if (options.split16 && vertices.size() > (1 << 16))
     {
-        albedoInfo.sampler = *albedo->sampler;
-        albedoInfo.imageView = *albedo->imageView;
-        albedoInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    } else {
-        albedoInfo.sampler = *m_default_albedo->sampler;
-        albedoInfo.imageView = *m_default_albedo->imageView;
-        albedoInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        auto split = MeshProcessing::Split(vertices, indices);
+        vertices = std::move(split.vertices);
+        indices = std::move(split.indices);
+        SetSubmeshes(*result, std::move(split.submeshes));
     }
-
-    vk::DescriptorImageInfo normalInfo;
-    if (normal)
+    else
     {
-        normalInfo.sampler = *normal->sampler;
-        normalInfo.imageView = *normal->imageView;
-        normalInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    } else {
-        normalInfo.sampler = *m_default_normal->sampler;
-        normalInfo.imageView = *m_default_normal->imageView;
-        normalInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        SetSubmeshes(*result, {{0, static_cast<uint32_t>(indices.size()), 0,
+                                static_cast<uint32_t>(vertices.size())}});
     }
 
-    vk::DescriptorImageInfo roughnessInfo;
-    if (roughness)
+    if (options.lodCount > 1)
     {
-        roughnessInfo.sampler = *roughness->sampler;
-        roughnessInfo.imageView = *roughness->imageView;
-        roughnessInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    } else {
-        roughnessInfo.sampler = *m_default_roughness->sampler;
-        roughnessInfo.imageView = *m_default_roughness->imageView;
-        roughnessInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        GenerateLods(*result, vertices, indices, options);
     }
 
-    vk::DescriptorImageInfo specularInfo;
-    if (specular)
+    if (options.meshlets)
     {
-        specularInfo.sampler = *specular->sampler;
-        specularInfo.imageView = *specular->imageView;
-        specularInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    } else {
-        specularInfo.sampler = *m_default_specular->sampler;
-        specularInfo.imageView = *m_default_specular->imageView;
-        specularInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+        BuildMeshlets(*result, vertices, indices);
     }
 
-    vk::DescriptorImageInfo aoInfo;
-    if (ao)
-    {
-        aoInfo.sampler = *ao->sampler;
-        aoInfo.imageView = *ao->imageView;
-        aoInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    } else {
-        aoInfo.sampler = *m_default_ao->sampler;
-        aoInfo.imageView = *m_default_ao->imageView;
-        aoInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    }
+    auto sphere = MeshProcessing::BoundingSphere(vertices, summary.min, summary.max);
+
+    result->vertices = std::move(vertices);
+    result->indices = std::move(indices);
+
+    result->surfaceCenter = summary.surfaceCenter;
+    result->min = summary.min;
+    result->max = summary.max;
+    result->sphereCenter = glm::vec3(sphere);
+    result->sphereRadius = sphere.w;
 
-    auto writes = {
-        init::ImageWriteDescriptorSet(0, result->descriptor, albedoInfo),
-        init::ImageWriteDescriptorSet(1, result->descriptor, normalInfo),
-        init::ImageWriteDescriptorSet(2, result->descriptor, specularInfo),
-        init::ImageWriteDescriptorSet(3, result->descriptor, roughnessInfo),
-        init::ImageWriteDescriptorSet(4, result->descriptor, aoInfo)
-    };
-    m_engine.GetDevice().updateDescriptorSets(writes, nullptr);
     return result;
 }
 
-Mesh::Ptr MeshManager::NewFromObj(const std::string &name, const std::filesystem::path &filename)
+void MeshManager::Upload(Mesh& mesh, const MeshImportOptions& options)
 {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
+    UploadVertices(mesh, mesh.vertices, options.vertexFormat);
+    UploadIndices(mesh, mesh.indices);
+    mesh.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+    mesh.indexCount = static_cast<uint32_t>(mesh.indices.size());
 
-    std::string err;
+    if (!mesh.meshlets.empty())
+    {
+        UploadMeshlets(mesh);
+    }
 
-    tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename.c_str());
-    if (!err.empty())
+    // The staging memory holds its own copy, so the vectors can go now
+    switch (options.retention)
     {
-        spdlog::error(err);
-        //throw std::runtime_error("Could not load mesh");
+    case MeshRetention::Drop:
+        std::vector<Vertex>().swap(mesh.vertices);
+        std::vector<uint32_t>().swap(mesh.indices);
+        break;
+    case MeshRetention::Positions:
+        mesh.positions.resize(mesh.vertices.size());
+        std::ranges::transform(mesh.vertices, mesh.positions.begin(), &Vertex::position);
+        std::vector<Vertex>().swap(mesh.vertices);
+        break;
+    case MeshRetention::Keep:
+        break;
     }
+}
 
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
-    std::unordered_map<Vertex, uint32_t> uniqueVertices;
+void MeshManager::GenerateLods(Mesh& mesh, std::span<const Vertex> vertices,
+                               std::vector<uint32_t>& indices,
+                               const MeshImportOptions& options) const
+{
+    ZoneScoped;
+    std::vector<Submesh> base = mesh.submeshes;
+    std::size_t jobCount = base.size() * (options.lodCount - 1);
+    std::vector<MeshSimplifier::Result> simplified(jobCount);
 
-    for (const auto& shape : shapes)
-    {
-        for (const auto& index : shape.mesh.indices)
+    ThreadPool::Global().ParallelFor(jobCount, 1, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t job = begin; job < end; job++)
         {
-            Vertex vertex;
-
-            vertex.position = {
-                attrib.vertices[3 * index.vertex_index + 0],
-                attrib.vertices[3 * index.vertex_index + 1],
-                attrib.vertices[3 * index.vertex_index + 2]
-            };
+            const Submesh& submesh = base[job % base.size()];
+            uint32_t level = job / base.size() + 1;
 
-            if (attrib.normals.size() > 0)
-            {
-                vertex.normal = {
-                    attrib.normals[3 * index.normal_index + 0],
-                    attrib.normals[3 * index.normal_index + 1],
-                    attrib.normals[3 * index.normal_index + 2]
-                };
-            }
+            auto target = static_cast<std::size_t>(
+                submesh.indexCount * std::pow(options.lodReduction, level));
+            simplified[job] = MeshSimplifier::Simplify(
+                vertices.subspan(submesh.vertexOffset, submesh.vertexCount),
+                std::span(indices).subspan(submesh.firstIndex, submesh.indexCount),
+                target / 3 * 3);
 
-            if (attrib.texcoords.size() > 0)
+            if (options.optimize)
             {
-                vertex.textureCoord = {
-                    attrib.texcoords[2 * index.texcoord_index + 0],
-                    1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-                };
+                MeshOptimizer::OptimizeVertexCache(simplified[job].indices, submesh.vertexCount);
             }
-            else
-            {
-                vertex.textureCoord = {
-                    0, 0
-                };
-            }
-
-            vertex.color = {1.0f, 1.0f, 1.0f};
-
-            if (!uniqueVertices.count(vertex)) {
-                uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                vertices.push_back(vertex);
-            }
-
-            indices.push_back(uniqueVertices[vertex]);
         }
+    });
+
+    std::vector<Submesh> submeshes = base;
+    for (std::size_t job = 0; job < jobCount; job++)
+    {
+        Submesh lod = base[job % base.size()];
+        lod.lod = job / base.size() + 1;
+        lod.firstIndex = static_cast<uint32_t>(indices.size());
+        lod.indexCount = static_cast<uint32_t>(simplified[job].indices.size());
+        lod.error = simplified[job].error;
+        indices.insert(indices.end(), simplified[job].indices.begin(), simplified[job].indices.end());
+        submeshes.push_back(lod);
     }
-    return NewFromVertices(name, std::move(vertices), std::move(indices));
+
+    SetSubmeshes(mesh, std::move(submeshes));
 }
 
-Mesh::Ptr MeshManager::NewFromVertices(const std::string& name,
-                                       std::vector<Vertex> vertices,
-                                       std::vector<uint32_t> indices)
+void MeshManager::SetSubmeshes(Mesh& mesh, std::vector<Submesh> submeshes)
 {
-    std::vector<glm::vec3> tan1(vertices.size());
-    std::ranges::fill(tan1, glm::vec3(0));
-    std::vector<glm::vec3> tan2(vertices.size());
-    std::ranges::fill(tan2, glm::vec3(0));
-
-    for(unsigned int i = 0; i < indices.size(); i += 3)
+    mesh.lodErrors.clear();
+    for (const auto& submesh : submeshes)
     {
-        auto& vertex0 = vertices[indices[i]];
-        auto& vertex1 = vertices[indices[i + 1]];
-        auto& vertex2 = vertices[indices[i + 2]];
-
-        glm::vec3 v1 = vertex0.position;
-        glm::vec3 v2 = vertex1.position;
-        glm::vec3 v3 = vertex2.position;
-
-        glm::vec2 w1 = vertex0.textureCoord;
-        glm::vec2 w2 = vertex1.textureCoord;
-        glm::vec2 w3 = vertex2.textureCoord;
+        if (submesh.lod >= mesh.lodErrors.size())
+            mesh.lodErrors.resize(submesh.lod + 1, 0.0f);
+        mesh.lodErrors[submesh.lod] = std::max(mesh.lodErrors[submesh.lod], submesh.error);
+    }
 
-        float x1 = v2.x - v1.x;
-        float x2 = v3.x - v1.x;
-        float y1 = v2.y - v1.y;
-        float y2 = v3.y - v1.y;
-        float z1 = v2.z - v1.z;
-        float z2 = v3.z - v1.z;
+    // Coarser levels are never considered more accurate than finer ones
+    for (std::size_t i = 1; i < mesh.lodErrors.size(); i++)
+        mesh.lodErrors[i] = std::max(mesh.lodErrors[i], mesh.lodErrors[i - 1]);
 
-        float s1 = w2.x - w1.x;
-        float s2 = w3.x - w1.x;
-        float t1 = w2.y - w1.y;
-        float t2 = w3.y - w1.y;
+    mesh.submeshes = std::move(submeshes);
+}
 
-        float r = 1.0F / (s1 * t2 - s2 * t1);
-        glm::vec3 sdir((t2 * x1 - t1 * x2) * r, (t2 * y1 - t1 * y2) * r,
-                       (t2 * z1 - t1 * z2) * r);
-        glm::vec3 tdir((s1 * x2 - s2 * x1) * r, (s1 * y2 - s2 * y1) * r,
-                       (s1 * z2 - s2 * z1) * r);
+void MeshManager::BuildMeshlets(Mesh& mesh, std::span<const Vertex> vertices,
+                                std::span<const uint32_t> indices)
+{
+    ZoneScoped;
+    std::vector<std::vector<Meshlet>> built(mesh.submeshes.size());
 
-        tan1[indices[i]] += sdir;
-        tan1[indices[i + 1]] += sdir;
-        tan1[indices[i + 2]] += sdir;
+    ThreadPool::Global().ParallelFor(built.size(), 1, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++)
+        {
+            const Submesh& submesh = mesh.submeshes[i];
+            built[i] = MeshletBuilder::Build(
+                vertices.subspan(submesh.vertexOffset, submesh.vertexCount),
+                indices.subspan(submesh.firstIndex, submesh.indexCount),
+                submesh.firstIndex);
+        }
+    });
 
-        tan2[indices[i]] += tdir;
-        tan2[indices[i + 1]] += tdir;
-        tan2[indices[i + 2]] += tdir;
+    mesh.meshlets.clear();
+    for (std::size_t i = 0; i < built.size(); i++)
+    {
+        mesh.submeshes[i].firstMeshlet = static_cast<uint32_t>(mesh.meshlets.size());
+        mesh.submeshes[i].meshletCount = static_cast<uint32_t>(built[i].size());
+        mesh.meshlets.insert(mesh.meshlets.end(), built[i].begin(), built[i].end());
     }
+}
 
-    for (long a = 0; a < vertices.size(); a++)
-    {
-        const glm::vec3& n = vertices[a].normal;
-        const glm::vec3& t = tan1[a];
+void MeshManager::UploadMeshlets(Mesh& mesh)
+{
+    // Aligned to the size, so the range starts at a whole meshlet
+    std::span<const Meshlet> meshlets = mesh.meshlets;
+    mesh.meshletRange = m_engine.GetMeshletArena().Allocate(meshlets.size_bytes(),
+                                                            sizeof(Meshlet));
+    m_engine.WriteToGPU(mesh.meshletRange, [&](std::span<uint8_t> staging) {
+        memcpy(staging.data(), meshlets.data(), meshlets.size_bytes());
+    });
+}
 
-        // Gram-Schmidt orthogonalize
-        vertices[a].tangent =
-            glm::vec4(glm::normalize(t - n * glm::dot(n, t)), 1.f);
+void MeshManager::UploadVertices(Mesh& mesh, std::span<const Vertex> vertices,
+                                 VertexFormat format)
+{
+    mesh.vertexFormat = format;
 
-        // Calculate handedness
-        vertices[a].tangent.w =
-            (glm::dot(glm::cross(n, t), tan2[a]) < 0.0F) ? -1.0F : 1.0F;
-    }
+    // Aligned to the stride, so the range starts at a whole vertex
+    std::size_t stride = format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+    mesh.vertexRange = m_engine.GetVertexArena().Allocate(vertices.size() * stride, stride);
+    mesh.baseVertex = static_cast<int32_t>(mesh.vertexRange.offset / stride);
 
-    float area_sum=0.0;
-    glm::vec3 centroid = glm::vec3(0.0,0.0,0.0);
-    for(unsigned int i = 0; i < indices.size(); i += 3)
+    if (format == VertexFormat::Packed)
     {
-        auto& vertex0 = vertices[indices[i]];
-        auto& vertex1 = vertices[indices[i + 1]];
-        auto& vertex2 = vertices[indices[i + 2]];
-
-        glm::vec3 v1 = vertex0.position;
-        glm::vec3 v2 = vertex1.position;
-        glm::vec3 v3 = vertex2.position;
-
-        glm::vec3 center = (v1+v2+v3) / 3.f;
-        float area = 0.5 * glm::length(glm::cross(v2-v1, v3-v1));
-        centroid += area*center;
-        area_sum += area;
+        // Packed straight into the staging memory
+        m_engine.WriteToGPU(mesh.vertexRange, [&](std::span<uint8_t> staging) {
+            std::span output(reinterpret_cast<PackedVertex*>(staging.data()), vertices.size());
+            auto quantization = MeshProcessing::PackVertices(vertices, output);
+            mesh.positionOffset = quantization.positionOffset;
+            mesh.positionScale = quantization.positionScale;
+        });
     }
-    centroid /= area_sum;
-
-    glm::vec3 min = vertices.front().position;
-    glm::vec3 max = vertices.front().position;
-    for (const auto& vert : vertices)
+    else
     {
-        min = glm::min(min, vert.position);
-        max = glm::max(max, vert.position);
+        m_engine.WriteToGPU(mesh.vertexRange, [&](std::span<uint8_t> staging) {
+            memcpy(staging.data(), vertices.data(), vertices.size_bytes());
+        });
     }
+}
 
-    Mesh::Ptr result = std::make_shared<Mesh>();
-
-    result->vertexBuffer =
-        m_engine.CopyToGPU(vertices, vk::BufferUsageFlagBits::eVertexBuffer);
-    result->vertices = std::move(vertices);
-
-    result->indexBuffer =
-        m_engine.CopyToGPU(indices, vk::BufferUsageFlagBits::eIndexBuffer);
-    result->indices = std::move(indices);
-
-    result->surfaceCenter = centroid;
-    result->min = centroid;
-    result->max = centroid;
+void MeshManager::UploadIndices(Mesh& mesh, std::span<const uint32_t> indices)
+{
+    bool shortIndices = std::ranges::all_of(mesh.submeshes, [](const Submesh& submesh) {
+        return submesh.vertexCount <= (1 << 16);
+    });
+    mesh.indexType = shortIndices ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
 
-    m_meshes[name] = result;
+    // 16 bit indices are padded to whole 32 bit words for the culling shader
+    std::size_t indexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+    std::size_t count = shortIndices ? (indices.size() + 1) / 2 * 2 : indices.size();
+    mesh.indexRange = m_engine.GetIndexArena().Allocate(count * indexSize, sizeof(uint32_t));
+    mesh.baseIndex = static_cast<uint32_t>(mesh.indexRange.offset / indexSize);
 
-    return result;
+    m_engine.WriteToGPU(mesh.indexRange, [&](std::span<uint8_t> staging) {
+        if (shortIndices)
+        {
+            auto* packed = reinterpret_cast<uint16_t*>(staging.data());
+            std::ranges::copy(indices, packed);
+            if (count > indices.size())
+                packed[count - 1] = 0;
+        }
+        else
+        {
+            memcpy(staging.data(), indices.data(), indices.size_bytes());
+        }
+    });
 }
 
 Material::Ptr MaterialManager::Create(
     const std::string &name,
     const std::filesystem::path &vertex,
     const std::filesystem::path &fragment,
-    bool textures
+    VertexAttributes attributes,
+    bool textures,
+    bool packed
     )
 {
     Material::Ptr result = std::make_shared<Material>();
 
-    auto vertexModule = m_engine.CreateShaderModule(
-        ShaderCompiler::CompileFromFile(
-            vertex, shaderc_shader_kind::shaderc_glsl_vertex_shader));
+    std::vector<std::string> fragmentDefinitions;
+    if (packed)
+        fragmentDefinitions.push_back("PACKED_ORM");
 
     auto fragmentModule = m_engine.CreateShaderModule(
         ShaderCompiler::CompileFromFile(
-            fragment, shaderc_shader_kind::shaderc_glsl_fragment_shader));
+            fragment, shaderc_shader_kind::shaderc_glsl_fragment_shader, fragmentDefinitions));
 
     vk::PipelineShaderStageCreateInfo vertCreateInfo;
     vertCreateInfo.stage = vk::ShaderStageFlagBits::eVertex;
-    vertCreateInfo.module = *vertexModule;
     vertCreateInfo.pName = "main";
 
     vk::PipelineShaderStageCreateInfo fragCreateInfo;
@@ -494,14 +1665,6 @@ Material::Ptr MaterialManager::Create(
     fragCreateInfo.module = *fragmentModule;
     fragCreateInfo.pName = "main";
 
-    std::array shaderStages {vertCreateInfo, fragCreateInfo};
-
-    vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
-    auto bindingDescription = Vertex::BindingDescription();
-    auto attributeDescriptions = Vertex::AttributeDescriptions();
-    vertexInputInfo.setVertexBindingDescriptions(bindingDescription);
-    vertexInputInfo.setVertexAttributeDescriptions(attributeDescriptions);
-
     vk::PipelineInputAssemblyStateCreateInfo inputAssemblyInfo;
     inputAssemblyInfo.topology = vk::PrimitiveTopology::eTriangleList;
     inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
@@ -572,10 +1735,13 @@ Material::Ptr MaterialManager::Create(
 
     if (textures)
     {
-        layouts.push_back(m_engine.GetTextureSetLayout());
+        layouts.push_back(packed ? m_engine.GetPackedTextureSetLayout()
+                          : m_engine.GetTextureSetLayout());
     }
 
     result->textures = textures;
+    result->packed = packed;
+    result->attributes = attributes;
 
     vk::PushConstantRange range(
         vk::ShaderStageFlagBits::eAllGraphics,
@@ -587,9 +1753,6 @@ Material::Ptr MaterialManager::Create(
     result->pipelineLayout = m_engine.GetDevice().createPipelineLayoutUnique(layoutInfo);
 
     vk::GraphicsPipelineCreateInfo pipelineInfo;
-    pipelineInfo.setStages(shaderStages);
-
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssemblyInfo;
     pipelineInfo.pViewportState = &viewportStateInfo;
     pipelineInfo.pRasterizationState = &rasterizerInfo;
@@ -600,7 +1763,33 @@ Material::Ptr MaterialManager::Create(
     pipelineInfo.renderPass = m_engine.GetRenderPass();
     pipelineInfo.subpass = 0;
 
-    result->pipeline = m_engine.GetDevice().createGraphicsPipelineUnique(VK_NULL_HANDLE, pipelineInfo).value;
+    // One pipeline per vertex format, the vertex shader is compiled with
+    // PACKED_VERTEX defined for the quantized layout
+    for (std::size_t i = 0; i < VertexFormatCount; i++)
+    {
+        auto format = static_cast<VertexFormat>(i);
+
+        std::vector<std::string> definitions;
+        if (format == VertexFormat::Packed)
+            definitions.push_back("PACKED_VERTEX");
+
+        auto vertexModule = m_engine.CreateShaderModule(
+            ShaderCompiler::CompileFromFile(
+                vertex, shaderc_shader_kind::shaderc_glsl_vertex_shader, definitions));
+        vertCreateInfo.module = *vertexModule;
+
+        std::array shaderStages {vertCreateInfo, fragCreateInfo};
+        pipelineInfo.setStages(shaderStages);
+
+        vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
+        auto bindingDescription = VertexBindingDescription(format);
+        auto attributeDescriptions = VertexAttributeDescriptions(format, attributes);
+        vertexInputInfo.setVertexBindingDescriptions(bindingDescription);
+        vertexInputInfo.setVertexAttributeDescriptions(attributeDescriptions);
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+
+        result->pipelines[i] = m_engine.GetDevice().createGraphicsPipelineUnique(VK_NULL_HANDLE, pipelineInfo).value;
+    }
 
     return result;
 }
@@ -608,9 +1797,10 @@ Material::Ptr MaterialManager::Create(
 Material::Ptr MaterialManager::FromShaders(
     const std::string &name,
     const std::filesystem::path &vertex,
-    const std::filesystem::path &fragment)
+    const std::filesystem::path &fragment,
+    VertexAttributes attributes)
 {
-    Material::Ptr result = Create(name, vertex, fragment);
+    Material::Ptr result = Create(name, vertex, fragment, attributes);
     m_materials[name] = result;
     m_names[result] = name;
     m_used_shaders[name] = {vertex, fragment};
@@ -621,9 +1811,24 @@ Material::Ptr MaterialManager::FromShaders(
 Material::Ptr MaterialManager::Textureless(
     const std::string &name,
     const std::filesystem::path &vertex,
-    const std::filesystem::path &fragment)
+    const std::filesystem::path &fragment,
+    VertexAttributes attributes)
+{
+    Material::Ptr result = Create(name, vertex, fragment, attributes, false);
+    m_materials[name] = result;
+    m_names[result] = name;
+    m_used_shaders[name] = {vertex, fragment};
+
+    return result;
+}
+
+Material::Ptr MaterialManager::PackedTextures(
+    const std::string &name,
+    const std::filesystem::path &vertex,
+    const std::filesystem::path &fragment,
+    VertexAttributes attributes)
 {
-    Material::Ptr result = Create(name, vertex, fragment, false);
+    Material::Ptr result = Create(name, vertex, fragment, attributes, true, true);
     m_materials[name] = result;
     m_names[result] = name;
     m_used_shaders[name] = {vertex, fragment};
@@ -636,77 +1841,672 @@ void MaterialManager::Recreate()
     for (auto& [name, material] : m_materials)
     {
         const auto& [vertex, fragment] = m_used_shaders[name];
-        *material = std::move(*Create(name, vertex, fragment));
+        *material = std::move(*Create(name, vertex, fragment,
+                                      material->attributes, material->textures,
+                                      material->packed));
+    }
+}
+
+namespace {
+    // Push constants of meshlet_cull.comp
+    struct CullConstants
+    {
+        glm::mat4 modelViewProj;
+        // Object space
+        glm::vec4 cameraPosition;
+        uint32_t firstMeshlet;
+        uint32_t command;
+        uint32_t shortIndices;
+        uint32_t firstIndex;
+    };
+}
+
+MeshRenderer::MeshRenderer() = default;
+MeshRenderer::~MeshRenderer() = default;
+
+void MeshRenderer::Init(Engine& engine)
+{
+    m_engine = &engine;
+    auto device = engine.GetDevice();
+
+    vk::DescriptorSetLayoutBinding indices;
+    indices.binding = 0;
+    indices.descriptorType = vk::DescriptorType::eStorageBuffer;
+    indices.descriptorCount = 1;
+    indices.stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+    vk::DescriptorSetLayoutBinding commands;
+    commands.binding = 1;
+    commands.descriptorType = vk::DescriptorType::eStorageBuffer;
+    commands.descriptorCount = 1;
+    commands.stageFlags = vk::ShaderStageFlagBits::eCompute;
+
+    auto bindings = {indices, commands};
+    vk::DescriptorSetLayoutCreateInfo setLayoutInfo;
+    setLayoutInfo.setBindings(bindings);
+    m_cullSetLayout = device.createDescriptorSetLayoutUnique(setLayoutInfo);
+
+    // Meshlet block, culling output and index block
+    std::array setLayouts {engine.GetGeometryBlockSetLayout(), *m_cullSetLayout,
+                           engine.GetGeometryBlockSetLayout()};
+    vk::PushConstantRange range(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullConstants));
+    vk::PipelineLayoutCreateInfo layoutInfo;
+    layoutInfo.setSetLayouts(setLayouts);
+    layoutInfo.setPushConstantRanges(range);
+    m_cullPipelineLayout = device.createPipelineLayoutUnique(layoutInfo);
+
+    auto computeModule = engine.CreateShaderModule(
+        ShaderCompiler::CompileFromFile(
+            Files::Local("res/shaders/meshlet_cull.comp"),
+            shaderc_shader_kind::shaderc_glsl_compute_shader));
+
+    vk::ComputePipelineCreateInfo pipelineInfo;
+    pipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+    pipelineInfo.stage.module = *computeModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = *m_cullPipelineLayout;
+    m_cullPipeline = device.createComputePipelineUnique(VK_NULL_HANDLE, pipelineInfo).value;
+
+    m_cullFrames.resize(engine.GetMaxFramesInFlight());
+    for (auto& frame : m_cullFrames)
+    {
+        vk::DescriptorSetAllocateInfo allocInfo;
+        allocInfo.descriptorPool = engine.GetGlobalDescriptorPool();
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.setSetLayouts(*m_cullSetLayout);
+        frame.descriptor = device.allocateDescriptorSets(allocInfo)[0];
     }
+
+    m_instanceFrames.resize(engine.GetMaxFramesInFlight());
+
+    m_scene = std::make_unique<GpuScene>();
+    m_scene->Init(engine);
 }
 
 void MeshRenderer::Begin()
 {
     m_toDraw.clear();
+    m_order.clear();
 }
 
 void MeshRenderer::End()
 {
+    ZoneScoped;
+    const auto& scene = m_engine->m_ubo;
+    glm::vec3 cameraPosition = glm::inverse(scene.view)[3];
+    float pixelsPerUnit = 0.5f * scene.resolution.y * std::abs(scene.proj[1][1]);
+
+    m_culled = 0;
+    if (frustumCulling)
+        FrustumCull(scene.proj * scene.view);
+
+    // Ids of the state, in order of first use
+    std::unordered_map<const Material*, uint64_t> materials;
+    std::unordered_map<const TextureSet*, uint64_t> textureSets;
+    std::unordered_map<const Mesh*, uint64_t> meshes;
+    auto idOf = [](auto& ids, const auto* object, uint64_t bits) {
+        auto it = ids.try_emplace(object, ids.size()).first;
+        return std::min(it->second, (uint64_t(1) << bits) - 1);
+    };
+
+    // Most significant first: 2 bits pass, 14 bits pipeline, 16 bits
+    // texture set, 16 bits mesh and 16 bits depth. Within a pass draws of
+    // the same state go front to back
+    std::vector<uint64_t> keys;
+    keys.reserve(m_toDraw.size());
+
+    // Textures drawn this frame are kept resident first
+    uint64_t frame = m_engine->GetFrameNumber();
+    for (auto& draw : m_toDraw)
+    {
+        draw.lod = SelectLod(draw, cameraPosition, pixelsPerUnit);
+        if (draw.lodState)
+            draw.lodState->level = draw.lod;
+        if (draw.textures)
+            draw.textures->Touch(frame);
+
+        uint64_t pass = std::min<uint64_t>(draw.material->pass, 3);
+        uint64_t pipeline = std::min<uint64_t>(
+            idOf(materials, draw.material.get(), 14) * VertexFormatCount
+            + static_cast<uint64_t>(draw.mesh->vertexFormat),
+            (uint64_t(1) << 14) - 1);
+        const TextureSet* textures = draw.material->textures ? draw.textures.get() : nullptr;
+
+        // The upper bits of a positive float order like the float
+        glm::vec3 center = draw.model * glm::vec4(draw.mesh->surfaceCenter, 1.0f);
+        float distance = glm::length(center - cameraPosition);
+        uint64_t depth = std::bit_cast<uint32_t>(distance) >> 16;
+
+        keys.push_back(pass << 62
+                       | pipeline << 48
+                       | idOf(textureSets, textures, 16) << 32
+                       | idOf(meshes, draw.mesh.get(), 16) << 16
+                       | depth);
+    }
 
+    RadixSort::Sort(keys, m_order);
 }
 
-void MeshRenderer::WriteCmdBuffer(vk::CommandBuffer cmd, Engine& engine)
+MeshRenderer::ObjectId MeshRenderer::AddObject(Mesh::Ptr mesh, Material::Ptr material,
+                                               TextureSet::Ptr textures, const glm::mat4& model)
 {
-    Material::Ptr lastMaterial;
-    Mesh::Ptr lastMesh;
-    TextureSet::Ptr lastTextureSet;
+    return m_scene->Add(std::move(mesh), std::move(material), std::move(textures), model);
+}
 
-    TracyVkZone(engine.GetCurrentTracyContext(), cmd, "Meshes");
-    for (auto& drawData : m_toDraw)
+void MeshRenderer::SetTransform(ObjectId id, const glm::mat4& model)
+{
+    m_scene->SetTransform(id, model);
+}
+
+void MeshRenderer::RemoveObject(ObjectId id)
+{
+    m_scene->Remove(id);
+}
+
+void MeshRenderer::FrustumCull(const glm::mat4& projview)
+{
+    ZoneScoped;
+    auto planes = FrustumCuller::Extract(projview);
+    std::size_t count = m_toDraw.size();
+    m_spheres.Resize(count);
+    m_visible.resize(count);
+
+    // Batches are a multiple of the SIMD width, small lists stay on this
+    // thread
+    ThreadPool::Global().ParallelFor(count, 4096, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; i++)
+        {
+            const auto& draw = m_toDraw[i];
+            glm::vec3 center = draw.model * glm::vec4(draw.mesh->sphereCenter, 1.0f);
+            float scale = std::max({glm::length(glm::vec3(draw.model[0])),
+                                    glm::length(glm::vec3(draw.model[1])),
+                                    glm::length(glm::vec3(draw.model[2]))});
+            m_spheres.x[i] = center.x;
+            m_spheres.y[i] = center.y;
+            m_spheres.z[i] = center.z;
+            m_spheres.radius[i] = draw.mesh->sphereRadius * scale;
+        }
+        FrustumCuller::Cull(planes, m_spheres, begin, end, m_visible);
+    });
+
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (!m_visible[i])
+            continue;
+        if (kept != i)
+            m_toDraw[kept] = std::move(m_toDraw[i]);
+        kept++;
+    }
+    m_toDraw.resize(kept);
+    m_culled = static_cast<uint32_t>(count - kept);
+}
+
+uint32_t MeshRenderer::SelectLod(const ToDraw& draw, const glm::vec3& cameraPosition,
+                                 float pixelsPerUnit) const
+{
+    const auto& errors = draw.mesh->lodErrors;
+    if (errors.size() <= 1)
+        return 0;
+
+    // Levels only get coarser once their error is comfortably below the
+    // threshold, so objects near a switch distance do not flicker
+    constexpr float hysteresis = 0.25f;
+
+    glm::vec3 center = draw.model * glm::vec4(draw.mesh->surfaceCenter, 1.0f);
+    float scale = std::max({glm::length(glm::vec3(draw.model[0])),
+                            glm::length(glm::vec3(draw.model[1])),
+                            glm::length(glm::vec3(draw.model[2]))});
+    float distance = std::max(glm::length(center - cameraPosition), 1e-3f);
+
+    auto projected = [&](uint32_t level) {
+        return errors[level] * scale / distance * pixelsPerUnit;
+    };
+
+    uint32_t level = draw.lodState ? std::min<uint32_t>(draw.lodState->level, errors.size() - 1) : 0;
+    while (level > 0 && projected(level) > lodThreshold)
+        level--;
+    while (level + 1 < errors.size() && projected(level + 1) <= lodThreshold * (1.0f - hysteresis))
+        level++;
+
+    return level;
+}
+
+void MeshRenderer::ReserveCullFrame(CullFrame& frame, vk::DeviceSize indexCount,
+                                    vk::DeviceSize commandCount)
+{
+    // Called after the frame's fence was waited on, so the old buffers
+    // are no longer in use
+    bool changed = false;
+    if (frame.indexCapacity < indexCount)
+    {
+        frame.indexCapacity = indexCount + indexCount / 2;
+        frame.indices = m_engine->CreateBuffer(
+            frame.indexCapacity * sizeof(uint32_t),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndexBuffer,
+            VMA_MEMORY_USAGE_GPU_ONLY);
+        changed = true;
+    }
+
+    if (frame.commandCapacity < commandCount)
+    {
+        frame.commandCapacity = commandCount + commandCount / 2;
+        frame.commands = m_engine->CreateBuffer(
+            frame.commandCapacity * sizeof(vk::DrawIndexedIndirectCommand),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+            VMA_MEMORY_USAGE_CPU_TO_GPU);
+        changed = true;
+    }
+
+    if (!changed)
+        return;
+
+    vk::DescriptorBufferInfo indicesInfo(frame.indices.buffer, 0, VK_WHOLE_SIZE);
+    vk::DescriptorBufferInfo commandsInfo(frame.commands.buffer, 0, VK_WHOLE_SIZE);
+
+    std::array<vk::WriteDescriptorSet, 2> writes;
+    writes[0].dstSet = frame.descriptor;
+    writes[0].dstBinding = 0;
+    writes[0].descriptorType = vk::DescriptorType::eStorageBuffer;
+    writes[0].setBufferInfo(indicesInfo);
+    writes[1].dstSet = frame.descriptor;
+    writes[1].dstBinding = 1;
+    writes[1].descriptorType = vk::DescriptorType::eStorageBuffer;
+    writes[1].setBufferInfo(commandsInfo);
+
+    m_engine->GetDevice().updateDescriptorSets(writes, nullptr);
+}
+
+void MeshRenderer::WriteInstances(Engine& engine)
+{
+    if (m_order.empty())
+        return;
+
+    // Called after the frame's fence was waited on, so neither the buffer
+    // nor the global set are in use
+    InstanceFrame& frame = m_instanceFrames[engine.GetCurrentFrame()];
+    if (frame.capacity < m_order.size())
+    {
+        frame.capacity = m_order.size() + m_order.size() / 2;
+        frame.instances = engine.CreateBuffer(frame.capacity * sizeof(InstanceData),
+                                              vk::BufferUsageFlagBits::eStorageBuffer,
+                                              VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+        vk::DescriptorBufferInfo instancesInfo(frame.instances.buffer, 0, VK_WHOLE_SIZE);
+        vk::WriteDescriptorSet write;
+        write.dstSet = engine.GetCurrentGlobalSet();
+        write.dstBinding = 2;
+        write.descriptorType = vk::DescriptorType::eStorageBuffer;
+        write.setBufferInfo(instancesInfo);
+        engine.GetDevice().updateDescriptorSets(write, nullptr);
+    }
+
+    // Instances of a draw are the draws following it, so the buffer is
+    // filled in drawing order
+    void* mapped;
+    vmaMapMemory(engine.GetVmaAllocator(), frame.instances.allocation, &mapped);
+    auto* instances = static_cast<InstanceData*>(mapped);
+    for (uint32_t i = 0; i < m_order.size(); i++)
+    {
+        auto& draw = m_toDraw[m_order[i]];
+        draw.instance = i;
+        instances[i].model = draw.model;
+    }
+    vmaFlushAllocation(engine.GetVmaAllocator(), frame.instances.allocation, 0, VK_WHOLE_SIZE);
+    vmaUnmapMemory(engine.GetVmaAllocator(), frame.instances.allocation);
+}
+
+vk::DescriptorSet MeshRenderer::GetBlockSet(std::vector<vk::DescriptorSet>& sets,
+                                            const GeometryRange& range)
+{
+    // Blocks are never freed, so neither are their sets
+    if (range.block >= sets.size())
+        sets.resize(range.block + 1);
+
+    vk::DescriptorSet& set = sets[range.block];
+    if (set)
+        return set;
+
+    vk::DescriptorSetAllocateInfo allocInfo;
+    allocInfo.descriptorPool = m_engine->GetGlobalDescriptorPool();
+    allocInfo.descriptorSetCount = 1;
+    auto layout = m_engine->GetGeometryBlockSetLayout();
+    allocInfo.setSetLayouts(layout);
+    set = m_engine->GetDevice().allocateDescriptorSets(allocInfo)[0];
+
+    vk::DescriptorBufferInfo blockInfo(range.buffer, 0, VK_WHOLE_SIZE);
+    vk::WriteDescriptorSet write;
+    write.dstSet = set;
+    write.dstBinding = 0;
+    write.descriptorType = vk::DescriptorType::eStorageBuffer;
+    write.setBufferInfo(blockInfo);
+    m_engine->GetDevice().updateDescriptorSets(write, nullptr);
+    return set;
+}
+
+bool MeshRenderer::IsInstanceOf(const ToDraw& draw, const ToDraw& first)
+{
+    return draw.mesh == first.mesh && draw.material == first.material && draw.lod == first.lod
+        && (draw.textures == first.textures || !first.material->textures);
+}
+
+void MeshRenderer::Cull(vk::CommandBuffer cmd, Engine& engine)
+{
+    ZoneScoped;
+    WriteInstances(engine);
+    m_scene->Cull(cmd);
+    for (auto& draw : m_toDraw)
+        draw.firstCommand.reset();
+
+    if (!meshletCulling)
+        return;
+
+    // Every drawn submesh gets an indirect command and an output range
+    // large enough for all of its triangles. Draws with instances are not
+    // culled, so they stay one instanced call
+    vk::DeviceSize indexCount = 0;
+    uint32_t commandCount = 0;
+    for (std::size_t i = 0; i < m_order.size();)
     {
-        if (drawData.textures != lastTextureSet)
+        auto& draw = m_toDraw[m_order[i]];
+        std::size_t instanceCount = 1;
+        while (i + instanceCount < m_order.size() &&
+               IsInstanceOf(m_toDraw[m_order[i + instanceCount]], draw))
         {
-            if (drawData.material->textures)
-                lastTextureSet = drawData.textures;
+            instanceCount++;
+        }
+        i += instanceCount;
 
-            if (drawData.material == lastMaterial)
+        if (instanceCount > 1 || draw.mesh->meshlets.empty())
+            continue;
+
+        draw.firstCommand = commandCount;
+        for (const auto& submesh : draw.mesh->submeshes)
+        {
+            if (submesh.lod == draw.lod)
             {
-                if (lastTextureSet != nullptr && drawData.material->textures)
-                {
-                    cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
-                                           *drawData.material->pipelineLayout, 1,
-                                           lastTextureSet->descriptor, nullptr);
-                }
+                commandCount++;
+                indexCount += submesh.indexCount;
             }
         }
+    }
 
-        if (drawData.material != lastMaterial)
+    if (commandCount == 0)
+        return;
+
+    CullFrame& frame = m_cullFrames[engine.GetCurrentFrame()];
+    ReserveCullFrame(frame, indexCount, commandCount);
+
+    void* mapped;
+    vmaMapMemory(engine.GetVmaAllocator(), frame.commands.allocation, &mapped);
+    auto* commands = static_cast<vk::DrawIndexedIndirectCommand*>(mapped);
+    // Without drawIndirectFirstInstance the instance is pushed when drawing
+    bool firstInstance = engine.HasDrawIndirectFirstInstance();
+    uint32_t firstIndex = 0;
+    for (const auto& draw : m_toDraw)
+    {
+        if (!draw.firstCommand)
+            continue;
+
+        uint32_t command = *draw.firstCommand;
+        for (const auto& submesh : draw.mesh->submeshes)
         {
-            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, *drawData.material->pipeline);
-            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
-                                   *drawData.material->pipelineLayout, 0,
-                                   engine.GetCurrentGlobalSet(), nullptr);
+            if (submesh.lod == draw.lod)
+            {
+                commands[command++] = vk::DrawIndexedIndirectCommand(
+                    0, 1, firstIndex, draw.mesh->baseVertex + submesh.vertexOffset,
+                    firstInstance ? draw.instance : 0);
+                firstIndex += submesh.indexCount;
+            }
+        }
+    }
+    vmaFlushAllocation(engine.GetVmaAllocator(), frame.commands.allocation, 0, VK_WHOLE_SIZE);
+    vmaUnmapMemory(engine.GetVmaAllocator(), frame.commands.allocation);
+
+    TracyVkZone(engine.GetCurrentTracyContext(), cmd, "Meshlet culling");
+    cmd.bindPipeline(vk::PipelineBindPoint::eCompute, *m_cullPipeline);
+    cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *m_cullPipelineLayout, 1,
+                           frame.descriptor, nullptr);
+
+    const auto& scene = engine.m_ubo;
+    glm::mat4 projview = scene.proj * scene.view;
+    glm::vec4 cameraPosition = glm::inverse(scene.view)[3];
+    vk::DescriptorSet lastMeshlets;
+    vk::DescriptorSet lastIndices;
+
+    for (uint32_t index : m_order)
+    {
+        const auto& draw = m_toDraw[index];
+        if (!draw.firstCommand)
+            continue;
+
+        const Mesh& mesh = *draw.mesh;
+        vk::DescriptorSet meshlets = GetBlockSet(m_meshletBlockSets, mesh.meshletRange);
+        if (meshlets != lastMeshlets)
+        {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *m_cullPipelineLayout, 0,
+                                   meshlets, nullptr);
+            lastMeshlets = meshlets;
+        }
+
+        vk::DescriptorSet indices = GetBlockSet(m_indexBlockSets, mesh.indexRange);
+        if (indices != lastIndices)
+        {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *m_cullPipelineLayout, 2,
+                                   indices, nullptr);
+            lastIndices = indices;
+        }
+
+        CullConstants constants;
+        constants.modelViewProj = projview * draw.model;
+        constants.cameraPosition = glm::inverse(draw.model) * cameraPosition;
+        constants.shortIndices = mesh.indexType == vk::IndexType::eUint16;
+        constants.firstIndex = static_cast<uint32_t>(
+            mesh.indexRange.offset / (constants.shortIndices ? 2 : 4));
+        uint32_t meshFirstMeshlet =
+            static_cast<uint32_t>(mesh.meshletRange.offset / sizeof(Meshlet));
+
+        uint32_t command = *draw.firstCommand;
+        for (const auto& submesh : draw.mesh->submeshes)
+        {
+            if (submesh.lod != draw.lod)
+                continue;
 
-            if (lastTextureSet != nullptr && drawData.material->textures)
+            constants.firstMeshlet = meshFirstMeshlet + submesh.firstMeshlet;
+            constants.command = command++;
+            if (submesh.meshletCount > 0)
             {
-                cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
-                                       *drawData.material->pipelineLayout, 1,
-                                       lastTextureSet->descriptor, nullptr);
+                cmd.pushConstants(*m_cullPipelineLayout, vk::ShaderStageFlagBits::eCompute,
+                                  0, sizeof(constants), &constants);
+                cmd.dispatch(submesh.meshletCount, 1, 1);
             }
+        }
+    }
+
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite,
+                              vk::AccessFlagBits::eIndexRead
+                              | vk::AccessFlagBits::eIndirectCommandRead);
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                        vk::PipelineStageFlagBits::eVertexInput
+                        | vk::PipelineStageFlagBits::eDrawIndirect,
+                        {}, barrier, nullptr, nullptr);
+}
+
+void MeshRenderer::WriteCmdBuffer(vk::CommandBuffer cmd, Engine& engine)
+{
+    m_stats = {};
+    m_stats.culled = m_culled;
+
+    TracyVkZone(engine.GetCurrentTracyContext(), cmd, "Meshes");
+    WriteDraws(cmd, engine, 0, m_order.size(), m_stats);
+
+    m_scene->WriteCmdBuffer(cmd, m_stats);
+    m_stats.sceneObjects = m_scene->GetObjectCount();
+    m_stats.sceneBatches = m_scene->GetBatchCount();
+}
+
+std::vector<vk::CommandBuffer> MeshRenderer::WriteSecondary(Engine& engine)
+{
+    ZoneScoped;
+    // Slices start at the first draw of an instance run and are not worth
+    // a job below a few hundred draws
+    constexpr std::size_t minDraws = 256;
+    std::size_t jobCount = std::clamp<std::size_t>(m_order.size() / minDraws, 1,
+                                                   engine.GetRecorderCount());
+    std::vector<std::size_t> bounds(jobCount + 1, m_order.size());
+    bounds[0] = 0;
+    for (std::size_t job = 1; job < jobCount; job++)
+    {
+        std::size_t i = std::max(bounds[job - 1], m_order.size() * job / jobCount);
+        while (i > 0 && i < m_order.size() &&
+               IsInstanceOf(m_toDraw[m_order[i]], m_toDraw[m_order[i - 1]]))
+            i++;
+        bounds[job] = i;
+    }
+
+    // Jobs are the batches of the parallel for, so each recorder is used
+    // by one thread. The GPU profiler is not thread safe, the slices are
+    // recorded without zones
+    std::vector<vk::CommandBuffer> buffers(jobCount);
+    std::vector<Stats> stats(jobCount);
+    ThreadPool::Global().ParallelFor(jobCount, 1, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t job = begin; job < end; job++)
+        {
+            ZoneScopedN("Record meshes");
+            buffers[job] = engine.BeginSecondary(job);
+            WriteDraws(buffers[job], engine, bounds[job], bounds[job + 1], stats[job]);
+            buffers[job].end();
+        }
+    });
+
+    m_stats = {};
+    m_stats.culled = m_culled;
+    for (const auto& job : stats)
+    {
+        m_stats.draws += job.draws;
+        m_stats.instances += job.instances;
+        m_stats.pipelineBinds += job.pipelineBinds;
+        m_stats.descriptorBinds += job.descriptorBinds;
+        m_stats.bufferBinds += job.bufferBinds;
+    }
+
+    if (m_scene->GetBatchCount() > 0)
+    {
+        auto sceneCmd = engine.BeginSecondary(0);
+        m_scene->WriteCmdBuffer(sceneCmd, m_stats);
+        sceneCmd.end();
+        buffers.push_back(sceneCmd);
+    }
+    m_stats.sceneObjects = m_scene->GetObjectCount();
+    m_stats.sceneBatches = m_scene->GetBatchCount();
 
+    return buffers;
+}
+
+void MeshRenderer::WriteDraws(vk::CommandBuffer cmd, Engine& engine, std::size_t begin,
+                              std::size_t end, Stats& stats) const
+{
+    Material::Ptr lastMaterial;
+    vk::Pipeline lastPipeline;
+    vk::Buffer lastVertexBuffer;
+    vk::Buffer lastIndexBuffer;
+    vk::IndexType lastIndexType = vk::IndexType::eUint32;
+    TextureSet::Ptr lastTextureSet;
+    const CullFrame* cullFrame = m_cullFrames.empty()
+        ? nullptr : &m_cullFrames[engine.GetCurrentFrame()];
+
+    uint32_t instanceCount;
+    for (std::size_t i = begin; i < end; i += instanceCount)
+    {
+        const auto& drawData = m_toDraw[m_order[i]];
+        instanceCount = 1;
+        while (i + instanceCount < end &&
+               IsInstanceOf(m_toDraw[m_order[i + instanceCount]], drawData))
+            instanceCount++;
+
+        vk::Pipeline pipeline = drawData.material->GetPipeline(drawData.mesh->vertexFormat);
+        if (pipeline != lastPipeline)
+        {
+            cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+            lastPipeline = pipeline;
+            stats.pipelineBinds++;
+        }
+
+        // Texture sets are bound again for a new material, its layout may
+        // differ from the previous one
+        if (drawData.material != lastMaterial)
+        {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                                   *drawData.material->pipelineLayout, 0,
+                                   engine.GetCurrentGlobalSet(), nullptr);
             lastMaterial = drawData.material;
+            lastTextureSet = nullptr;
+            stats.descriptorBinds++;
+        }
+
+        if (drawData.material->textures && drawData.textures &&
+            drawData.textures != lastTextureSet)
+        {
+            cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+                                   *drawData.material->pipelineLayout, 1,
+                                   drawData.textures->descriptor, nullptr);
+            lastTextureSet = drawData.textures;
+            stats.descriptorBinds++;
         }
+
         PushConstants constants;
-        constants.model = drawData.model;
+        constants.positionOffset = glm::vec4(drawData.mesh->positionOffset, 0.0f);
+        constants.positionScale = glm::vec4(drawData.mesh->positionScale, 0.0f);
+        if (drawData.firstCommand && !engine.HasDrawIndirectFirstInstance())
+            constants.firstInstance = drawData.instance;
 
         cmd.pushConstants(*drawData.material->pipelineLayout,
                           vk::ShaderStageFlagBits::eAllGraphics, 0, sizeof(constants), &constants);
 
-        if (drawData.mesh != lastMesh)
+        // Meshes share arena blocks, buffers only change between blocks
+        vk::Buffer vertexBuffer = drawData.mesh->vertexRange.buffer;
+        if (vertexBuffer != lastVertexBuffer)
         {
             vk::DeviceSize offset = 0;
-            vk::Buffer buffer = drawData.mesh->vertexBuffer.buffer;
-            cmd.bindVertexBuffers(0, buffer, offset);
-            cmd.bindIndexBuffer(drawData.mesh->indexBuffer.buffer, 0, vk::IndexType::eUint32);
-            lastMesh = drawData.mesh;
+            cmd.bindVertexBuffers(0, vertexBuffer, offset);
+            lastVertexBuffer = vertexBuffer;
+            stats.bufferBinds++;
         }
 
-        cmd.drawIndexed(drawData.mesh->indices.size(), 1, 0, 0, 0);
+        // Culled draws read the compacted 32 bit indices of this frame
+        vk::Buffer indexBuffer = drawData.firstCommand
+            ? cullFrame->indices.buffer : drawData.mesh->indexRange.buffer;
+        vk::IndexType indexType = drawData.firstCommand
+            ? vk::IndexType::eUint32 : drawData.mesh->indexType;
+        if (indexBuffer != lastIndexBuffer || indexType != lastIndexType)
+        {
+            cmd.bindIndexBuffer(indexBuffer, 0, indexType);
+            lastIndexBuffer = indexBuffer;
+            lastIndexType = indexType;
+            stats.bufferBinds++;
+        }
+
+        uint32_t command = drawData.firstCommand.value_or(0);
+        for (const auto& submesh : drawData.mesh->submeshes)
+        {
+            if (submesh.lod != drawData.lod)
+                continue;
+
+            if (drawData.firstCommand)
+            {
+                cmd.drawIndexedIndirect(cullFrame->commands.buffer,
+                                        command++ * sizeof(vk::DrawIndexedIndirectCommand),
+                                        1, sizeof(vk::DrawIndexedIndirectCommand));
+            }
+            else
+            {
+                cmd.drawIndexed(submesh.indexCount, instanceCount,
+                                drawData.mesh->baseIndex + submesh.firstIndex,
+                                drawData.mesh->baseVertex + submesh.vertexOffset, drawData.instance);
+            }
+            stats.draws++;
+            stats.instances += instanceCount;
+        }
     }
 }
 
@@ -726,4 +2526,7 @@ void TextureManager::Init()
 
     uint32_t ao_pixels[] {glm::packSnorm4x8({1, 1, 1, 1})};
     m_default_ao = NewFromPixels("default_ao", ao_pixels, 1, 1);
+
+    uint8_t orm_pixels[] {255, 128, 10, 255};
+    m_default_orm = NewFromPixels("default_orm", orm_pixels, 1, 1, vk::Format::eR8G8B8A8Unorm);
 }
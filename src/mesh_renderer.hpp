@@ -1,68 +1,80 @@
 #pragma once
 #include "engine.hpp"
+#include "vertex.hpp"
+#include "mesh_cache.hpp"
+#include "meshlet_builder.hpp"
+#include "texture_cache.hpp"
+#include "mip_generator.hpp"
+#include "frustum_culler.hpp"
 #include <filesystem>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <glm/glm.hpp>
 #include <ranges>
-#include <glm/gtx/hash.hpp>
+#include <optional>
+#include <functional>
+#include <future>
+#include <exception>
 
 struct PushConstants
 {
-    alignas(16) glm::mat4 model;
+    // Dequantization of packed vertex positions
+    alignas(16) glm::vec4 positionOffset;
+    alignas(16) glm::vec4 positionScale;
+    // Added to gl_InstanceIndex, for indirect draws that can not set
+    // firstInstance
+    uint32_t firstInstance = 0;
 };
 
-struct Vertex
+// Per draw data in the instance buffer, binding 2 of the global set
+struct InstanceData
 {
-    glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec3 color;
-    glm::vec2 textureCoord;
-    glm::vec4 tangent;
-
-    static std::array<vk::VertexInputAttributeDescription, 5>
-    AttributeDescriptions();
-
-    static vk::VertexInputBindingDescription BindingDescription();
-
-    bool operator==(const Vertex& other) const
-    {
-        return position == other.position
-            && normal == other.normal
-            && color == other.color
-            && textureCoord == other.textureCoord
-            && tangent == other.tangent;
-    }
+    alignas(16) glm::mat4 model;
 };
 
-inline void hash_combine(std::size_t& seed) { }
-
-template <typename T, typename... Rest>
-inline void hash_combine(std::size_t& seed, const T& v, Rest... rest) {
-    std::hash<T> hasher;
-    seed ^= hasher(v) + 0x9e3779b9 + (seed<<6) + (seed>>2);
-    hash_combine(seed, rest...);
-}
-
-
-namespace std {
-    template<> struct hash<Vertex> {
-        size_t operator()(Vertex const& vertex) const {
-            std::size_t seed = 31;
-            hash_combine(
-                seed, vertex.position, vertex.normal, vertex.color,
-                vertex.textureCoord, vertex.tangent);
-            return seed;
-                }
-    };
-}
-
+// Textures returned by TextureManager::LoadAsync have no image or view
+// until they are loaded
 struct Texture
 {
     using Ptr = std::shared_ptr<Texture>;
     AllocatedImage image;
     vk::UniqueImageView imageView;
     vk::UniqueSampler sampler;
+    uint32_t mipLevels = 1;
+    vk::Format format = vk::Format::eUndefined;
+    // Of the largest resident level
+    vk::Extent2D extent;
+    // Device memory of the image as allocated by VMA
+    vk::DeviceSize memorySize = 0;
+    // Frames wait for it on their own, poll it to know when the contents
+    // are there
+    UploadTicket upload;
+    // Frame that last drew with it, drives residency
+    uint64_t lastUsed = 0;
+};
+
+enum class TextureChannels
+{
+    Rgba,
+    Rg,
+    R
+};
+
+struct TextureLoadOptions
+{
+    // Full mip chain, blitted on the GPU when the format allows it and
+    // box filtered on the CPU otherwise
+    bool mipmaps = true;
+    // Keep only this many of the smallest levels, 0 keeps all of them.
+    // Larger levels are filtered away before upload
+    uint32_t residentMips = 0;
+    // Channels the shaders read, the rest are dropped on load. R and Rg
+    // textures are always linear
+    TextureChannels channels = TextureChannels::Rgba;
+    // Bake to BC7, BC5 or BC4 by channels and keep the result in the
+    // texture cache. Falls back to uncompressed when the device lacks BC
+    bool compress = false;
 };
 
 struct TextureSet
@@ -73,7 +85,74 @@ struct TextureSet
     Texture::Ptr specular;
     Texture::Ptr roughness;
     Texture::Ptr ao;
+    // Occlusion, roughness and specular in one texture, replaces the
+    // three separate maps
+    Texture::Ptr orm;
+    bool packed = false;
     vk::DescriptorSet descriptor;
+
+    void Touch(uint64_t frame)
+    {
+        for (auto* texture : {&albedo, &normal, &specular, &roughness, &ao, &orm})
+        {
+            if (*texture)
+                (*texture)->lastUsed = frame;
+        }
+    }
+};
+
+// Single channel maps merged by TextureManager::NewOrmFromFiles. Any of
+// them may be empty, the channel then takes the default texture value
+struct OrmSources
+{
+    std::filesystem::path occlusion;
+    std::filesystem::path roughness;
+    // Averaged to one linear value
+    std::filesystem::path specular;
+    // The roughness source holds gloss and is inverted
+    bool gloss = false;
+};
+
+// Textures loaded together by TextureManager::Load
+struct TextureBatch
+{
+    struct File
+    {
+        std::string name;
+        std::filesystem::path filename;
+        vk::Format view_format;
+        TextureLoadOptions options;
+    };
+
+    struct Orm
+    {
+        std::string name;
+        OrmSources sources;
+        TextureLoadOptions options;
+    };
+
+    void Add(const std::string& name, const std::filesystem::path& filename,
+             vk::Format view_format = vk::Format::eR8G8B8A8Srgb,
+             const TextureLoadOptions& options = {})
+    {
+        files.push_back({name, filename, view_format, options});
+    }
+
+    void AddOrm(const std::string& name, const OrmSources& sources,
+                const TextureLoadOptions& options = {})
+    {
+        orms.push_back({name, sources, options});
+    }
+
+    // Files come first, then packed textures
+    std::size_t Size() const { return files.size() + orms.size(); }
+    const std::string& Name(std::size_t i) const
+    {
+        return i < files.size() ? files[i].name : orms[i - files.size()].name;
+    }
+
+    std::vector<File> files;
+    std::vector<Orm> orms;
 };
 
 class TextureManager
@@ -82,16 +161,19 @@ public:
     explicit TextureManager(Engine& engine)
         : m_engine(engine)
     {}
+    ~TextureManager();
 
     void Init();
 
     Texture::Ptr NewFromFile(const std::string& name,
                              const std::filesystem::path& filename,
-                             vk::Format view_format = vk::Format::eR8G8B8A8Srgb);
+                             vk::Format view_format = vk::Format::eR8G8B8A8Srgb,
+                             const TextureLoadOptions& options = {});
 
     Texture::Ptr NewFromPixels(const std::string& name, void* pixel_ptr,
                                int texWidth, int texHeight,
-                               vk::Format view_format = vk::Format::eR8G8B8A8Srgb);
+                               vk::Format view_format = vk::Format::eR8G8B8A8Srgb,
+                               const TextureLoadOptions& options = {});
 
     TextureSet::Ptr NewTextureSet(
         Texture::Ptr albedo,
@@ -101,30 +183,215 @@ public:
         Texture::Ptr ao
         );
 
+    // Packs the sources into r, g and b of one linear texture
+    Texture::Ptr NewOrmFromFiles(const std::string& name,
+                                 const OrmSources& sources,
+                                 const TextureLoadOptions& options = {});
+
+    TextureSet::Ptr NewPackedTextureSet(
+        Texture::Ptr albedo,
+        Texture::Ptr normal,
+        Texture::Ptr orm
+        );
+
+    // Decodes and bakes the whole batch on the thread pool, then uploads
+    // it with a single staging buffer and submission
+    void Load(const TextureBatch& batch);
+    // Registers an empty texture under every name of the batch right away.
+    // The batch is prepared on the thread pool and Update fills the
+    // textures in once uploaded, texture sets show the defaults until then
+    void LoadAsync(TextureBatch batch);
+    // Uploads prepared batches and swaps in uploaded ones, call between
+    // frames
+    void Update();
+
     Texture::Ptr Get(const std::string& name) const
     {
         return m_textures.at(name);
     }
+
+    // Baked textures go next to their sources when this is not set
+    void SetCacheDirectory(const std::filesystem::path& directory)
+    {
+        m_cache.SetDirectory(directory);
+    }
+
+    // Textures over the budget lose their largest levels, least recently
+    // drawn first, and get them back from their sources once drawn again
+    // while there is room. 0 uses what the device has left for textures
+    void SetBudget(vk::DeviceSize budget) { m_budget = budget; }
+    vk::DeviceSize GetBudget() const;
+    vk::DeviceSize GetResidentBytes() const { return m_residentBytes; }
 private:
+    // Loaded texture that can be rebuilt from its source
+    struct Residency
+    {
+        // Batch of the texture alone
+        TextureBatch source;
+        uint32_t fullLevels = 1;
+        bool restoring = false;
+    };
+
+    // Texture ready for upload. Levels point into storage or into the
+    // mapped cache file
+    struct Prepared
+    {
+        vk::Format format = vk::Format::eUndefined;
+        std::vector<TextureCache::Level> levels;
+        // Levels past the prepared ones are blitted on the GPU
+        uint32_t levelCount = 0;
+        std::vector<std::vector<uint8_t>> storage;
+        MappedFile cached;
+    };
+
+    // Errors are kept per texture, in batch order
+    struct PreparedBatch
+    {
+        std::vector<Prepared> textures;
+        std::vector<std::exception_ptr> errors;
+    };
+
+    struct PendingBatch
+    {
+        std::vector<Texture::Ptr> handles;
+        TextureBatch batch;
+        std::future<PreparedBatch> prepared;
+        // Uploaded textures by handle, empty until the batch is prepared
+        std::vector<Texture::Ptr> loaded;
+        UploadTicket upload;
+        // Brings back levels of resident textures instead of loading new ones
+        bool restore = false;
+    };
+
+    PreparedBatch PrepareBatch(const TextureBatch& batch) const;
+
+    // Prepare functions only work on the CPU and may run on any thread
+    Prepared PrepareFile(const std::filesystem::path& filename,
+                         vk::Format view_format,
+                         const TextureLoadOptions& options) const;
+    Prepared PrepareOrm(const std::string& name,
+                        const OrmSources& sources,
+                        const TextureLoadOptions& options) const;
+    Prepared PreparePixels(MipGenerator::Level image,
+                           vk::Format view_format,
+                           const TextureLoadOptions& options) const;
+    // Levels may reference the texels, which then have to outlive the upload
+    Prepared PreparePixels(const TextureCache::Level& image,
+                           vk::Format view_format,
+                           const TextureLoadOptions& options) const;
+    // Loads the baked texture from the cache, decode gives RGBA texels to
+    // bake on a miss
+    Prepared PrepareCompressed(const std::filesystem::path& cacheSource,
+                               uint64_t sourceHash,
+                               vk::Format view_format,
+                               const TextureLoadOptions& options,
+                               const std::function<MipGenerator::Level()>& decode) const;
+    std::optional<vk::Format> CompressedFormatFor(vk::Format view_format,
+                                                  const TextureLoadOptions& options) const;
+
+    std::vector<Texture::Ptr> Upload(std::span<Prepared> textures);
+    void CreateImage(Texture& texture);
+    void CreateView(Texture& texture) const;
+
+    PendingBatch& Enqueue(TextureBatch batch);
+    void Track(const std::string& name, TextureBatch source, const Texture& texture);
+    void UpdateResidency(std::unordered_set<const Texture*>& changed);
+    // Copies all but the dropped largest levels into a new image, recorded
+    // into the open upload batch
+    Texture Downgrade(const Texture& texture, uint32_t dropped);
+    // The old contents are released once frames in flight are done
+    void Replace(Texture& texture, Texture&& replacement);
+    // Sets that use the textures get new descriptors
+    void RewriteSets(const std::unordered_set<const Texture*>& changed);
+
+    void WriteTextureSet(TextureSet& set);
+
     std::unordered_map<std::string, Texture::Ptr> m_textures;
+    std::unordered_map<std::string, Residency> m_residency;
+    std::vector<PendingBatch> m_pending;
+    std::vector<std::weak_ptr<TextureSet>> m_sets;
+    vk::DeviceSize m_budget = 0;
+    vk::DeviceSize m_residentBytes = 0;
+    // Heap that texture images are allocated from
+    uint32_t m_textureHeap = 0;
+    TextureCache m_cache;
     Texture::Ptr m_default_albedo;
     Texture::Ptr m_default_normal;
     Texture::Ptr m_default_specular;
     Texture::Ptr m_default_roughness;
     Texture::Ptr m_default_ao;
+    Texture::Ptr m_default_orm;
     Engine& m_engine;
 };
 
 struct Mesh
 {
     using Ptr = std::shared_ptr<Mesh>;
-    AllocatedBuffer vertexBuffer;
-    AllocatedBuffer indexBuffer;
+    // Ranges of the engine's geometry arenas
+    GeometryRange vertexRange;
+    GeometryRange indexRange;
+    // Position of the ranges in vertices and indices, added to the offsets
+    // of submeshes when drawing
+    int32_t baseVertex = 0;
+    uint32_t baseIndex = 0;
+    // Of the uploaded geometry, the CPU copies may be gone
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    // CPU copies as kept by MeshImportOptions::retention
     std::vector<uint32_t> indices;
     std::vector<Vertex> vertices;
-    glm::vec3 surfaceCenter;
-    glm::vec3 min;
-    glm::vec3 max;
+    std::vector<glm::vec3> positions;
+    glm::vec3 surfaceCenter {0};
+    glm::vec3 min {0};
+    glm::vec3 max {0};
+    // Bounding sphere, tighter than the one around the bounds
+    glm::vec3 sphereCenter {0};
+    float sphereRadius = 0.0f;
+    VertexFormat vertexFormat = VertexFormat::Full;
+    glm::vec3 positionOffset {0};
+    glm::vec3 positionScale {1};
+    vk::IndexType indexType = vk::IndexType::eUint32;
+    std::vector<Submesh> submeshes;
+    // Largest error of every level of detail, finest first
+    std::vector<float> lodErrors;
+    // Culled on the GPU when not empty, see MeshRenderer::Cull
+    std::vector<Meshlet> meshlets;
+    // Range of the engine's meshlet arena
+    GeometryRange meshletRange;
+};
+
+// What a mesh keeps of its geometry on the CPU once uploaded
+enum class MeshRetention
+{
+    Drop,
+    Keep,
+    // Positions and indices, for picking and collision
+    Positions
+};
+
+struct MeshImportOptions
+{
+    // See ObjLoadOptions
+    float weldEpsilon = 0.0f;
+    // Reorder for the post transform cache, overdraw and vertex fetch
+    bool optimize = false;
+    // Format of the GPU vertex buffer, the cache always keeps full vertices
+    VertexFormat vertexFormat = VertexFormat::Full;
+    // Split meshes with more than 65536 vertices into submeshes so they can
+    // use 16 bit indices too
+    bool split16 = false;
+    // Levels of detail including the full mesh, each one keeping
+    // lodReduction of the triangles of the previous
+    uint32_t lodCount = 1;
+    float lodReduction = 0.5f;
+    // Build meshlets of every submesh for GPU cone and frustum culling
+    bool meshlets = false;
+    // Does not change the imported mesh, so it is not part of the hash
+    MeshRetention retention = MeshRetention::Keep;
+
+    // Seed for the cache key, entries imported with different options
+    // must not alias
+    uint64_t Hash() const;
 };
 
 class MeshManager
@@ -133,17 +400,61 @@ public:
     explicit MeshManager(Engine& engine)
         : m_engine(engine)
     {}
+    ~MeshManager();
 
-    Mesh::Ptr NewFromObj(const std::string& name, const std::filesystem::path& filename);
+    Mesh::Ptr NewFromObj(const std::string& name, const std::filesystem::path& filename,
+                         const MeshImportOptions& options = {});
     Mesh::Ptr NewFromVertices(const std::string& name,
-                              std::vector<Vertex>, std::vector<uint32_t>);
+                              std::vector<Vertex>, std::vector<uint32_t>,
+                              const MeshImportOptions& options = {});
+
+    // Returns an empty mesh right away. The import runs on the thread pool
+    // and Update fills the mesh in once its upload has finished
+    Mesh::Ptr LoadObjAsync(const std::string& name, const std::filesystem::path& filename,
+                           const MeshImportOptions& options = {});
+    // Uploads finished imports and swaps in uploaded ones, call between
+    // frames
+    void Update();
 
     Mesh::Ptr Get(const std::string& name) const
     {
         return m_meshes.at(name);
     }
+
+    void SetCacheDirectory(const std::filesystem::path& directory)
+    {
+        m_cache.SetDirectory(directory);
+    }
 private:
+    struct Pending
+    {
+        Mesh::Ptr handle;
+        std::string name;
+        MeshImportOptions options;
+        std::future<Mesh::Ptr> imported;
+        Mesh::Ptr loaded;
+        UploadTicket upload;
+    };
+
+    // Import functions only work on the CPU and may run on any thread
+    Mesh::Ptr ImportObj(const std::string& name, const std::filesystem::path& filename,
+                        const MeshImportOptions& options) const;
+    static Mesh::Ptr FromCache(const MeshCache::Entry&);
+    Mesh::Ptr Process(std::vector<Vertex> vertices, std::vector<uint32_t> indices,
+                      const MeshImportOptions& options) const;
+    void Upload(Mesh& mesh, const MeshImportOptions& options);
+    void UploadVertices(Mesh& mesh, std::span<const Vertex> vertices, VertexFormat format);
+    void UploadIndices(Mesh& mesh, std::span<const uint32_t> indices);
+    void GenerateLods(Mesh& mesh, std::span<const Vertex> vertices,
+                      std::vector<uint32_t>& indices, const MeshImportOptions& options) const;
+    static void SetSubmeshes(Mesh& mesh, std::vector<Submesh> submeshes);
+    static void BuildMeshlets(Mesh& mesh, std::span<const Vertex> vertices,
+                              std::span<const uint32_t> indices);
+    void UploadMeshlets(Mesh& mesh);
+
     std::unordered_map<std::string, Mesh::Ptr> m_meshes;
+    std::vector<Pending> m_pending;
+    MeshCache m_cache;
     Engine& m_engine;
 };
 
@@ -151,8 +462,18 @@ struct Material
 {
     using Ptr = std::shared_ptr<Material>;
     vk::UniquePipelineLayout pipelineLayout;
-    vk::UniquePipeline pipeline;
+    std::array<vk::UniquePipeline, VertexFormatCount> pipelines;
     bool textures = true;
+    // Expects a packed texture set, see TextureManager::NewPackedTextureSet
+    bool packed = false;
+    VertexAttributes attributes = VertexAttribute::All;
+    // Materials of lower passes draw first, 0 to 3
+    uint8_t pass = 0;
+
+    vk::Pipeline GetPipeline(VertexFormat format) const
+    {
+        return *pipelines[static_cast<std::size_t>(format)];
+    }
 };
 
 class MaterialManager
@@ -163,11 +484,19 @@ public:
     {}
     Material::Ptr FromShaders(const std::string& name,
                               const std::filesystem::path& vertex,
-                              const std::filesystem::path& fragment);
+                              const std::filesystem::path& fragment,
+                              VertexAttributes attributes = VertexAttribute::All);
 
     Material::Ptr Textureless(const std::string& name,
                               const std::filesystem::path& vertex,
-                              const std::filesystem::path& fragment);
+                              const std::filesystem::path& fragment,
+                              VertexAttributes attributes = VertexAttribute::All);
+
+    // Fragment shader is compiled with PACKED_ORM defined
+    Material::Ptr PackedTextures(const std::string& name,
+                                 const std::filesystem::path& vertex,
+                                 const std::filesystem::path& fragment,
+                                 VertexAttributes attributes = VertexAttribute::All);
     Material::Ptr Get(const std::string& name) const {
         return m_materials.at(name);
     }
@@ -193,22 +522,79 @@ private:
     Material::Ptr Create(const std::string& name,
                          const std::filesystem::path& vertex,
                          const std::filesystem::path& fragment,
-                         bool textures = true);
+                         VertexAttributes attributes,
+                         bool textures = true,
+                         bool packed = false);
 
     Engine& m_engine;
 };
 
+class GpuScene;
+
 class MeshRenderer
 {
 public:
-    void Init(Engine& m_engine);
+    using ObjectId = uint32_t;
+
+    MeshRenderer();
+    ~MeshRenderer();
+
+    // Level of detail picked for an object last frame, kept by the caller
+    struct LodState
+    {
+        uint32_t level = 0;
+    };
+
+    void Init(Engine& engine);
     void Begin();
-    void Add(Mesh::Ptr mesh, Material::Ptr material, TextureSet::Ptr textures, glm::mat4 model)
+    void Add(Mesh::Ptr mesh, Material::Ptr material, TextureSet::Ptr textures, glm::mat4 model,
+             LodState* lod = nullptr)
     {
-        m_toDraw.push_back({model, material, mesh, textures});
+        // Meshes still streaming in have nothing to draw yet
+        if (mesh->submeshes.empty())
+            return;
+        m_toDraw.push_back({model, material, mesh, textures, lod});
     }
+    // Drops draws outside the view frustum, picks levels of detail and
+    // sorts the rest by state, then front to back
     void End();
+
+    // Objects that stay until removed, culled and drawn on the GPU, see
+    // GpuScene. Suited for many static objects
+    ObjectId AddObject(Mesh::Ptr mesh, Material::Ptr material, TextureSet::Ptr textures,
+                       const glm::mat4& model);
+    void SetTransform(ObjectId id, const glm::mat4& model);
+    void RemoveObject(ObjectId id);
+
+    // Writes this frame's instance buffer and culls meshlets of the added
+    // meshes into its index buffer, must be recorded before the render
+    // pass begins
+    void Cull(vk::CommandBuffer cmd, Engine&);
     void WriteCmdBuffer(vk::CommandBuffer cmd, Engine&);
+    // Records the same draws into secondary command buffers of the scene
+    // pass, slices of the draw list in parallel on the thread pool. They
+    // are to be executed in order
+    std::vector<vk::CommandBuffer> WriteSecondary(Engine&);
+
+    // Recorded by the last WriteCmdBuffer
+    struct Stats
+    {
+        uint32_t draws = 0;
+        uint32_t instances = 0;
+        uint32_t pipelineBinds = 0;
+        uint32_t descriptorBinds = 0;
+        uint32_t bufferBinds = 0;
+        // Draws dropped by End
+        uint32_t culled = 0;
+        uint32_t sceneObjects = 0;
+        uint32_t sceneBatches = 0;
+    };
+    const Stats& GetStats() const { return m_stats; }
+
+    // Largest simplification error allowed on screen, in pixels
+    float lodThreshold = 1.0f;
+    bool frustumCulling = true;
+    bool meshletCulling = true;
 private:
     struct ToDraw
     {
@@ -216,7 +602,65 @@ private:
         Material::Ptr material;
         Mesh::Ptr mesh;
         TextureSet::Ptr textures;
+        LodState* lodState = nullptr;
+        uint32_t lod = 0;
+        // Position in this frame's instance buffer
+        uint32_t instance = 0;
+        // First indirect command of the culled submeshes, if culled
+        std::optional<uint32_t> firstCommand;
+    };
+
+    // Model matrices of all draws in drawing order, one per frame in flight
+    struct InstanceFrame
+    {
+        AllocatedBuffer instances;
+        vk::DeviceSize capacity = 0;
     };
 
+    // Culling output, one per frame in flight
+    struct CullFrame
+    {
+        AllocatedBuffer indices;
+        vk::DeviceSize indexCapacity = 0;
+        AllocatedBuffer commands;
+        vk::DeviceSize commandCapacity = 0;
+        vk::DescriptorSet descriptor;
+    };
+
+    void ReserveCullFrame(CullFrame& frame, vk::DeviceSize indexCount,
+                          vk::DeviceSize commandCount);
+    void WriteInstances(Engine& engine);
+    // Draws of m_order in [begin, end), which must not split instances
+    void WriteDraws(vk::CommandBuffer cmd, Engine& engine, std::size_t begin,
+                    std::size_t end, Stats& stats) const;
+    // Set binding the whole arena block of the range, made on first use
+    vk::DescriptorSet GetBlockSet(std::vector<vk::DescriptorSet>& sets,
+                                  const GeometryRange& range);
+    // Following draws that can be instances of the first one
+    static bool IsInstanceOf(const ToDraw& draw, const ToDraw& first);
+
+    // Tests world space bounding spheres of the draws against the frustum
+    // and removes the ones outside
+    void FrustumCull(const glm::mat4& projview);
+    uint32_t SelectLod(const ToDraw& draw, const glm::vec3& cameraPosition,
+                       float pixelsPerUnit) const;
+
     std::vector<ToDraw> m_toDraw;
+    // Indices of m_toDraw in drawing order
+    std::vector<uint32_t> m_order;
+    Stats m_stats;
+    uint32_t m_culled = 0;
+    SphereList m_spheres;
+    std::vector<uint8_t> m_visible;
+    Engine* m_engine = nullptr;
+
+    vk::UniqueDescriptorSetLayout m_cullSetLayout;
+    vk::UniquePipelineLayout m_cullPipelineLayout;
+    vk::UniquePipeline m_cullPipeline;
+    std::vector<CullFrame> m_cullFrames;
+    // Meshlet and index arena blocks read by meshlet culling, by block
+    std::vector<vk::DescriptorSet> m_meshletBlockSets;
+    std::vector<vk::DescriptorSet> m_indexBlockSets;
+    std::vector<InstanceFrame> m_instanceFrames;
+    std::unique_ptr<GpuScene> m_scene;
 };
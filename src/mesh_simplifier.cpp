@@ -0,0 +1,303 @@
+#include "mesh_simplifier.hpp"
+#include "vertex_welder.hpp"
+#include <Tracy.hpp>
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <unordered_map>
+
+namespace {
+    struct Quadric
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+        double b0 = 0, b1 = 0, b2 = 0;
+        double c = 0;
+        double weight = 0;
+
+        // Squared distance to the plane n.p + d = 0, scaled by weight
+        static Quadric FromPlane(double nx, double ny, double nz, double d, double weight)
+        {
+            Quadric result;
+            result.a00 = weight * nx * nx;
+            result.a01 = weight * nx * ny;
+            result.a02 = weight * nx * nz;
+            result.a11 = weight * ny * ny;
+            result.a12 = weight * ny * nz;
+            result.a22 = weight * nz * nz;
+            result.b0 = weight * nx * d;
+            result.b1 = weight * ny * d;
+            result.b2 = weight * nz * d;
+            result.c = weight * d * d;
+            result.weight = weight;
+            return result;
+        }
+
+        Quadric& operator+=(const Quadric& other)
+        {
+            a00 += other.a00; a01 += other.a01; a02 += other.a02;
+            a11 += other.a11; a12 += other.a12; a22 += other.a22;
+            b0 += other.b0; b1 += other.b1; b2 += other.b2;
+            c += other.c;
+            weight += other.weight;
+            return *this;
+        }
+
+        double Error(const glm::vec3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double result = a00 * x * x + a11 * y * y + a22 * z * z
+                + 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                + 2 * (b0 * x + b1 * y + b2 * z) + c;
+            return std::max(result, 0.0);
+        }
+    };
+
+    struct PositionKey
+    {
+        uint32_t x, y, z;
+
+        bool operator==(const PositionKey&) const = default;
+    };
+
+    struct PositionKeyHash
+    {
+        std::size_t operator()(const PositionKey& key) const
+        {
+            return WeldMix(WeldMix(WeldMix(0, key.x), key.y), key.z);
+        }
+    };
+
+    struct Collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        double cost;
+        // Average squared distance to the merged planes
+        double distance;
+    };
+
+    // Vertex to triangle adjacency of the current index buffer
+    struct Adjacency
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+
+        void Build(std::span<const uint32_t> indices, std::size_t vertexCount)
+        {
+            offsets.assign(vertexCount + 1, 0);
+            triangles.resize(indices.size());
+
+            for (uint32_t index : indices)
+                offsets[index + 1]++;
+
+            for (std::size_t i = 0; i < vertexCount; i++)
+                offsets[i + 1] += offsets[i];
+
+            std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+            for (std::size_t i = 0; i < indices.size(); i++)
+                triangles[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    };
+}
+
+MeshSimplifier::Result MeshSimplifier::Simplify(std::span<const Vertex> vertices,
+                                                std::span<const uint32_t> indices,
+                                                std::size_t targetIndexCount)
+{
+    ZoneScoped;
+    Result result;
+    result.indices.assign(indices.begin(), indices.begin() + indices.size() / 3 * 3);
+    std::size_t vertexCount = vertices.size();
+
+    // Vertices sharing a position, more than one means a seam
+    std::vector<uint32_t> positionIds(vertexCount);
+    std::vector<uint32_t> positionUses;
+    {
+        VertexWelder<PositionKey, PositionKeyHash> welder(vertexCount);
+        for (std::size_t i = 0; i < vertexCount; i++)
+        {
+            const glm::vec3& p = vertices[i].position;
+            PositionKey key {std::bit_cast<uint32_t>(p.x), std::bit_cast<uint32_t>(p.y),
+                             std::bit_cast<uint32_t>(p.z)};
+            auto [id, inserted] = welder.Insert(key, static_cast<uint32_t>(positionUses.size()));
+            if (inserted)
+                positionUses.push_back(0);
+            positionIds[i] = id;
+            positionUses[id]++;
+        }
+    }
+
+    // Edges not shared by exactly two triangles are borders or non manifold
+    std::unordered_map<uint64_t, uint32_t> edges;
+    edges.reserve(result.indices.size());
+    auto edgeKey = [&](uint32_t a, uint32_t b) {
+        uint64_t pa = positionIds[a];
+        uint64_t pb = positionIds[b];
+        return pa < pb ? (pa << 32 | pb) : (pb << 32 | pa);
+    };
+
+    for (std::size_t i = 0; i < result.indices.size(); i += 3)
+    {
+        for (int k = 0; k < 3; k++)
+            edges[edgeKey(result.indices[i + k], result.indices[i + (k + 1) % 3])]++;
+    }
+
+    std::vector<uint8_t> locked(vertexCount, 0);
+    std::vector<Quadric> quadrics(vertexCount);
+    for (std::size_t i = 0; i < vertexCount; i++)
+        locked[i] = positionUses[positionIds[i]] > 1;
+
+    for (std::size_t i = 0; i < result.indices.size(); i += 3)
+    {
+        uint32_t v[3] = {result.indices[i], result.indices[i + 1], result.indices[i + 2]};
+        for (int k = 0; k < 3; k++)
+        {
+            if (edges[edgeKey(v[k], v[(k + 1) % 3])] != 2)
+            {
+                locked[v[k]] = 1;
+                locked[v[(k + 1) % 3]] = 1;
+            }
+        }
+
+        glm::vec3 p0 = vertices[v[0]].position;
+        glm::vec3 normal = glm::cross(vertices[v[1]].position - p0, vertices[v[2]].position - p0);
+        float length = glm::length(normal);
+        if (!(length > 0.0f))
+            continue;
+
+        normal /= length;
+        Quadric quadric = Quadric::FromPlane(normal.x, normal.y, normal.z,
+                                             -glm::dot(normal, p0), 0.5 * length);
+        for (uint32_t vertex : v)
+            quadrics[vertex] += quadric;
+    }
+
+    auto isDegenerate = [&](const uint32_t* triangle) {
+        return positionIds[triangle[0]] == positionIds[triangle[1]]
+            || positionIds[triangle[1]] == positionIds[triangle[2]]
+            || positionIds[triangle[0]] == positionIds[triangle[2]];
+    };
+
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<uint8_t> touched(vertexCount);
+    Adjacency adjacency;
+    double maxDistance = 0;
+
+    while (result.indices.size() > targetIndexCount)
+    {
+        collapses.clear();
+        for (std::size_t i = 0; i < result.indices.size(); i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t a = result.indices[i + k];
+                uint32_t b = result.indices[i + (k + 1) % 3];
+
+                Quadric quadric = quadrics[a];
+                quadric += quadrics[b];
+
+                double weight = std::max(quadric.weight, 1e-12);
+                if (!locked[a])
+                {
+                    double cost = quadric.Error(vertices[b].position);
+                    collapses.push_back({a, b, cost, cost / weight});
+                }
+                if (!locked[b])
+                {
+                    double cost = quadric.Error(vertices[a].position);
+                    collapses.push_back({b, a, cost, cost / weight});
+                }
+            }
+        }
+
+        std::ranges::sort(collapses, {}, &Collapse::cost);
+        adjacency.Build(result.indices, vertexCount);
+
+        for (std::size_t i = 0; i < vertexCount; i++)
+            remap[i] = static_cast<uint32_t>(i);
+        std::ranges::fill(touched, 0);
+
+        std::size_t triangleCount = result.indices.size() / 3;
+        std::size_t targetTriangles = targetIndexCount / 3;
+        std::size_t applied = 0;
+
+        for (const Collapse& collapse : collapses)
+        {
+            if (triangleCount <= targetTriangles)
+                break;
+
+            if (touched[collapse.from] || touched[collapse.to])
+                continue;
+
+            // Reject collapses folding any of the remaining triangles over
+            bool flips = false;
+            const glm::vec3& target = vertices[collapse.to].position;
+            for (uint32_t j = adjacency.offsets[collapse.from];
+                 j < adjacency.offsets[collapse.from + 1] && !flips; j++)
+            {
+                const uint32_t* triangle = &result.indices[3 * adjacency.triangles[j]];
+                if (positionIds[triangle[0]] == positionIds[collapse.to]
+                    || positionIds[triangle[1]] == positionIds[collapse.to]
+                    || positionIds[triangle[2]] == positionIds[collapse.to])
+                {
+                    continue;
+                }
+
+                glm::vec3 before[3];
+                glm::vec3 after[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    before[k] = vertices[triangle[k]].position;
+                    after[k] = triangle[k] == collapse.from ? target : before[k];
+                }
+
+                glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                // Also reject turns of more than about 75 degrees
+                flips = glm::dot(normalBefore, normalAfter)
+                    <= 0.25f * glm::length(normalBefore) * glm::length(normalAfter);
+            }
+
+            if (flips)
+                continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to] += quadrics[collapse.from];
+            maxDistance = std::max(maxDistance, collapse.distance);
+
+            touched[collapse.from] = 1;
+            touched[collapse.to] = 1;
+            for (uint32_t j = adjacency.offsets[collapse.from];
+                 j < adjacency.offsets[collapse.from + 1]; j++)
+            {
+                const uint32_t* triangle = &result.indices[3 * adjacency.triangles[j]];
+                touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+            }
+
+            // An interior collapse removes the two triangles of the edge
+            triangleCount -= 2;
+            applied++;
+        }
+
+        if (applied == 0)
+            break;
+
+        std::size_t output = 0;
+        for (std::size_t i = 0; i < result.indices.size(); i += 3)
+        {
+            uint32_t triangle[3] = {remap[result.indices[i]], remap[result.indices[i + 1]],
+                                    remap[result.indices[i + 2]]};
+            if (isDegenerate(triangle))
+                continue;
+
+            result.indices[output++] = triangle[0];
+            result.indices[output++] = triangle[1];
+            result.indices[output++] = triangle[2];
+        }
+        result.indices.resize(output);
+    }
+
+    result.error = static_cast<float>(std::sqrt(maxDistance));
+    return result;
+}
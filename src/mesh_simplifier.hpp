@@ -0,0 +1,23 @@
+#pragma once
+#include "vertex.hpp"
+#include <span>
+#include <vector>
+
+// Quadric error metric simplification (Garland and Heckbert) by half edge
+// collapses, so no new vertices are created and the vertex buffer can be
+// shared between levels of detail. Vertices on open borders and on UV or
+// normal seams, where one position has several vertices, are never moved
+class MeshSimplifier
+{
+public:
+    struct Result
+    {
+        std::vector<uint32_t> indices;
+        // Largest collapse error in object space units
+        float error = 0.0f;
+    };
+
+    static Result Simplify(std::span<const Vertex> vertices,
+                           std::span<const uint32_t> indices,
+                           std::size_t targetIndexCount);
+};
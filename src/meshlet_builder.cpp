@@ -0,0 +1,131 @@
+#include "meshlet_builder.hpp"
+#include <Tracy.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+    glm::vec3 TriangleNormal(std::span<const Vertex> vertices, const uint32_t* triangle)
+    {
+        glm::vec3 p0 = vertices[triangle[0]].position;
+        return glm::cross(vertices[triangle[1]].position - p0, vertices[triangle[2]].position - p0);
+    }
+
+    Meshlet ComputeBounds(std::span<const Vertex> vertices, std::span<const uint32_t> indices,
+                          uint32_t firstIndex)
+    {
+        Meshlet result {};
+        result.firstIndex = firstIndex;
+        result.triangleCount = static_cast<uint32_t>(indices.size() / 3);
+
+        glm::vec3 min(std::numeric_limits<float>::max());
+        glm::vec3 max(std::numeric_limits<float>::lowest());
+        for (uint32_t index : indices)
+        {
+            min = glm::min(min, vertices[index].position);
+            max = glm::max(max, vertices[index].position);
+        }
+
+        result.center = (min + max) * 0.5f;
+        for (uint32_t index : indices)
+        {
+            result.radius = std::max(result.radius,
+                                     glm::length(vertices[index].position - result.center));
+        }
+
+        glm::vec3 normalSum(0.0f);
+        for (std::size_t i = 0; i < indices.size(); i += 3)
+        {
+            glm::vec3 normal = TriangleNormal(vertices, &indices[i]);
+            float length = glm::length(normal);
+            if (length > 0.0f)
+                normalSum += normal / length;
+        }
+
+        // A cutoff of 1 never culls
+        result.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+        result.coneCutoff = 1.0f;
+
+        float sumLength = glm::length(normalSum);
+        if (!(sumLength > 0.0f))
+            return result;
+
+        glm::vec3 axis = normalSum / sumLength;
+        float minDot = 1.0f;
+        for (std::size_t i = 0; i < indices.size(); i += 3)
+        {
+            glm::vec3 normal = TriangleNormal(vertices, &indices[i]);
+            float length = glm::length(normal);
+            if (length > 0.0f)
+                minDot = std::min(minDot, glm::dot(axis, normal / length));
+        }
+
+        result.coneAxis = axis;
+        // Normals spread over a half sphere or more can not be back facing
+        // all at once
+        if (minDot > 0.0f)
+            result.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+
+        return result;
+    }
+}
+
+std::vector<Meshlet> MeshletBuilder::Build(std::span<const Vertex> vertices,
+                                           std::span<const uint32_t> indices,
+                                           uint32_t firstIndex)
+{
+    ZoneScoped;
+    std::vector<Meshlet> result;
+
+    // Vertices are marked with the number of the meshlet using them
+    std::vector<uint32_t> stamps(vertices.size(), 0);
+    uint32_t stamp = 1;
+
+    std::size_t begin = 0;
+    uint32_t vertexCount = 0;
+    glm::vec3 normalSum(0.0f);
+
+    auto flush = [&](std::size_t end) {
+        result.push_back(ComputeBounds(vertices, indices.subspan(begin, end - begin),
+                                       firstIndex + static_cast<uint32_t>(begin)));
+        begin = end;
+        vertexCount = 0;
+        normalSum = glm::vec3(0.0f);
+        stamp++;
+    };
+
+    std::size_t triangleIndices = indices.size() / 3 * 3;
+    for (std::size_t i = 0; i < triangleIndices; i += 3)
+    {
+        const uint32_t* triangle = &indices[i];
+        uint32_t newVertices = 0;
+        for (int k = 0; k < 3; k++)
+            newVertices += stamps[triangle[k]] != stamp;
+
+        glm::vec3 normal = TriangleNormal(vertices, triangle);
+        uint32_t triangleCount = static_cast<uint32_t>((i - begin) / 3);
+
+        // Past a quarter of the budget also stop at triangles facing away
+        // from the meshlet, wide cones would never be culled
+        bool full = vertexCount + newVertices > s_maxVertices || triangleCount == s_maxTriangles;
+        bool turns = triangleCount >= s_maxTriangles / 4 && glm::dot(normal, normalSum) < 0.0f;
+        if (i != begin && (full || turns))
+        {
+            flush(i);
+            newVertices = 3;
+        }
+
+        for (int k = 0; k < 3; k++)
+            stamps[triangle[k]] = stamp;
+        vertexCount += newVertices;
+
+        float length = glm::length(normal);
+        if (length > 0.0f)
+            normalSum += normal / length;
+    }
+
+    if (begin < triangleIndices)
+        flush(triangleIndices);
+
+    return result;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "vertex.hpp"
+#include <span>
+#include <vector>
+
+// Cluster of consecutive triangles of the index buffer with bounds for GPU
+// culling. Matches the std430 layout of the culling shader
+struct Meshlet
+{
+    glm::vec3 center;
+    float radius;
+    // Every triangle of the meshlet is back facing when
+    // dot(center - camera, coneAxis) >= coneCutoff * |center - camera| + radius
+    glm::vec3 coneAxis;
+    float coneCutoff;
+    uint32_t firstIndex;
+    uint32_t triangleCount;
+    uint32_t padding[2];
+};
+
+// Splits index ranges into meshlets without reordering them, so an index
+// buffer already optimized for the vertex cache keeps its order and the
+// meshlets stay spatially coherent
+class MeshletBuilder
+{
+public:
+    static constexpr uint32_t s_maxVertices = 64;
+    static constexpr uint32_t s_maxTriangles = 124;
+
+    // Indices are relative to vertices, firstIndex is the position of the
+    // range in the whole index buffer
+    static std::vector<Meshlet> Build(std::span<const Vertex> vertices,
+                                      std::span<const uint32_t> indices,
+                                      uint32_t firstIndex);
+};
@@ -0,0 +1,102 @@
+#include "mip_generator.hpp"
+#include "thread_pool.hpp"
+#include <Tracy.hpp>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+
+namespace {
+    struct SrgbTables
+    {
+        std::array<float, 256> decode;
+        // Linear values halfway between consecutive codes
+        std::array<float, 255> thresholds;
+
+        SrgbTables()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                decode[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            for (int i = 0; i < 255; i++)
+                thresholds[i] = (decode[i] + decode[i + 1]) * 0.5f;
+        }
+
+        uint8_t Encode(float linear) const
+        {
+            return static_cast<uint8_t>(
+                std::upper_bound(thresholds.begin(), thresholds.end(), linear) - thresholds.begin());
+        }
+    };
+
+    const SrgbTables& Srgb()
+    {
+        static const SrgbTables tables;
+        return tables;
+    }
+}
+
+uint32_t MipGenerator::LevelCount(uint32_t width, uint32_t height)
+{
+    return std::bit_width(std::max({width, height, 1u}));
+}
+
+MipGenerator::Level MipGenerator::Downsample(std::span<const uint8_t> texels,
+                                             uint32_t width, uint32_t height,
+                                             uint32_t channels, TexelEncoding encoding)
+{
+    ZoneScoped;
+    Level result;
+    result.width = std::max(width / 2, 1u);
+    result.height = std::max(height / 2, 1u);
+    result.texels.resize(std::size_t(result.width) * result.height * channels);
+
+    const SrgbTables& srgb = Srgb();
+    std::size_t rowSize = std::size_t(width) * channels;
+    std::size_t outputRowSize = std::size_t(result.width) * channels;
+
+    auto& pool = ThreadPool::Global();
+    pool.ParallelFor(result.height, std::max<std::size_t>(1, pool.BatchSize(result.height, 16)),
+                     [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t y = begin; y < end; y++)
+        {
+            const uint8_t* row0 = texels.data() + std::min<std::size_t>(2 * y, height - 1) * rowSize;
+            const uint8_t* row1 = texels.data() + std::min<std::size_t>(2 * y + 1, height - 1) * rowSize;
+            uint8_t* output = result.texels.data() + y * outputRowSize;
+
+            for (std::size_t x = 0; x < result.width; x++)
+            {
+                std::size_t x0 = std::min<std::size_t>(2 * x, width - 1) * channels;
+                std::size_t x1 = std::min<std::size_t>(2 * x + 1, width - 1) * channels;
+
+                for (uint32_t c = 0; c < channels; c++)
+                {
+                    uint8_t* texel = output + x * channels + c;
+                    if (encoding == TexelEncoding::Srgb && c < 3)
+                    {
+                        float sum = srgb.decode[row0[x0 + c]] + srgb.decode[row0[x1 + c]]
+                            + srgb.decode[row1[x0 + c]] + srgb.decode[row1[x1 + c]];
+                        *texel = srgb.Encode(sum * 0.25f);
+                    }
+                    else if (encoding == TexelEncoding::Snorm)
+                    {
+                        int sum = static_cast<int8_t>(row0[x0 + c]) + static_cast<int8_t>(row0[x1 + c])
+                            + static_cast<int8_t>(row1[x0 + c]) + static_cast<int8_t>(row1[x1 + c]);
+                        // Round half away from zero
+                        *texel = static_cast<uint8_t>(static_cast<int8_t>(
+                            sum >= 0 ? (sum + 2) / 4 : -((-sum + 2) / 4)));
+                    }
+                    else
+                    {
+                        *texel = static_cast<uint8_t>(
+                            (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+                    }
+                }
+            }
+        }
+    });
+
+    return result;
+}
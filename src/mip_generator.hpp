@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// How 8 bit channels map to values, filtering happens on the values.
+// Srgb leaves a fourth channel linear
+enum class TexelEncoding : uint8_t
+{
+    Unorm,
+    Srgb,
+    Snorm
+};
+
+// CPU mip chain generation with a 2x2 box filter, for formats the GPU can
+// not blit and for levels dropped before upload. Rows are filtered in
+// parallel on the global thread pool
+class MipGenerator
+{
+public:
+    struct Level
+    {
+        uint32_t width;
+        uint32_t height;
+        std::vector<uint8_t> texels;
+    };
+
+    static uint32_t LevelCount(uint32_t width, uint32_t height);
+
+    // Next level of a tightly packed image, odd edges are clamped
+    static Level Downsample(std::span<const uint8_t> texels, uint32_t width, uint32_t height,
+                            uint32_t channels, TexelEncoding encoding);
+};
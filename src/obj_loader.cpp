@@ -0,0 +1,506 @@
+#include "obj_loader.hpp"
+#include "thread_pool.hpp"
+#include "vertex_welder.hpp"
+#include <spdlog/spdlog.h>
+#include <Tracy.hpp>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    using Corner = ObjLoader::Corner;
+    using Attributes = ObjLoader::Attributes;
+
+    struct CornerHash
+    {
+        std::size_t operator()(const Corner& corner) const
+        {
+            uint64_t seed = WeldMix(0, static_cast<uint32_t>(corner.position));
+            seed = WeldMix(seed, static_cast<uint32_t>(corner.texcoord));
+            return WeldMix(seed, static_cast<uint32_t>(corner.normal));
+        }
+    };
+
+    // Vertex attributes snapped to the welding grid
+    struct QuantizedVertex
+    {
+        std::array<int32_t, 8> cells;
+
+        bool operator==(const QuantizedVertex&) const = default;
+    };
+
+    struct QuantizedVertexHash
+    {
+        std::size_t operator()(const QuantizedVertex& vertex) const
+        {
+            uint64_t seed = 0;
+            for (int32_t cell : vertex.cells)
+                seed = WeldMix(seed, static_cast<uint32_t>(cell));
+            return seed;
+        }
+    };
+
+    struct Counts
+    {
+        std::size_t positions = 0;
+        std::size_t texcoords = 0;
+        std::size_t normals = 0;
+        std::size_t corners = 0;
+    };
+
+    struct Chunk
+    {
+        const char* begin;
+        const char* end;
+        Counts count;
+        Counts base;
+        const char* error = nullptr;
+        const char* errorLine = nullptr;
+    };
+
+    enum class LineType
+    {
+        Position, Texcoord, Normal, Face, Other
+    };
+
+    bool IsSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    const char* SkipSpaces(const char* p, const char* end)
+    {
+        while (p < end && IsSpace(*p))
+            p++;
+        return p;
+    }
+
+    const char* SkipToken(const char* p, const char* end)
+    {
+        while (p < end && !IsSpace(*p))
+            p++;
+        return p;
+    }
+
+    const char* LineEnd(const char* p, const char* end)
+    {
+        auto newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        return newline ? newline : end;
+    }
+
+    // Advances p past the keyword
+    LineType Classify(const char*& p, const char* end)
+    {
+        p = SkipSpaces(p, end);
+        if (end - p < 2)
+            return LineType::Other;
+
+        if (p[0] == 'v')
+        {
+            if (IsSpace(p[1]))
+            {
+                p += 1;
+                return LineType::Position;
+            }
+            if (end - p > 2 && IsSpace(p[2]))
+            {
+                if (p[1] == 't')
+                {
+                    p += 2;
+                    return LineType::Texcoord;
+                }
+                if (p[1] == 'n')
+                {
+                    p += 2;
+                    return LineType::Normal;
+                }
+            }
+        }
+        else if (p[0] == 'f' && IsSpace(p[1]))
+        {
+            p += 1;
+            return LineType::Face;
+        }
+
+        return LineType::Other;
+    }
+
+    std::size_t CountTokens(const char* p, const char* end)
+    {
+        std::size_t result = 0;
+        p = SkipSpaces(p, end);
+        while (p < end && *p != '#')
+        {
+            result++;
+            p = SkipSpaces(SkipToken(p, end), end);
+        }
+        return result;
+    }
+
+    bool ParseFloat(const char*& p, const char* end, float& value)
+    {
+        p = SkipSpaces(p, end);
+        if (p < end && *p == '+')
+            p++;
+
+        auto [ptr, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc())
+            return false;
+
+        p = ptr;
+        return true;
+    }
+
+    bool ParseInt(const char*& p, const char* end, int32_t& value)
+    {
+        auto [ptr, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc())
+            return false;
+
+        p = ptr;
+        return true;
+    }
+
+    // Turns a 1 based or negative relative OBJ index into an absolute one,
+    // -1 stands for a missing attribute
+    bool Resolve(int32_t value, std::size_t defined, std::size_t total, int32_t& result)
+    {
+        if (value > 0)
+            result = value - 1;
+        else if (value < 0)
+            result = static_cast<int32_t>(defined) + value;
+        else
+            return false;
+
+        return result >= 0 && static_cast<std::size_t>(result) < total;
+    }
+
+    Counts CountChunk(const char* p, const char* end)
+    {
+        Counts result;
+        while (p < end)
+        {
+            const char* lineEnd = LineEnd(p, end);
+            switch (Classify(p, lineEnd))
+            {
+            case LineType::Position:
+                result.positions++;
+                break;
+            case LineType::Texcoord:
+                result.texcoords++;
+                break;
+            case LineType::Normal:
+                result.normals++;
+                break;
+            case LineType::Face:
+            {
+                std::size_t refs = CountTokens(p, lineEnd);
+                if (refs >= 3)
+                    result.corners += 3 * (refs - 2);
+                break;
+            }
+            default:
+                break;
+            }
+            p = lineEnd + 1;
+        }
+        return result;
+    }
+
+    void ParseChunk(Chunk& chunk, const Counts& total, Attributes& attributes)
+    {
+        Counts cursor = chunk.base;
+        const char* p = chunk.begin;
+        const char* end = chunk.end;
+
+        auto fail = [&](const char* line, const char* message) {
+            chunk.error = message;
+            chunk.errorLine = line;
+        };
+
+        while (p < end)
+        {
+            const char* line = p;
+            const char* lineEnd = LineEnd(p, end);
+            switch (Classify(p, lineEnd))
+            {
+            case LineType::Position:
+            {
+                glm::vec3& position = attributes.positions[cursor.positions++];
+                if (!ParseFloat(p, lineEnd, position.x) ||
+                    !ParseFloat(p, lineEnd, position.y) ||
+                    !ParseFloat(p, lineEnd, position.z))
+                {
+                    return fail(line, "Malformed vertex position");
+                }
+                break;
+            }
+            case LineType::Texcoord:
+            {
+                glm::vec2& texcoord = attributes.texcoords[cursor.texcoords++];
+                if (!ParseFloat(p, lineEnd, texcoord.x))
+                {
+                    return fail(line, "Malformed texture coordinate");
+                }
+                if (!ParseFloat(p, lineEnd, texcoord.y))
+                {
+                    texcoord.y = 0;
+                }
+                break;
+            }
+            case LineType::Normal:
+            {
+                glm::vec3& normal = attributes.normals[cursor.normals++];
+                if (!ParseFloat(p, lineEnd, normal.x) ||
+                    !ParseFloat(p, lineEnd, normal.y) ||
+                    !ParseFloat(p, lineEnd, normal.z))
+                {
+                    return fail(line, "Malformed vertex normal");
+                }
+                break;
+            }
+            case LineType::Face:
+            {
+                std::size_t refs = CountTokens(p, lineEnd);
+                if (refs < 3)
+                    break;
+
+                Corner first {};
+                Corner previous {};
+                for (std::size_t i = 0; i < refs; i++)
+                {
+                    p = SkipSpaces(p, lineEnd);
+                    Corner corner {-1, -1, -1};
+                    int32_t value;
+
+                    if (!ParseInt(p, lineEnd, value) ||
+                        !Resolve(value, cursor.positions, total.positions, corner.position))
+                    {
+                        return fail(line, "Invalid face position index");
+                    }
+
+                    if (p < lineEnd && *p == '/')
+                    {
+                        p++;
+                        if (p < lineEnd && *p != '/')
+                        {
+                            if (!ParseInt(p, lineEnd, value) ||
+                                !Resolve(value, cursor.texcoords, total.texcoords, corner.texcoord))
+                            {
+                                return fail(line, "Invalid face texture coordinate index");
+                            }
+                        }
+
+                        if (p < lineEnd && *p == '/')
+                        {
+                            p++;
+                            if (!ParseInt(p, lineEnd, value) ||
+                                !Resolve(value, cursor.normals, total.normals, corner.normal))
+                            {
+                                return fail(line, "Invalid face normal index");
+                            }
+                        }
+                    }
+
+                    if (p < lineEnd && !IsSpace(*p))
+                    {
+                        return fail(line, "Malformed face");
+                    }
+
+                    if (i == 0)
+                    {
+                        first = corner;
+                    }
+                    else if (i >= 2)
+                    {
+                        attributes.corners[cursor.corners++] = first;
+                        attributes.corners[cursor.corners++] = previous;
+                        attributes.corners[cursor.corners++] = corner;
+                    }
+                    previous = corner;
+                }
+                break;
+            }
+            default:
+                break;
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    std::vector<Chunk> SplitChunks(std::string_view source, std::size_t count)
+    {
+        std::vector<Chunk> result;
+        const char* begin = source.data();
+        const char* end = source.data() + source.size();
+
+        const char* chunkBegin = begin;
+        for (std::size_t i = 1; i <= count && chunkBegin < end; i++)
+        {
+            const char* chunkEnd = end;
+            if (i < count)
+            {
+                chunkEnd = begin + source.size() * i / count;
+                if (chunkEnd < chunkBegin)
+                    chunkEnd = chunkBegin;
+                chunkEnd = LineEnd(chunkEnd, end);
+                if (chunkEnd < end)
+                    chunkEnd++;
+            }
+
+            result.push_back({chunkBegin, chunkEnd});
+            chunkBegin = chunkEnd;
+        }
+        return result;
+    }
+
+    QuantizedVertex Quantize(const Vertex& vertex, float scale)
+    {
+        auto cell = [scale](float value) {
+            return static_cast<int32_t>(std::floor(value * scale + 0.5f));
+        };
+
+        return {{
+            cell(vertex.position.x), cell(vertex.position.y), cell(vertex.position.z),
+            cell(vertex.normal.x), cell(vertex.normal.y), cell(vertex.normal.z),
+            cell(vertex.textureCoord.x), cell(vertex.textureCoord.y)
+        }};
+    }
+
+    template<typename Key, typename Hash, typename MakeKey>
+    void WeldCorners(const Attributes& attributes, ObjLoader::Result& result,
+              std::size_t expected, MakeKey makeKey)
+    {
+        VertexWelder<Key, Hash> welder(expected);
+        result.indices.reserve(attributes.corners.size());
+        result.vertices.reserve(expected);
+
+        for (const auto& corner : attributes.corners)
+        {
+            Vertex vertex = ObjLoader::MakeVertex(attributes, corner);
+            auto [index, inserted] = welder.Insert(
+                makeKey(corner, vertex), static_cast<uint32_t>(result.vertices.size()));
+            if (inserted)
+            {
+                result.vertices.push_back(vertex);
+            }
+
+            result.indices.push_back(index);
+        }
+    }
+}
+
+ObjLoader::Result ObjLoader::Load(std::string_view source, const ObjLoadOptions& options)
+{
+    ZoneScoped;
+    return Weld(Parse(source), options);
+}
+
+ObjLoader::Attributes ObjLoader::Parse(std::string_view source)
+{
+    ZoneScoped;
+    auto& pool = ThreadPool::Global();
+
+    constexpr std::size_t minChunkSize = 1 << 20;
+    std::size_t chunkCount = std::clamp<std::size_t>(
+        source.size() / minChunkSize, 1, (pool.GetThreadCount() + 1) * 4);
+    auto chunks = SplitChunks(source, chunkCount);
+
+    {
+        ZoneScopedN("Count");
+        pool.ParallelFor(chunks.size(), 1, [&](std::size_t begin, std::size_t end, std::size_t) {
+            for (std::size_t i = begin; i < end; i++)
+            {
+                chunks[i].count = CountChunk(chunks[i].begin, chunks[i].end);
+            }
+        });
+    }
+
+    Counts total;
+    for (auto& chunk : chunks)
+    {
+        chunk.base = total;
+        total.positions += chunk.count.positions;
+        total.texcoords += chunk.count.texcoords;
+        total.normals += chunk.count.normals;
+        total.corners += chunk.count.corners;
+    }
+
+    Attributes attributes;
+    attributes.positions.resize(total.positions);
+    attributes.texcoords.resize(total.texcoords);
+    attributes.normals.resize(total.normals);
+    attributes.corners.resize(total.corners);
+
+    {
+        ZoneScopedN("Parse");
+        pool.ParallelFor(chunks.size(), 1, [&](std::size_t begin, std::size_t end, std::size_t) {
+            for (std::size_t i = begin; i < end; i++)
+            {
+                ParseChunk(chunks[i], total, attributes);
+            }
+        });
+    }
+
+    for (const auto& chunk : chunks)
+    {
+        if (chunk.error)
+        {
+            std::string_view line(chunk.errorLine,
+                                  LineEnd(chunk.errorLine, chunk.end) - chunk.errorLine);
+            spdlog::error("{}: \"{}\"", chunk.error, line);
+            throw std::runtime_error("Could not load mesh");
+        }
+    }
+
+    return attributes;
+}
+
+ObjLoader::Result ObjLoader::Weld(const Attributes& attributes, const ObjLoadOptions& options)
+{
+    ZoneScoped;
+    Result result;
+    if (options.weldEpsilon > 0.0f)
+    {
+        float scale = 1.0f / options.weldEpsilon;
+        WeldCorners<QuantizedVertex, QuantizedVertexHash>(
+            attributes, result, attributes.positions.size(),
+            [scale](const Corner&, const Vertex& vertex) {
+                return Quantize(vertex, scale);
+            });
+    }
+    else
+    {
+        WeldCorners<Corner, CornerHash>(
+            attributes, result, attributes.positions.size(),
+            [](const Corner& corner, const Vertex&) {
+                return corner;
+            });
+    }
+
+    return result;
+}
+
+Vertex ObjLoader::MakeVertex(const Attributes& attributes, const Corner& corner)
+{
+    Vertex vertex {};
+
+    vertex.position = attributes.positions[corner.position];
+
+    if (corner.normal >= 0)
+    {
+        vertex.normal = attributes.normals[corner.normal];
+    }
+
+    if (corner.texcoord >= 0)
+    {
+        vertex.textureCoord = {
+            attributes.texcoords[corner.texcoord].x,
+            1.0f - attributes.texcoords[corner.texcoord].y
+        };
+    }
+
+    vertex.color = {1.0f, 1.0f, 1.0f};
+    return vertex;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "vertex.hpp"
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+struct ObjLoadOptions
+{
+    // Corners are welded by their OBJ index triple by default. A non zero
+    // epsilon welds by attribute values snapped to a grid of that size
+    // instead, merging duplicated positions, normals and texture coordinates
+    float weldEpsilon = 0.0f;
+};
+
+// Wavefront OBJ reader working on a memory mapped file. The file is split
+// into line aligned chunks which are counted and then parsed in parallel
+// straight into the final attribute arrays, after which face corners are
+// welded into the vertex and index streams. Materials, groups and smoothing
+// groups are ignored, polygons are triangulated as fans
+class ObjLoader
+{
+public:
+    struct Result
+    {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+    };
+
+    // One face corner, indices into the attribute arrays or -1 when absent
+    struct Corner
+    {
+        int32_t position;
+        int32_t texcoord;
+        int32_t normal;
+
+        bool operator==(const Corner&) const = default;
+    };
+
+    // The file as parsed, before welding
+    struct Attributes
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec2> texcoords;
+        std::vector<glm::vec3> normals;
+        std::vector<Corner> corners;
+    };
+
+    static Result Load(std::string_view source, const ObjLoadOptions& options = {});
+
+    // The two halves of Load
+    static Attributes Parse(std::string_view source);
+    static Result Weld(const Attributes& attributes, const ObjLoadOptions& options = {});
+
+    static Vertex MakeVertex(const Attributes& attributes, const Corner& corner);
+};
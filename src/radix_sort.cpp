@@ -0,0 +1,44 @@
+#include "radix_sort.hpp"
+#include <array>
+#include <numeric>
+#include <utility>
+
+void RadixSort::Sort(std::span<const uint64_t> keys, std::vector<uint32_t>& order)
+{
+    order.resize(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (keys.size() < 2)
+        return;
+
+    // Histograms of all passes are counted in one go
+    std::array<std::array<uint32_t, 256>, 8> counts {};
+    for (uint64_t key : keys)
+    {
+        for (int pass = 0; pass < 8; pass++)
+            counts[pass][(key >> (pass * 8)) & 0xff]++;
+    }
+
+    std::vector<uint64_t> sortedKeys(keys.begin(), keys.end());
+    std::vector<uint64_t> keysScratch(keys.size());
+    std::vector<uint32_t> orderScratch(keys.size());
+    for (int pass = 0; pass < 8; pass++)
+    {
+        auto& count = counts[pass];
+        uint32_t shift = pass * 8;
+        if (count[(sortedKeys.front() >> shift) & 0xff] == keys.size())
+            continue;
+
+        uint32_t offset = 0;
+        for (auto& bucket : count)
+            offset += std::exchange(bucket, offset);
+
+        for (std::size_t i = 0; i < sortedKeys.size(); i++)
+        {
+            uint32_t destination = count[(sortedKeys[i] >> shift) & 0xff]++;
+            keysScratch[destination] = sortedKeys[i];
+            orderScratch[destination] = order[i];
+        }
+        sortedKeys.swap(keysScratch);
+        order.swap(orderScratch);
+    }
+}
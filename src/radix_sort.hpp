@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Least significant digit radix sort of 64 bit keys, 8 bits per pass.
+// Passes over bytes that are equal in all keys are skipped
+class RadixSort
+{
+public:
+    // Indices of keys in ascending key order, equal keys keep their order
+    static void Sort(std::span<const uint64_t> keys, std::vector<uint32_t>& order);
+};
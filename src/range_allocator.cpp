@@ -0,0 +1,56 @@
+#include "range_allocator.hpp"
+
+RangeAllocator::RangeAllocator(uint64_t size)
+    : m_size(size)
+{
+    if (size > 0)
+        m_free[0] = size;
+}
+
+std::optional<uint64_t> RangeAllocator::Allocate(uint64_t size, uint64_t alignment)
+{
+    for (auto it = m_free.begin(); it != m_free.end(); ++it)
+    {
+        auto [begin, freeSize] = *it;
+        uint64_t end = begin + freeSize;
+        uint64_t offset = (begin + alignment - 1) / alignment * alignment;
+        if (offset + size > end)
+            continue;
+
+        // Padding in front of the range stays free
+        m_free.erase(it);
+        if (offset > begin)
+            m_free[begin] = offset - begin;
+        if (offset + size < end)
+            m_free[offset + size] = end - offset - size;
+
+        m_used += size;
+        return offset;
+    }
+
+    return std::nullopt;
+}
+
+void RangeAllocator::Free(uint64_t offset, uint64_t size)
+{
+    m_used -= size;
+
+    auto next = m_free.lower_bound(offset);
+    if (next != m_free.end() && next->first == offset + size)
+    {
+        size += next->second;
+        next = m_free.erase(next);
+    }
+
+    if (next != m_free.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset)
+        {
+            previous->second += size;
+            return;
+        }
+    }
+
+    m_free[offset] = size;
+}
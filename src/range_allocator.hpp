@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <optional>
+
+// First fit allocation of ranges in [0, size), freed ranges merge with
+// their free neighbours
+class RangeAllocator
+{
+public:
+    explicit RangeAllocator(uint64_t size = 0);
+
+    // Any alignment works, not just powers of two
+    std::optional<uint64_t> Allocate(uint64_t size, uint64_t alignment = 1);
+    void Free(uint64_t offset, uint64_t size);
+
+    uint64_t GetSize() const { return m_size; }
+    uint64_t GetUsed() const { return m_used; }
+
+private:
+    // Free ranges by offset
+    std::map<uint64_t, uint64_t> m_free;
+    uint64_t m_size = 0;
+    uint64_t m_used = 0;
+};
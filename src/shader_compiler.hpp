@@ -27,10 +27,15 @@ public:
         return result;
     }
 
-    static std::vector<uint32_t> CompileFromFile(const std::filesystem::path& path, shaderc_shader_kind kind)
+    static std::vector<uint32_t> CompileFromFile(const std::filesystem::path& path, shaderc_shader_kind kind,
+                                                 const std::vector<std::string>& definitions = {})
     {
         shaderc::Compiler compiler;
         shaderc::CompileOptions options;
+        for (const auto& definition : definitions)
+        {
+            options.AddMacroDefinition(definition);
+        }
         shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(ReadFile(path), kind, path.c_str(), options);
 
         if (result.GetCompilationStatus() != shaderc_compilation_status_success)
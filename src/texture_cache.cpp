@@ -0,0 +1,158 @@
+#include "texture_cache.hpp"
+#include "mip_generator.hpp"
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/fmt.h>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    constexpr char s_identifier[12] = {'T', 'E', 'X', 'C', 'C', 'H', ' ', '2', '\r', '\n', '\x1A', '\n'};
+    // Level data starts on whole blocks
+    constexpr uint64_t s_alignment = 16;
+
+    uint64_t Align(uint64_t offset)
+    {
+        return (offset + s_alignment - 1) / s_alignment * s_alignment;
+    }
+}
+
+std::filesystem::path TextureCache::PathFor(const std::filesystem::path& source,
+                                            uint64_t sourceHash) const
+{
+    if (m_directory.empty())
+    {
+        auto result = source;
+        result += ".texcache";
+        return result;
+    }
+
+    return m_directory / fmt::format("{}-{:016x}.texcache",
+                                     source.stem().string(), sourceHash);
+}
+
+std::optional<TextureCache::Entry> TextureCache::Load(const std::filesystem::path& path,
+                                                      uint64_t sourceHash, vk::Format format,
+                                                      const LevelSize& levelSize) const
+{
+    MappedFile file(path);
+    if (!file || file.size() < sizeof(Header))
+        return std::nullopt;
+
+    Header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.identifier, s_identifier, sizeof(s_identifier)) != 0
+        || header.version != s_version
+        || header.sourceHash != sourceHash
+        || header.format != static_cast<uint32_t>(format))
+    {
+        return std::nullopt;
+    }
+
+    if (header.width == 0 || header.height == 0 || header.levelCount == 0
+        || header.levelCount > MipGenerator::LevelCount(header.width, header.height))
+    {
+        spdlog::warn("Texture cache {} has {} levels for {}x{}", path.c_str(),
+                     header.levelCount, header.width, header.height);
+        return std::nullopt;
+    }
+
+    std::size_t indexEnd = sizeof(Header) + header.levelCount * sizeof(LevelIndex);
+    if (file.size() < indexEnd)
+    {
+        spdlog::warn("Texture cache {} is truncated", path.c_str());
+        return std::nullopt;
+    }
+
+    Entry result;
+    result.format = static_cast<vk::Format>(header.format);
+    for (uint32_t i = 0; i < header.levelCount; i++)
+    {
+        LevelIndex index;
+        std::memcpy(&index, file.data() + sizeof(Header) + i * sizeof(LevelIndex), sizeof(index));
+        if (index.byteOffset > file.size() || index.byteLength > file.size() - index.byteOffset)
+        {
+            spdlog::warn("Texture cache {} is truncated", path.c_str());
+            return std::nullopt;
+        }
+
+        // Uploads copy the extent, so the data has to cover exactly that
+        uint32_t width = std::max(header.width >> i, 1u);
+        uint32_t height = std::max(header.height >> i, 1u);
+        if (index.byteLength != levelSize(width, height))
+        {
+            spdlog::warn("Texture cache {} level {} has {} bytes", path.c_str(), i,
+                         index.byteLength);
+            return std::nullopt;
+        }
+
+        result.levels.push_back({
+                width, height,
+                {reinterpret_cast<const uint8_t*>(file.data()) + index.byteOffset, index.byteLength}});
+    }
+
+    result.file = std::move(file);
+    return result;
+}
+
+void TextureCache::Store(const std::filesystem::path& path, uint64_t sourceHash,
+                         vk::Format format, std::span<const Level> levels) const
+{
+    Header header {};
+    std::memcpy(header.identifier, s_identifier, sizeof(s_identifier));
+    header.version = s_version;
+    header.sourceHash = sourceHash;
+    header.format = static_cast<uint32_t>(format);
+    header.width = levels.empty() ? 0 : levels.front().width;
+    header.height = levels.empty() ? 0 : levels.front().height;
+    header.levelCount = levels.size();
+
+    std::vector<LevelIndex> index;
+    uint64_t offset = sizeof(Header) + levels.size() * sizeof(LevelIndex);
+    for (const auto& level : levels)
+    {
+        offset = Align(offset);
+        index.push_back({offset, level.data.size()});
+        offset += level.data.size();
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    // Same temporary file scheme as the mesh cache
+    auto temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            spdlog::warn("Failed to write texture cache {}", path.c_str());
+            return;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(LevelIndex));
+        for (std::size_t i = 0; i < levels.size(); i++)
+        {
+            static constexpr char padding[s_alignment] {};
+            file.write(padding, index[i].byteOffset - static_cast<uint64_t>(file.tellp()));
+            file.write(reinterpret_cast<const char*>(levels[i].data.data()), levels[i].data.size());
+        }
+
+        if (!file)
+        {
+            spdlog::warn("Failed to write texture cache {}", path.c_str());
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+        spdlog::warn("Failed to write texture cache {}: {}", path.c_str(), error.message());
+        std::filesystem::remove(temporary, error);
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "files.hpp"
+#include <vulkan/vulkan.hpp>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Binary cache of baked textures, laid out like a KTX2 file: a header with
+// the Vulkan format and extent, an index of levels, largest first, then
+// the level data. There is no data format descriptor, the cache is only
+// ever read back by TextureManager. Entries are keyed by the content hash
+// of the source image and the bake options
+class TextureCache
+{
+public:
+    static constexpr uint32_t s_version = 1;
+
+    struct Header
+    {
+        char identifier[12];
+        uint32_t version;
+        uint64_t sourceHash;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+    };
+
+    struct LevelIndex
+    {
+        uint64_t byteOffset;
+        uint64_t byteLength;
+    };
+
+    struct Level
+    {
+        uint32_t width;
+        uint32_t height;
+        std::span<const uint8_t> data;
+    };
+
+    struct Entry
+    {
+        MappedFile file;
+        vk::Format format;
+        std::vector<Level> levels;
+    };
+
+    void SetDirectory(const std::filesystem::path& directory)
+    {
+        m_directory = directory;
+    }
+
+    std::filesystem::path PathFor(const std::filesystem::path& source,
+                                  uint64_t sourceHash) const;
+
+    // Bytes of a level with the given extent
+    using LevelSize = std::function<std::size_t(uint32_t width, uint32_t height)>;
+
+    // Entries of another format, or whose levels do not match their
+    // extent, are not loaded
+    std::optional<Entry> Load(const std::filesystem::path& path, uint64_t sourceHash,
+                              vk::Format format, const LevelSize& levelSize) const;
+    void Store(const std::filesystem::path& path, uint64_t sourceHash,
+               vk::Format format, std::span<const Level> levels) const;
+
+private:
+    std::filesystem::path m_directory;
+};
@@ -0,0 +1,332 @@
+#include "texture_compressor.hpp"
+#include "thread_pool.hpp"
+#include <Tracy.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+    constexpr uint32_t s_block = 4;
+
+    // Block texels with edge clamping, always four channels
+    using BlockTexels = std::array<std::array<uint8_t, 4>, 16>;
+
+    void FetchBlock(std::span<const uint8_t> texels, uint32_t width, uint32_t height,
+                    uint32_t channels, uint32_t blockX, uint32_t blockY, BlockTexels& block)
+    {
+        for (uint32_t y = 0; y < s_block; y++)
+        {
+            uint32_t sy = std::min(blockY * s_block + y, height - 1);
+            for (uint32_t x = 0; x < s_block; x++)
+            {
+                uint32_t sx = std::min(blockX * s_block + x, width - 1);
+                const uint8_t* texel = &texels[(std::size_t(sy) * width + sx) * channels];
+                auto& out = block[y * s_block + x];
+                out = {0, 0, 0, 255};
+                for (uint32_t c = 0; c < std::min(channels, 4u); c++)
+                    out[c] = texel[c];
+            }
+        }
+    }
+
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(uint8_t* output)
+            : m_output(output)
+        {}
+
+        void Write(uint32_t value, uint32_t bits)
+        {
+            for (uint32_t i = 0; i < bits; i++, m_position++)
+            {
+                if ((value >> i) & 1)
+                    m_output[m_position / 8] |= 1 << (m_position % 8);
+            }
+        }
+    private:
+        uint8_t* m_output;
+        uint32_t m_position = 0;
+    };
+
+    void EncodeBC4(const BlockTexels& block, uint32_t channel, uint8_t* output)
+    {
+        uint8_t lo = 255, hi = 0;
+        for (const auto& texel : block)
+        {
+            lo = std::min(lo, texel[channel]);
+            hi = std::max(hi, texel[channel]);
+        }
+
+        std::memset(output, 0, 8);
+        // hi > lo selects the mode with six interpolated values, equal
+        // endpoints decode to hi with all indices zero
+        output[0] = hi;
+        output[1] = lo;
+        if (hi == lo)
+            return;
+
+        BitWriter writer(output + 2);
+        float scale = 7.0f / (hi - lo);
+        for (const auto& texel : block)
+        {
+            // Position between hi and lo, index 0 is hi, 1 is lo and
+            // 2 to 7 lie in between
+            int t = static_cast<int>(std::lround((hi - texel[channel]) * scale));
+            uint32_t index = t == 0 ? 0 : t == 7 ? 1 : t + 1;
+            writer.Write(index, 3);
+        }
+    }
+
+    constexpr std::array<int, 16> s_weights4 {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    struct Endpoint
+    {
+        std::array<uint8_t, 4> quantized;
+        uint8_t pbit;
+
+        uint8_t Value(int c) const
+        {
+            return static_cast<uint8_t>(quantized[c] << 1 | pbit);
+        }
+    };
+
+    Endpoint QuantizeEndpoint(const std::array<float, 4>& value)
+    {
+        Endpoint best {};
+        float bestError = std::numeric_limits<float>::max();
+        for (uint8_t pbit = 0; pbit < 2; pbit++)
+        {
+            Endpoint candidate {};
+            candidate.pbit = pbit;
+            float error = 0.0f;
+            for (int c = 0; c < 4; c++)
+            {
+                float q = std::round((std::clamp(value[c], 0.0f, 255.0f) - pbit) * 0.5f);
+                candidate.quantized[c] = static_cast<uint8_t>(std::clamp(q, 0.0f, 127.0f));
+                float difference = candidate.Value(c) - value[c];
+                error += difference * difference;
+            }
+
+            if (error < bestError)
+            {
+                bestError = error;
+                best = candidate;
+            }
+        }
+        return best;
+    }
+
+    // Chooses the closest palette entry for every texel, returns the
+    // squared error
+    uint32_t AssignIndices(const BlockTexels& block, const Endpoint& e0, const Endpoint& e1,
+                           std::array<uint8_t, 16>& indices)
+    {
+        std::array<std::array<int, 4>, 16> palette;
+        for (int k = 0; k < 16; k++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                palette[k][c] = ((64 - s_weights4[k]) * e0.Value(c)
+                                 + s_weights4[k] * e1.Value(c) + 32) >> 6;
+            }
+        }
+
+        uint32_t total = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            uint32_t bestError = UINT32_MAX;
+            for (int k = 0; k < 16; k++)
+            {
+                uint32_t error = 0;
+                for (int c = 0; c < 4; c++)
+                {
+                    int difference = palette[k][c] - block[i][c];
+                    error += difference * difference;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    indices[i] = static_cast<uint8_t>(k);
+                }
+            }
+            total += bestError;
+        }
+        return total;
+    }
+
+    void EncodeBC7(const BlockTexels& block, uint8_t* output)
+    {
+        std::array<float, 4> mean {};
+        for (const auto& texel : block)
+        {
+            for (int c = 0; c < 4; c++)
+                mean[c] += texel[c] / 16.0f;
+        }
+
+        float covariance[4][4] {};
+        for (const auto& texel : block)
+        {
+            for (int a = 0; a < 4; a++)
+            {
+                for (int b = 0; b < 4; b++)
+                    covariance[a][b] += (texel[a] - mean[a]) * (texel[b] - mean[b]);
+            }
+        }
+
+        // Principal axis by power iteration
+        std::array<float, 4> axis {1.0f, 1.0f, 1.0f, 1.0f};
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            std::array<float, 4> next {};
+            for (int a = 0; a < 4; a++)
+            {
+                for (int b = 0; b < 4; b++)
+                    next[a] += covariance[a][b] * axis[b];
+            }
+
+            float length = std::sqrt(next[0] * next[0] + next[1] * next[1]
+                                     + next[2] * next[2] + next[3] * next[3]);
+            if (!(length > 1e-6f))
+                break;
+            for (int c = 0; c < 4; c++)
+                axis[c] = next[c] / length;
+        }
+
+        float tMin = 0.0f, tMax = 0.0f;
+        for (const auto& texel : block)
+        {
+            float t = 0.0f;
+            for (int c = 0; c < 4; c++)
+                t += (texel[c] - mean[c]) * axis[c];
+            tMin = std::min(tMin, t);
+            tMax = std::max(tMax, t);
+        }
+
+        std::array<float, 4> low, high;
+        for (int c = 0; c < 4; c++)
+        {
+            low[c] = mean[c] + axis[c] * tMin;
+            high[c] = mean[c] + axis[c] * tMax;
+        }
+
+        Endpoint e0 = QuantizeEndpoint(low);
+        Endpoint e1 = QuantizeEndpoint(high);
+        std::array<uint8_t, 16> indices;
+        uint32_t error = AssignIndices(block, e0, e1, indices);
+
+        // Least squares endpoints for the chosen weights
+        float aa = 0, ab = 0, bb = 0;
+        std::array<float, 4> ap {}, bp {};
+        for (int i = 0; i < 16; i++)
+        {
+            float w = s_weights4[indices[i]] / 64.0f;
+            aa += (1 - w) * (1 - w);
+            ab += (1 - w) * w;
+            bb += w * w;
+            for (int c = 0; c < 4; c++)
+            {
+                ap[c] += (1 - w) * block[i][c];
+                bp[c] += w * block[i][c];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (std::abs(determinant) > 1e-6f)
+        {
+            std::array<float, 4> refinedLow, refinedHigh;
+            for (int c = 0; c < 4; c++)
+            {
+                refinedLow[c] = (bb * ap[c] - ab * bp[c]) / determinant;
+                refinedHigh[c] = (aa * bp[c] - ab * ap[c]) / determinant;
+            }
+
+            Endpoint r0 = QuantizeEndpoint(refinedLow);
+            Endpoint r1 = QuantizeEndpoint(refinedHigh);
+            std::array<uint8_t, 16> refinedIndices;
+            uint32_t refinedError = AssignIndices(block, r0, r1, refinedIndices);
+            if (refinedError < error)
+            {
+                e0 = r0;
+                e1 = r1;
+                indices = refinedIndices;
+            }
+        }
+
+        // The anchor index is stored without its top bit
+        if (indices[0] >= 8)
+        {
+            std::swap(e0, e1);
+            for (auto& index : indices)
+                index = 15 - index;
+        }
+
+        std::memset(output, 0, 16);
+        BitWriter writer(output);
+        writer.Write(1 << 6, 7);
+        for (int c = 0; c < 4; c++)
+        {
+            writer.Write(e0.quantized[c], 7);
+            writer.Write(e1.quantized[c], 7);
+        }
+        writer.Write(e0.pbit, 1);
+        writer.Write(e1.pbit, 1);
+        writer.Write(indices[0], 3);
+        for (int i = 1; i < 16; i++)
+            writer.Write(indices[i], 4);
+    }
+}
+
+std::size_t TextureCompressor::BlockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC4 ? 8 : 16;
+}
+
+std::size_t TextureCompressor::EncodedSize(uint32_t width, uint32_t height, BlockFormat format)
+{
+    std::size_t blocksX = (width + s_block - 1) / s_block;
+    std::size_t blocksY = (height + s_block - 1) / s_block;
+    return blocksX * blocksY * BlockBytes(format);
+}
+
+std::vector<uint8_t> TextureCompressor::Encode(std::span<const uint8_t> texels,
+                                               uint32_t width, uint32_t height,
+                                               uint32_t channels, BlockFormat format)
+{
+    ZoneScoped;
+    uint32_t blocksX = (width + s_block - 1) / s_block;
+    uint32_t blocksY = (height + s_block - 1) / s_block;
+    std::size_t blockBytes = BlockBytes(format);
+    std::vector<uint8_t> result(EncodedSize(width, height, format));
+
+    auto& pool = ThreadPool::Global();
+    pool.ParallelFor(blocksY, pool.BatchSize(blocksY, 4), [&](std::size_t begin, std::size_t end, std::size_t) {
+        BlockTexels block;
+        for (std::size_t y = begin; y < end; y++)
+        {
+            for (uint32_t x = 0; x < blocksX; x++)
+            {
+                FetchBlock(texels, width, height, channels, x, y, block);
+                uint8_t* output = &result[(y * blocksX + x) * blockBytes];
+
+                switch (format)
+                {
+                case BlockFormat::BC4:
+                    EncodeBC4(block, 0, output);
+                    break;
+                case BlockFormat::BC5:
+                    EncodeBC4(block, 0, output);
+                    EncodeBC4(block, 1, output + 8);
+                    break;
+                case BlockFormat::BC7:
+                    EncodeBC7(block, output);
+                    break;
+                }
+            }
+        }
+    });
+
+    return result;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+enum class BlockFormat : uint8_t
+{
+    // One channel, 8 bytes per 4x4 block
+    BC4,
+    // Two BC4 blocks for the first two channels
+    BC5,
+    // RGBA, 16 bytes per 4x4 block
+    BC7
+};
+
+// CPU block compression. BC7 uses mode 6 only, a single subset with 7 bit
+// endpoints and 4 bit indices, endpoints are fitted along the principal
+// axis of the block and refined once by least squares. Blocks are encoded
+// in parallel on the global thread pool
+class TextureCompressor
+{
+public:
+    static std::size_t BlockBytes(BlockFormat format);
+    static std::size_t EncodedSize(uint32_t width, uint32_t height, BlockFormat format);
+
+    // Texels are tightly packed with channels bytes each, partial blocks
+    // on the right and bottom edges repeat the edge texels
+    static std::vector<uint8_t> Encode(std::span<const uint8_t> texels,
+                                       uint32_t width, uint32_t height,
+                                       uint32_t channels, BlockFormat format);
+};
@@ -0,0 +1,58 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    for (unsigned i = 0; i < threadCount; i++)
+    {
+        m_threads.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+ThreadPool& ThreadPool::Global()
+{
+    static ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+void ThreadPool::Submit(std::function<void()> job)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+    m_condition.notify_one();
+}
+
+void ThreadPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+
+            if (m_stop && m_jobs.empty())
+                return;
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        job();
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Shared pool sized to the machine, one thread is left for the caller
+    static ThreadPool& Global();
+
+    unsigned GetThreadCount() const { return m_threads.size(); }
+
+    void Submit(std::function<void()> job);
+
+    template<std::invocable F>
+    auto Async(F func) -> std::future<std::invoke_result_t<F>>
+    {
+        using Result = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(func));
+        auto future = task->get_future();
+        Submit([task] { (*task)(); });
+        return future;
+    }
+
+    // Calls func(begin, end, batch) for consecutive ranges covering
+    // [0, count) and blocks until all of them are done. The calling thread
+    // takes part, so nesting inside a pool job cannot deadlock
+    template<typename F>
+    void ParallelFor(std::size_t count, std::size_t batchSize, F&& func)
+    {
+        if (count == 0)
+            return;
+
+        batchSize = std::max<std::size_t>(batchSize, 1);
+        std::size_t batches = (count + batchSize - 1) / batchSize;
+        if (batches == 1)
+        {
+            func(std::size_t(0), count, std::size_t(0));
+            return;
+        }
+
+        auto state = std::make_shared<ParallelState>();
+        state->batches = batches;
+        state->run = [&func, count, batchSize](std::size_t batch) {
+            std::size_t begin = batch * batchSize;
+            std::size_t end = std::min(count, begin + batchSize);
+            func(begin, end, batch);
+        };
+
+        std::size_t helpers = std::min<std::size_t>(GetThreadCount(), batches - 1);
+        for (std::size_t i = 0; i < helpers; i++)
+        {
+            Submit([state] { state->Work(); });
+        }
+
+        state->Work();
+
+        std::unique_lock lock(state->mutex);
+        state->finished.wait(lock, [&] { return state->done == state->batches; });
+    }
+
+    // Batch size that splits count into a few batches per thread
+    std::size_t BatchSize(std::size_t count, std::size_t minBatch = 1024) const
+    {
+        std::size_t batches = (GetThreadCount() + 1) * 4;
+        return std::max(minBatch, (count + batches - 1) / batches);
+    }
+
+private:
+    struct ParallelState
+    {
+        std::function<void(std::size_t)> run;
+        std::size_t batches = 0;
+        std::atomic<std::size_t> next = 0;
+        std::size_t done = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        void Work()
+        {
+            std::size_t completed = 0;
+            for (std::size_t batch = next++; batch < batches; batch = next++)
+            {
+                run(batch);
+                completed++;
+            }
+
+            if (completed)
+            {
+                std::lock_guard lock(mutex);
+                done += completed;
+                if (done == batches)
+                    finished.notify_all();
+            }
+        }
+    };
+
+    void WorkerLoop();
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop = false;
+};
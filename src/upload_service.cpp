@@ -0,0 +1,364 @@
+#include "upload_service.hpp"
+#include <spdlog/spdlog.h>
+#include <Tracy.hpp>
+
+namespace
+{
+    vk::UniqueSemaphore CreateTimeline(vk::Device device)
+    {
+        vk::SemaphoreTypeCreateInfo typeInfo;
+        typeInfo.semaphoreType = vk::SemaphoreType::eTimeline;
+        typeInfo.initialValue = 0;
+
+        vk::SemaphoreCreateInfo createInfo;
+        createInfo.pNext = &typeInfo;
+        return device.createSemaphoreUnique(createInfo);
+    }
+
+    AllocatedBuffer CreateMappedBuffer(vk::Device device, VmaAllocator allocator,
+                                       vk::DeviceSize size, void** data)
+    {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+        allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        AllocatedBuffer result;
+        VmaAllocationInfo info;
+        if (vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &result.buffer,
+                            &result.allocation, &info) != VK_SUCCESS)
+        {
+            spdlog::error("Failed to allocate {} bytes of staging memory", size);
+            throw std::runtime_error("failed to allocate staging memory");
+        }
+        result.allocator = allocator;
+        result.device = device;
+        *data = info.pMappedData;
+        return result;
+    }
+}
+
+void UploadService::Init(vk::Device device, const vk::DispatchLoaderDynamic& dispatcher,
+                         VmaAllocator allocator, const Queues& queues,
+                         vk::DeviceSize stagingSize)
+{
+    m_device = device;
+    m_dispatcher = &dispatcher;
+    m_allocator = allocator;
+    m_queues = queues;
+
+    vk::CommandPoolCreateInfo poolInfo;
+    poolInfo.flags = vk::CommandPoolCreateFlagBits::eTransient;
+    poolInfo.queueFamilyIndex = m_queues.graphicsFamily;
+    m_graphicsPool = m_device.createCommandPoolUnique(poolInfo);
+    if (HasDedicatedTransfer())
+    {
+        poolInfo.queueFamilyIndex = m_queues.transferFamily;
+        m_transferPool = m_device.createCommandPoolUnique(poolInfo);
+    }
+
+    m_transferTimeline = CreateTimeline(m_device);
+    m_timeline = CreateTimeline(m_device);
+
+    void* data;
+    m_staging = CreateMappedBuffer(m_device, m_allocator, stagingSize, &data);
+    m_stagingData = static_cast<uint8_t*>(data);
+    m_stagingSize = stagingSize;
+
+    spdlog::info("Uploads use {} queue family {}",
+                 HasDedicatedTransfer() ? "transfer" : "graphics",
+                 m_queues.transferFamily);
+}
+
+void UploadService::Terminate()
+{
+    m_releaseBuffers.clear();
+    m_releaseImages.clear();
+    m_acquireBuffers.clear();
+    m_acquireImages.clear();
+    m_open = {};
+    m_inFlight.clear();
+    m_staging = {};
+    m_transferPool.reset();
+    m_graphicsPool.reset();
+    m_transferTimeline.reset();
+    m_timeline.reset();
+}
+
+StagingAllocation UploadService::Stage(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    ZoneScoped;
+    if (size <= m_stagingSize)
+    {
+        while (true)
+        {
+            uint64_t offset = m_head % m_stagingSize;
+            uint64_t aligned = (offset + alignment - 1) / alignment * alignment;
+            // Allocations never straddle the end of the ring
+            uint64_t start = aligned + size <= m_stagingSize
+                ? m_head + (aligned - offset)
+                : m_head + (m_stagingSize - offset);
+            uint64_t end = start + size;
+
+            if (end - m_tail <= m_stagingSize)
+            {
+                m_head = end;
+                StagingAllocation result;
+                result.buffer = m_staging.buffer;
+                result.offset = start % m_stagingSize;
+                result.data = {m_stagingData + result.offset, size};
+                return result;
+            }
+
+            if (!m_inFlight.empty())
+            {
+                Wait({m_inFlight.front().value});
+                Retire();
+            }
+            else if (m_tail == m_head)
+            {
+                // Nothing staged is alive, start over at the beginning
+                m_head = m_tail = (m_head + m_stagingSize - 1) / m_stagingSize * m_stagingSize;
+            }
+            else
+            {
+                // The open batch holds the ring, it is not submitted here
+                // since its staging may not be written yet
+                break;
+            }
+        }
+    }
+
+    void* data;
+    auto& dedicated = m_open.dedicated.emplace_back(
+        CreateMappedBuffer(m_device, m_allocator, size, &data));
+
+    StagingAllocation result;
+    result.buffer = dedicated.buffer;
+    result.offset = 0;
+    result.data = {static_cast<uint8_t*>(data), size};
+    return result;
+}
+
+void UploadService::CopyToBuffer(const StagingAllocation& source, vk::Buffer destination,
+                                 vk::DeviceSize destinationOffset)
+{
+    vk::BufferCopy region;
+    region.srcOffset = source.offset;
+    region.dstOffset = destinationOffset;
+    region.size = source.data.size();
+    TransferCommands().copyBuffer(source.buffer, destination, region);
+
+    vk::BufferMemoryBarrier barrier;
+    barrier.buffer = destination;
+    barrier.offset = destinationOffset;
+    barrier.size = source.data.size();
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+    if (HasDedicatedTransfer())
+    {
+        barrier.srcQueueFamilyIndex = m_queues.transferFamily;
+        barrier.dstQueueFamilyIndex = m_queues.graphicsFamily;
+        m_releaseBuffers.push_back(barrier);
+        barrier.srcAccessMask = {};
+    }
+
+    barrier.dstAccessMask = vk::AccessFlagBits::eMemoryRead;
+    m_acquireBuffers.push_back(barrier);
+}
+
+void UploadService::CopyToImage(const StagingAllocation& source, vk::Image image,
+                                const vk::ImageSubresourceRange& range,
+                                std::span<const vk::BufferImageCopy> regions,
+                                vk::ImageLayout finalLayout)
+{
+    auto commandBuffer = TransferCommands();
+
+    vk::ImageMemoryBarrier toTransfer;
+    toTransfer.oldLayout = vk::ImageLayout::eUndefined;
+    toTransfer.newLayout = vk::ImageLayout::eTransferDstOptimal;
+    toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toTransfer.image = image;
+    toTransfer.subresourceRange = range;
+    toTransfer.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                  vk::PipelineStageFlagBits::eTransfer,
+                                  {}, nullptr, nullptr, toTransfer);
+
+    std::vector<vk::BufferImageCopy> copies(regions.begin(), regions.end());
+    for (auto& copy : copies)
+        copy.bufferOffset += source.offset;
+    commandBuffer.copyBufferToImage(source.buffer, image,
+                                    vk::ImageLayout::eTransferDstOptimal, copies);
+
+    // Release and acquire must describe the same layout transition
+    vk::ImageMemoryBarrier barrier = toTransfer;
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = finalLayout;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = {};
+
+    if (HasDedicatedTransfer())
+    {
+        barrier.srcQueueFamilyIndex = m_queues.transferFamily;
+        barrier.dstQueueFamilyIndex = m_queues.graphicsFamily;
+        m_releaseImages.push_back(barrier);
+        barrier.srcAccessMask = {};
+    }
+
+    barrier.dstAccessMask = finalLayout == vk::ImageLayout::eTransferDstOptimal
+        ? vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite
+        : vk::AccessFlagBits::eShaderRead;
+    m_acquireImages.push_back(barrier);
+}
+
+vk::CommandBuffer UploadService::AfterTransfer()
+{
+    auto commandBuffer = GraphicsCommands();
+    FlushBarriers();
+    return commandBuffer;
+}
+
+UploadTicket UploadService::Submit()
+{
+    ZoneScoped;
+    if (!m_open.transfer && !m_open.graphics)
+        return {m_value};
+
+    if (m_open.transfer)
+    {
+        // Hand everything copied over to the graphics queue
+        m_open.transfer->pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                         vk::PipelineStageFlagBits::eBottomOfPipe,
+                                         {}, nullptr, m_releaseBuffers, m_releaseImages);
+        m_releaseBuffers.clear();
+        m_releaseImages.clear();
+        m_open.transfer->end();
+
+        m_transferValue++;
+        vk::TimelineSemaphoreSubmitInfo timelineInfo;
+        timelineInfo.setSignalSemaphoreValues(m_transferValue);
+
+        vk::SubmitInfo submitInfo;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.setCommandBuffers(*m_open.transfer);
+        submitInfo.setSignalSemaphores(*m_transferTimeline);
+        m_queues.transfer.submit(submitInfo);
+    }
+
+    auto commandBuffer = GraphicsCommands();
+    FlushBarriers();
+    commandBuffer.end();
+
+    m_value++;
+    vk::TimelineSemaphoreSubmitInfo timelineInfo;
+    timelineInfo.setSignalSemaphoreValues(m_value);
+
+    vk::SubmitInfo submitInfo;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.setCommandBuffers(commandBuffer);
+    submitInfo.setSignalSemaphores(*m_timeline);
+
+    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+    if (m_open.transfer)
+    {
+        timelineInfo.setWaitSemaphoreValues(m_transferValue);
+        submitInfo.setWaitSemaphores(*m_transferTimeline);
+        submitInfo.setWaitDstStageMask(waitStage);
+    }
+    m_queues.graphics.submit(submitInfo);
+
+    m_open.stagingEnd = m_head;
+    m_open.value = m_value;
+    m_inFlight.push_back(std::move(m_open));
+    m_open = {};
+
+    return {m_value};
+}
+
+bool UploadService::IsComplete(UploadTicket ticket) const
+{
+    return m_device.getSemaphoreCounterValue(*m_timeline, *m_dispatcher) >= ticket.value;
+}
+
+void UploadService::Wait(UploadTicket ticket) const
+{
+    ZoneScoped;
+    vk::SemaphoreWaitInfo waitInfo;
+    waitInfo.setSemaphores(*m_timeline);
+    waitInfo.setValues(ticket.value);
+    auto r = m_device.waitSemaphores(waitInfo, UINT64_MAX, *m_dispatcher);
+}
+
+void UploadService::Retire()
+{
+    if (m_inFlight.empty())
+        return;
+
+    uint64_t completed = m_device.getSemaphoreCounterValue(*m_timeline, *m_dispatcher);
+    while (!m_inFlight.empty() && m_inFlight.front().value <= completed)
+    {
+        m_tail = m_inFlight.front().stagingEnd;
+        m_inFlight.pop_front();
+    }
+}
+
+vk::CommandBuffer UploadService::TransferCommands()
+{
+    if (!HasDedicatedTransfer())
+        return GraphicsCommands();
+
+    if (!m_open.transfer)
+    {
+        vk::CommandBufferAllocateInfo allocInfo;
+        allocInfo.commandPool = *m_transferPool;
+        allocInfo.level = vk::CommandBufferLevel::ePrimary;
+        allocInfo.commandBufferCount = 1;
+        m_open.transfer = std::move(m_device.allocateCommandBuffersUnique(allocInfo).front());
+
+        vk::CommandBufferBeginInfo beginInfo;
+        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        m_open.transfer->begin(beginInfo);
+    }
+    return *m_open.transfer;
+}
+
+vk::CommandBuffer UploadService::GraphicsCommands()
+{
+    if (!m_open.graphics)
+    {
+        vk::CommandBufferAllocateInfo allocInfo;
+        allocInfo.commandPool = *m_graphicsPool;
+        allocInfo.level = vk::CommandBufferLevel::ePrimary;
+        allocInfo.commandBufferCount = 1;
+        m_open.graphics = std::move(m_device.allocateCommandBuffersUnique(allocInfo).front());
+
+        vk::CommandBufferBeginInfo beginInfo;
+        beginInfo.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        m_open.graphics->begin(beginInfo);
+    }
+    return *m_open.graphics;
+}
+
+void UploadService::FlushBarriers()
+{
+    if (m_acquireBuffers.empty() && m_acquireImages.empty())
+        return;
+
+    // Acquires are ordered by the semaphore wait, without a transfer queue
+    // the copies are in the same command buffer
+    auto srcStage = HasDedicatedTransfer()
+        ? vk::PipelineStageFlagBits::eTopOfPipe
+        : vk::PipelineStageFlagBits::eTransfer;
+    GraphicsCommands().pipelineBarrier(srcStage, vk::PipelineStageFlagBits::eAllCommands,
+                                       {}, nullptr, m_acquireBuffers, m_acquireImages);
+    m_acquireBuffers.clear();
+    m_acquireImages.clear();
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include "allocated.hpp"
+#include <vulkan/vulkan.hpp>
+#include <vk_mem_alloc.h>
+#include <deque>
+#include <span>
+#include <vector>
+
+// Completion point of submitted uploads, later tickets complete later
+struct UploadTicket
+{
+    uint64_t value = 0;
+};
+
+// Staging memory for an upload, valid until the batch it was staged for
+// retires. Offsets of copy regions are relative to it
+struct StagingAllocation
+{
+    vk::Buffer buffer;
+    vk::DeviceSize offset = 0;
+    std::span<uint8_t> data;
+};
+
+// Asynchronous uploads. Copies are recorded into an open batch and run on
+// a dedicated transfer queue when the device has one, the destinations
+// are then released to the graphics queue, where work that needs it, such
+// as mip blits, is recorded. Submitted batches signal a timeline semaphore
+// on the graphics queue and hand out a ticket to poll or wait on. Staging
+// memory comes from a persistently mapped ring buffer
+class UploadService
+{
+public:
+    struct Queues
+    {
+        uint32_t graphicsFamily;
+        vk::Queue graphics;
+        uint32_t transferFamily;
+        vk::Queue transfer;
+    };
+
+    // The dispatcher resolves the timeline semaphore calls, which are
+    // extensions on Vulkan 1.1
+    void Init(vk::Device device, const vk::DispatchLoaderDynamic& dispatcher,
+              VmaAllocator allocator, const Queues& queues, vk::DeviceSize stagingSize);
+    void Terminate();
+
+    bool HasDedicatedTransfer() const
+    {
+        return m_queues.transferFamily != m_queues.graphicsFamily;
+    }
+
+    // Blocks on the oldest batch when the ring is full. The data has to be
+    // written before the batch that copies it is submitted
+    StagingAllocation Stage(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+
+    void CopyToBuffer(const StagingAllocation& source, vk::Buffer destination,
+                      vk::DeviceSize destinationOffset = 0);
+    // The image starts undefined and ends in finalLayout once it reaches
+    // the graphics queue
+    void CopyToImage(const StagingAllocation& source, vk::Image image,
+                     const vk::ImageSubresourceRange& range,
+                     std::span<const vk::BufferImageCopy> regions,
+                     vk::ImageLayout finalLayout);
+
+    // Graphics queue commands of the open batch, they run after all copies
+    // recorded so far
+    vk::CommandBuffer AfterTransfer();
+
+    // Submits the open batch, an empty batch returns the last ticket
+    UploadTicket Submit();
+    bool IsComplete(UploadTicket ticket) const;
+    void Wait(UploadTicket ticket) const;
+    // Recycles staging memory and command buffers of finished batches
+    void Retire();
+
+    // Signaled with ticket values on the graphics queue, work that uses
+    // uploaded resources waits on it
+    vk::Semaphore GetTimeline() const { return *m_timeline; }
+
+private:
+    struct Batch
+    {
+        vk::UniqueCommandBuffer transfer;
+        vk::UniqueCommandBuffer graphics;
+        // Ring position past the last staged byte
+        uint64_t stagingEnd = 0;
+        // Payloads larger than the ring
+        std::vector<AllocatedBuffer> dedicated;
+        uint64_t value = 0;
+    };
+
+    vk::CommandBuffer TransferCommands();
+    vk::CommandBuffer GraphicsCommands();
+    void FlushBarriers();
+
+    vk::Device m_device;
+    const vk::DispatchLoaderDynamic* m_dispatcher = nullptr;
+    VmaAllocator m_allocator = {};
+    Queues m_queues;
+
+    vk::UniqueCommandPool m_transferPool;
+    vk::UniqueCommandPool m_graphicsPool;
+    vk::UniqueSemaphore m_transferTimeline;
+    vk::UniqueSemaphore m_timeline;
+    uint64_t m_transferValue = 0;
+    uint64_t m_value = 0;
+
+    AllocatedBuffer m_staging;
+    uint8_t* m_stagingData = nullptr;
+    vk::DeviceSize m_stagingSize = 0;
+    // Positions grow forever, the buffer offset is position % size
+    uint64_t m_head = 0;
+    uint64_t m_tail = 0;
+
+    Batch m_open;
+    std::vector<vk::BufferMemoryBarrier> m_releaseBuffers;
+    std::vector<vk::ImageMemoryBarrier> m_releaseImages;
+    std::vector<vk::BufferMemoryBarrier> m_acquireBuffers;
+    std::vector<vk::ImageMemoryBarrier> m_acquireImages;
+    std::deque<Batch> m_inFlight;
+};
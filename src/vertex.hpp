@@ -0,0 +1,96 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+#include <array>
+#include <vector>
+
+struct Vertex
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 color;
+    glm::vec2 textureCoord;
+    glm::vec4 tangent;
+
+    static std::array<vk::VertexInputAttributeDescription, 5>
+    AttributeDescriptions();
+
+    static vk::VertexInputBindingDescription BindingDescription();
+
+    bool operator==(const Vertex& other) const
+    {
+        return position == other.position
+            && normal == other.normal
+            && color == other.color
+            && textureCoord == other.textureCoord
+            && tangent == other.tangent;
+    }
+};
+
+// Quantized vertex, 20 bytes instead of 60. Position is relative to the
+// mesh bounds with the tangent sign in w, normal and tangent are
+// octahedral encoded and texture coordinates are half floats. There is no
+// color stream
+struct PackedVertex
+{
+    uint16_t position[4];
+    int16_t normal[2];
+    int16_t tangent[2];
+    uint16_t textureCoord[2];
+
+    static std::array<vk::VertexInputAttributeDescription, 4>
+    AttributeDescriptions();
+
+    static vk::VertexInputBindingDescription BindingDescription();
+};
+
+enum class VertexFormat : uint8_t
+{
+    Full,
+    Packed
+};
+
+constexpr std::size_t VertexFormatCount = 2;
+
+// Vertex inputs a material consumes, bit index is the shader location
+namespace VertexAttribute
+{
+    enum : uint32_t
+    {
+        Position = 1 << 0,
+        Normal = 1 << 1,
+        Color = 1 << 2,
+        TextureCoord = 1 << 3,
+        Tangent = 1 << 4,
+        All = Position | Normal | Color | TextureCoord | Tangent
+    };
+}
+using VertexAttributes = uint32_t;
+
+// Binding and the attributes of format selected by the mask
+vk::VertexInputBindingDescription VertexBindingDescription(VertexFormat format);
+std::vector<vk::VertexInputAttributeDescription>
+VertexAttributeDescriptions(VertexFormat format, VertexAttributes attributes);
+
+inline void hash_combine(std::size_t& seed) { }
+
+template <typename T, typename... Rest>
+inline void hash_combine(std::size_t& seed, const T& v, Rest... rest) {
+    std::hash<T> hasher;
+    seed ^= hasher(v) + 0x9e3779b9 + (seed<<6) + (seed>>2);
+    hash_combine(seed, rest...);
+}
+
+
+namespace std {
+    template<> struct hash<Vertex> {
+        size_t operator()(Vertex const& vertex) const {
+            std::size_t seed = 31;
+            hash_combine(
+                seed, vertex.position, vertex.normal, vertex.color,
+                vertex.textureCoord, vertex.tangent);
+            return seed;
+                }
+    };
+}
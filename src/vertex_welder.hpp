@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <bit>
+#include <algorithm>
+#include <utility>
+
+// Flat open addressing table used to weld mesh corners into unique
+// vertices. Keys are small PODs describing a corner, values are indices
+// into the output vertex array. Linear probing over a power of two slot
+// array keeps every lookup to a single probe sequence which either finds
+// the key or claims the first free slot
+template<typename Key, typename Hash>
+class VertexWelder
+{
+public:
+    explicit VertexWelder(std::size_t expected = 0)
+    {
+        Rehash(std::bit_ceil(std::max<std::size_t>(expected + expected / 2, 16)));
+    }
+
+    // Returns the index stored for key and whether it was inserted, index
+    // is stored when the key was not present yet
+    std::pair<uint32_t, bool> Insert(const Key& key, uint32_t index)
+    {
+        if ((m_size + 1) * 3 > m_slots.size() * 2)
+            Rehash(m_slots.size() * 2);
+
+        for (std::size_t i = Hash{}(key) & m_mask;; i = (i + 1) & m_mask)
+        {
+            Slot& slot = m_slots[i];
+            if (slot.index == s_empty)
+            {
+                slot.key = key;
+                slot.index = index;
+                m_size++;
+                return {index, true};
+            }
+
+            if (slot.key == key)
+                return {slot.index, false};
+        }
+    }
+
+    std::size_t Size() const { return m_size; }
+
+private:
+    static constexpr uint32_t s_empty = UINT32_MAX;
+
+    struct Slot
+    {
+        Key key;
+        uint32_t index = s_empty;
+    };
+
+    void Rehash(std::size_t capacity)
+    {
+        std::vector<Slot> old(capacity);
+        std::swap(old, m_slots);
+        m_mask = capacity - 1;
+
+        for (const Slot& slot : old)
+        {
+            if (slot.index == s_empty)
+                continue;
+
+            std::size_t i = Hash{}(slot.key) & m_mask;
+            while (m_slots[i].index != s_empty)
+                i = (i + 1) & m_mask;
+            m_slots[i] = slot;
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    std::size_t m_mask = 0;
+    std::size_t m_size = 0;
+};
+
+inline uint64_t WeldMix(uint64_t seed, uint64_t value)
+{
+    seed ^= value * 0x9E3779B97F4A7C15ull;
+    seed = (seed ^ (seed >> 31)) * 0xBF58476D1CE4E5B9ull;
+    return seed ^ (seed >> 29);
+}
@@ -0,0 +1,169 @@
+#include "mesh_processing.hpp"
+#include "thread_pool.hpp"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// MeshProcessing::GenerateTangents has to match the scalar loops it
+// replaced bit for bit, on any number of threads
+
+namespace
+{
+    // The scalar tangent, centroid and bounds loops as they were before
+    // GenerateTangents
+    MeshProcessing::Summary Reference(std::vector<Vertex>& vertices,
+                                      const std::vector<uint32_t>& indices)
+    {
+        std::vector<glm::vec3> tan1(vertices.size(), glm::vec3(0));
+        std::vector<glm::vec3> tan2(vertices.size(), glm::vec3(0));
+
+        for (std::size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            auto& vertex0 = vertices[indices[i]];
+            auto& vertex1 = vertices[indices[i + 1]];
+            auto& vertex2 = vertices[indices[i + 2]];
+
+            glm::vec3 v1 = vertex0.position;
+            glm::vec3 v2 = vertex1.position;
+            glm::vec3 v3 = vertex2.position;
+
+            glm::vec2 w1 = vertex0.textureCoord;
+            glm::vec2 w2 = vertex1.textureCoord;
+            glm::vec2 w3 = vertex2.textureCoord;
+
+            float x1 = v2.x - v1.x;
+            float x2 = v3.x - v1.x;
+            float y1 = v2.y - v1.y;
+            float y2 = v3.y - v1.y;
+            float z1 = v2.z - v1.z;
+            float z2 = v3.z - v1.z;
+
+            float s1 = w2.x - w1.x;
+            float s2 = w3.x - w1.x;
+            float t1 = w2.y - w1.y;
+            float t2 = w3.y - w1.y;
+
+            float r = 1.0F / (s1 * t2 - s2 * t1);
+            glm::vec3 sdir((t2 * x1 - t1 * x2) * r, (t2 * y1 - t1 * y2) * r,
+                           (t2 * z1 - t1 * z2) * r);
+            glm::vec3 tdir((s1 * x2 - s2 * x1) * r, (s1 * y2 - s2 * y1) * r,
+                           (s1 * z2 - s2 * z1) * r);
+
+            tan1[indices[i]] += sdir;
+            tan1[indices[i + 1]] += sdir;
+            tan1[indices[i + 2]] += sdir;
+
+            tan2[indices[i]] += tdir;
+            tan2[indices[i + 1]] += tdir;
+            tan2[indices[i + 2]] += tdir;
+        }
+
+        for (std::size_t a = 0; a < vertices.size(); a++)
+        {
+            const glm::vec3& n = vertices[a].normal;
+            const glm::vec3& t = tan1[a];
+
+            // Gram-Schmidt orthogonalize
+            vertices[a].tangent = glm::vec4(glm::normalize(t - n * glm::dot(n, t)), 1.f);
+
+            // Calculate handedness
+            vertices[a].tangent.w =
+                (glm::dot(glm::cross(n, t), tan2[a]) < 0.0F) ? -1.0F : 1.0F;
+        }
+
+        float areaSum = 0.0;
+        glm::vec3 centroid(0.0);
+        for (std::size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            glm::vec3 v1 = vertices[indices[i]].position;
+            glm::vec3 v2 = vertices[indices[i + 1]].position;
+            glm::vec3 v3 = vertices[indices[i + 2]].position;
+
+            glm::vec3 center = (v1 + v2 + v3) / 3.f;
+            float area = 0.5 * glm::length(glm::cross(v2 - v1, v3 - v1));
+            centroid += area * center;
+            areaSum += area;
+        }
+
+        MeshProcessing::Summary summary;
+        summary.surfaceCenter = centroid / areaSum;
+        summary.min = vertices.front().position;
+        summary.max = vertices.front().position;
+        for (const auto& vertex : vertices)
+        {
+            summary.min = glm::min(summary.min, vertex.position);
+            summary.max = glm::max(summary.max, vertex.position);
+        }
+        return summary;
+    }
+
+    void RandomMesh(uint32_t seed, std::size_t vertexCount, std::size_t triangleCount,
+                    std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::uniform_int_distribution<uint32_t> index(0, vertexCount - 1);
+
+        vertices.resize(vertexCount);
+        for (auto& vertex : vertices)
+        {
+            vertex = {};
+            vertex.position = glm::vec3(unit(random), unit(random), unit(random)) * 10.0f;
+            vertex.normal = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)));
+            vertex.textureCoord = glm::vec2(unit(random), unit(random));
+        }
+
+        indices.resize(triangleCount * 3);
+        for (auto& i : indices)
+            i = index(random);
+    }
+
+    bool Matches(const std::vector<Vertex>& expected, const MeshProcessing::Summary& expectedSummary,
+                 const std::vector<Vertex>& actual, const MeshProcessing::Summary& actualSummary)
+    {
+        return std::memcmp(expected.data(), actual.data(), expected.size() * sizeof(Vertex)) == 0
+            && std::memcmp(&expectedSummary.surfaceCenter, &actualSummary.surfaceCenter,
+                           sizeof(glm::vec3)) == 0
+            && std::memcmp(&expectedSummary.min, &actualSummary.min, sizeof(glm::vec3)) == 0
+            && std::memcmp(&expectedSummary.max, &actualSummary.max, sizeof(glm::vec3)) == 0;
+    }
+}
+
+int main()
+{
+    struct Case
+    {
+        uint32_t seed;
+        std::size_t vertexCount;
+        std::size_t triangleCount;
+    };
+    // Large enough to split into many batches
+    const Case cases[] {{1, 100, 150}, {2, 20000, 40000}, {3, 150000, 100000}};
+    const unsigned threadCounts[] {0, 1, 3, 7};
+
+    int failures = 0;
+    for (const auto& test : cases)
+    {
+        std::vector<Vertex> source;
+        std::vector<uint32_t> indices;
+        RandomMesh(test.seed, test.vertexCount, test.triangleCount, source, indices);
+
+        std::vector<Vertex> expected = source;
+        auto expectedSummary = Reference(expected, indices);
+
+        for (unsigned threads : threadCounts)
+        {
+            ThreadPool pool(threads);
+            std::vector<Vertex> actual = source;
+            auto actualSummary = MeshProcessing::GenerateTangents(actual, indices, pool);
+
+            bool ok = Matches(expected, expectedSummary, actual, actualSummary);
+            std::printf("seed %u, %zu vertices, %u threads: %s\n", test.seed,
+                        test.vertexCount, threads, ok ? "ok" : "MISMATCH");
+            failures += !ok;
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
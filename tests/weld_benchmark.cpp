@@ -0,0 +1,114 @@
+#include "obj_loader.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+// Times welding the corners of every OBJ in a directory, res/models by
+// default, with the std::unordered_map<Vertex, uint32_t> ObjLoader used
+// before VertexWelder and with ObjLoader::Weld itself
+
+namespace
+{
+    constexpr int s_runs = 5;
+    constexpr float s_epsilon = 1e-4f;
+
+    // The map based weld as it was before VertexWelder. Epsilon mode keys
+    // the map on vertices snapped to the welding grid
+    ObjLoader::Result MapWeld(const ObjLoader::Attributes& attributes, float epsilon)
+    {
+        ObjLoader::Result result;
+        std::unordered_map<Vertex, uint32_t> uniqueVertices;
+        uniqueVertices.reserve(attributes.positions.size());
+        result.indices.reserve(attributes.corners.size());
+
+        float scale = epsilon > 0.0f ? 1.0f / epsilon : 0.0f;
+        for (const auto& corner : attributes.corners)
+        {
+            Vertex vertex = ObjLoader::MakeVertex(attributes, corner);
+            Vertex key = vertex;
+            if (epsilon > 0.0f)
+            {
+                auto snap = [scale](auto value) { return glm::floor(value * scale + 0.5f); };
+                key.position = snap(key.position);
+                key.normal = snap(key.normal);
+                key.textureCoord = snap(key.textureCoord);
+            }
+
+            auto [it, inserted] = uniqueVertices.try_emplace(
+                key, static_cast<uint32_t>(result.vertices.size()));
+            if (inserted)
+            {
+                result.vertices.push_back(vertex);
+            }
+
+            result.indices.push_back(it->second);
+        }
+        return result;
+    }
+
+    // Best of several runs in milliseconds, and the vertex count welded
+    template<typename WeldFunc>
+    std::pair<double, std::size_t> Time(WeldFunc weld)
+    {
+        double best = INFINITY;
+        std::size_t vertices = 0;
+        for (int run = 0; run < s_runs; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            ObjLoader::Result result = weld();
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+            vertices = result.vertices.size();
+        }
+        return {best, vertices};
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::filesystem::path directory = argc > 1 ? argv[1] : "res/models";
+    if (!std::filesystem::is_directory(directory))
+    {
+        std::fprintf(stderr, "%s is not a directory\n", directory.string().c_str());
+        return 1;
+    }
+
+    std::printf("%-32s %-8s %10s %10s %12s %12s\n", "model", "mode", "corners",
+                "vertices", "map ms", "welder ms");
+
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+    {
+        if (entry.path().extension() != ".obj")
+            continue;
+
+        std::ifstream file(entry.path(), std::ios::binary);
+        std::stringstream source;
+        source << file.rdbuf();
+        ObjLoader::Attributes attributes = ObjLoader::Parse(source.str());
+
+        for (float epsilon : {0.0f, s_epsilon})
+        {
+            auto [mapTime, mapVertices] = Time([&] { return MapWeld(attributes, epsilon); });
+            auto [welderTime, welderVertices] = Time([&] {
+                return ObjLoader::Weld(attributes, {.weldEpsilon = epsilon});
+            });
+
+            std::printf("%-32s %-8s %10zu %10zu %12.2f %12.2f\n",
+                        entry.path().filename().string().c_str(),
+                        epsilon > 0.0f ? "epsilon" : "exact", attributes.corners.size(),
+                        welderVertices, mapTime, welderTime);
+            if (mapVertices != welderVertices)
+            {
+                std::printf("%-32s map welded %zu vertices\n", "", mapVertices);
+            }
+        }
+    }
+
+    return 0;
+}